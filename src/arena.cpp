@@ -0,0 +1,167 @@
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <vitasdk.h>
+
+#include "arena.h"
+
+static std::vector<char*> blocks;
+static size_t block_size = 0;
+static size_t block_used = 0;
+// open addressing on the string hash, nullptr marks a free slot
+static std::vector<const char*> table;
+static ArenaStats arena_stats;
+// the scanner workers fill in games next to the ui thread
+static SceUID arena_mutex = -1;
+
+namespace ARENA {
+    void Init()
+    {
+        arena_mutex = sceKernelCreateMutex("arena_mutex", 0, 0, NULL);
+        table.assign(ARENA_TABLE_SIZE, nullptr);
+        memset(&arena_stats, 0, sizeof(ArenaStats));
+    }
+
+    static uint32_t Hash(const char *text, size_t length)
+    {
+        uint32_t hash = 0x811c9dc5;
+        for (size_t i = 0; i < length; i++)
+        {
+            hash = (hash ^ (unsigned char)text[i]) * 0x01000193;
+        }
+        return hash;
+    }
+
+    static char *Allocate(size_t size)
+    {
+        if (block_used + size > block_size)
+        {
+            if (blocks.size() > 0)
+            {
+                arena_stats.wasted += block_size - block_used;
+            }
+            block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            block_used = 0;
+            blocks.push_back((char*)malloc(block_size));
+            arena_stats.blocks++;
+        }
+        char *text = blocks.back() + block_used;
+        block_used += size;
+        arena_stats.used += size;
+        return text;
+    }
+
+    static void GrowTable()
+    {
+        std::vector<const char*> old_table;
+        old_table.swap(table);
+        table.assign(old_table.size() * 2, nullptr);
+        size_t mask = table.size() - 1;
+        for (size_t i = 0; i < old_table.size(); i++)
+        {
+            if (old_table[i] != nullptr)
+            {
+                size_t slot = Hash(old_table[i], strlen(old_table[i])) & mask;
+                while (table[slot] != nullptr)
+                {
+                    slot = (slot + 1) & mask;
+                }
+                table[slot] = old_table[i];
+            }
+        }
+    }
+
+    const char *Copy(const char *text, size_t length)
+    {
+        if (text == nullptr || text[0] == 0 || length == 0)
+        {
+            return "";
+        }
+        length = strnlen(text, length);
+        uint32_t hash = Hash(text, length);
+
+        sceKernelLockMutex(arena_mutex, 1, NULL);
+        size_t mask = table.size() - 1;
+        size_t slot = hash & mask;
+        while (table[slot] != nullptr)
+        {
+            if (strncmp(table[slot], text, length) == 0 && table[slot][length] == 0)
+            {
+                const char *shared = table[slot];
+                arena_stats.shared += length + 1;
+                sceKernelUnlockMutex(arena_mutex, 1);
+                return shared;
+            }
+            slot = (slot + 1) & mask;
+        }
+
+        char *copy = Allocate(length + 1);
+        memcpy(copy, text, length);
+        copy[length] = 0;
+        table[slot] = copy;
+        arena_stats.strings++;
+        if (arena_stats.strings * 4 > table.size() * 3)
+        {
+            GrowTable();
+        }
+        sceKernelUnlockMutex(arena_mutex, 1);
+        return copy;
+    }
+
+    const char *Copy(const char *text)
+    {
+        if (text == nullptr)
+        {
+            return "";
+        }
+        return Copy(text, strlen(text));
+    }
+
+    const char *Format(const char *format, ...)
+    {
+        char buffer[512];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (length < 0)
+        {
+            return "";
+        }
+        if (length < sizeof(buffer))
+        {
+            return Copy(buffer, length);
+        }
+
+        std::vector<char> text(length + 1);
+        va_start(args, format);
+        vsnprintf(text.data(), text.size(), format, args);
+        va_end(args);
+        return Copy(text.data(), length);
+    }
+
+    void Reset()
+    {
+        sceKernelLockMutex(arena_mutex, 1, NULL);
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            free(blocks[i]);
+        }
+        std::vector<char*>().swap(blocks);
+        block_size = 0;
+        block_used = 0;
+        std::vector<const char*>(ARENA_TABLE_SIZE, nullptr).swap(table);
+        memset(&arena_stats, 0, sizeof(ArenaStats));
+        sceKernelUnlockMutex(arena_mutex, 1);
+    }
+
+    void GetStats(ArenaStats *stats)
+    {
+        sceKernelLockMutex(arena_mutex, 1, NULL);
+        *stats = arena_stats;
+        sceKernelUnlockMutex(arena_mutex, 1);
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef LAUNCHER_ARENA_H
+#define LAUNCHER_ARENA_H
+
+#pragma once
+#include <cstddef>
+
+#define ARENA_BLOCK_SIZE 0x10000
+#define ARENA_TABLE_SIZE 0x4000
+
+typedef struct {
+    int strings;
+    int blocks;
+    size_t used;    // bytes of the strings in the blocks
+    size_t wasted;  // ends of full blocks too short for the next string
+    size_t shared;  // bytes handed out again instead of copied
+} ArenaStats;
+
+// The strings of the games, id, title and rom_path, are kept once in large blocks
+// instead of fixed buffers in every Game. Copying a string that is already there
+// returns the same pointer, so favorites, search results and the games read again
+// on every refresh share their bytes. Strings are never freed one by one, they
+// stay valid until Reset.
+namespace ARENA {
+    void Init();
+    const char *Copy(const char *text);
+    // copies at most length bytes of text
+    const char *Copy(const char *text, size_t length);
+    const char *Format(const char *format, ...);
+    // frees every string, the caller makes sure no Game points into the arena anymore
+    void Reset();
+    void GetStats(ArenaStats *stats);
+}
+
+#endif
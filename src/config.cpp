@@ -17,6 +17,7 @@ bool parental_control;
 char search_text[32];
 bool new_icon_method;
 bool swap_xo;
+int insert_batch_size;
 
 namespace CONFIG {
 
@@ -37,7 +38,7 @@ namespace CONFIG {
         category->rom_type = rom_type;
 
         Folder root_folder;
-        sprintf(root_folder.category, category->category);
+        root_folder.category = category->id;
         root_folder.id = FOLDER_ROOT_ID;
         root_folder.type = FOLDER_TYPE_ROOT;
         sprintf(root_folder.icon_path, "ux0:app/SMLA00001/folder.png");
@@ -49,6 +50,7 @@ namespace CONFIG {
 
         category->order = ReadInt(category->title, CONFIG_CATEGORY_ORDER, category_id);
         WriteInt(category->title, CONFIG_CATEGORY_ORDER, category->order);
+        category->sort_order = ReadInt(category->title, CONFIG_SORT_ORDER, SORT_ORDER_TITLE);
 
         category->rows = ReadInt(category->title, CONFIG_GRID_ROWS, 3);
         if (category->rows <= 2)
@@ -189,6 +191,9 @@ namespace CONFIG {
         swap_xo = ReadBool(CONFIG_GLOBAL, CONFIG_SWAP_XO, false);
         WriteBool(CONFIG_GLOBAL, CONFIG_SWAP_XO, swap_xo);
 
+        insert_batch_size = ReadInt(CONFIG_GLOBAL, CONFIG_INSERT_BATCH_SIZE, DEFAULT_INSERT_BATCH_SIZE);
+        WriteInt(CONFIG_GLOBAL, CONFIG_INSERT_BATCH_SIZE, insert_batch_size);
+
         // Load parental control config
         parental_control = ReadBool(CONFIG_GLOBAL, CONFIG_PARENT_CONTROL, false);
         WriteBool(CONFIG_GLOBAL, CONFIG_PARENT_CONTROL, parental_control);
@@ -246,6 +251,7 @@ namespace CONFIG {
         SetupCategory(&game_categories[EMULATORS], EMULATORS, "emulator", "Emulators", nullptr, nullptr, "", nullptr, nullptr, TYPE_BUBBLE, nullptr, 3);
         SetupCategory(&game_categories[HOMEBREWS], HOMEBREWS, "homebrew", "Homebrews", nullptr, nullptr, nullptr, nullptr, nullptr, TYPE_BUBBLE, nullptr, 3);
         SetupCategory(&game_categories[FAVORITES], FAVORITES, "favorites", "Favorites", nullptr, nullptr, nullptr, nullptr, nullptr, TYPE_BUBBLE, nullptr, 3);
+        GAME::CompileExtensionMatchers();
 
         WriteIniFile(CONFIG_INI_FILE);
         CloseIniFile();
@@ -286,6 +292,7 @@ namespace CONFIG {
         category.id = cat->id;
         category.rom_type = cat->rom_type;
         category.view_mode = ReadInt(cat->title, CONFIG_VIEW_MODE, VIEW_MODE_GRID);
+        category.sort_order = ReadInt(cat->title, CONFIG_SORT_ORDER, SORT_ORDER_TITLE);
         sprintf(category.alt_title, "%s", ReadString(cat->title, CONFIG_ALT_TITLE, ""));
         char* valid_title_prefixes = ReadString(cat->title, CONFIG_TITLE_ID_PREFIXES, "");
         ParseMultiValueString(valid_title_prefixes, category.valid_title_ids, false);
@@ -326,6 +333,7 @@ namespace CONFIG {
         OpenIniFile(CONFIG_INI_FILE);
 
         WriteInt(cat->title, CONFIG_VIEW_MODE, cat->view_mode);
+        WriteInt(cat->title, CONFIG_SORT_ORDER, cat->sort_order);
         WriteString(cat->title, CONFIG_ALT_TITLE, cat->alt_title);
         WriteInt(cat->title, CONFIG_GRID_ROWS, cat->rows);
         if (cat->id != FAVORITES && cat->id != HOMEBREWS)
@@ -340,6 +348,7 @@ namespace CONFIG {
             WriteString(cat->title, CONFIG_ROMS_PATH, cat->roms_path);
             WriteString(cat->title, CONFIG_ICON_PATH, cat->icon_path);
             WriteString(cat->title, CONFIG_ROM_EXTENSIONS, GetMultiValueString(cat->file_filters).c_str());
+            GAME::CompileExtensionMatchers();
             WriteString(cat->title, CONFIG_ALT_CORES, GetMultiValueString(cat->alt_cores).c_str());
             WriteBool(cat->title, CONFIG_BOOT_WITH_ALT_CORE, cat->boot_with_alt_core);
             WriteInt(cat->title, CONFIG_ICON_TYPE, cat->icon_type);
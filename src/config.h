@@ -36,6 +36,7 @@
 #define CONFIG_GRID_ROWS "grid_rows"
 #define CONFIG_NEW_ICON_METHOD "new_icon_method"
 #define CONFIG_ICON_TYPE "icon_type"
+#define CONFIG_SORT_ORDER "sort_order"
 
 #define DEFAULT_ADERNALINE_LAUNCHER_TITLE_ID "ADRLANCHR"
 #define RETROARCH_TITLE_ID "RETROVITA"
@@ -50,6 +51,8 @@
 #define CONFIG_STYLE_NAME "style"
 #define CONFIG_DEFAULT_STYLE_NAME "Default"
 #define CONFIG_SWAP_XO "swap_xo"
+#define CONFIG_INSERT_BATCH_SIZE "insert_batch_size"
+#define DEFAULT_INSERT_BATCH_SIZE 200
 
 #define ICON_TYPE_BOXARTS "Boxarts"
 #define ICON_TYPE_TITLES "Titles"
@@ -205,6 +208,7 @@ extern bool parental_control;
 extern char search_text[];
 extern bool new_icon_method;
 extern bool swap_xo;
+extern int insert_batch_size;
 
 namespace CONFIG {
     void LoadConfig();
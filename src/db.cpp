@@ -1,31 +1,315 @@
 #include <stdio.h>
+#include <vitasdk.h>
 #include <string.h>
 #include <algorithm>
+#include <iterator>
+#include <list>
+#include <map>
+#include <set>
 #include "sqlite3.h"
+#include "vfs_cache.h"
 #include "db.h"
+#include "fs.h"
 #include "game.h"
 #include "textures.h"
 //#include "debugnet.h"
 
+typedef struct {
+    std::string sql;
+    sqlite3_stmt *stmt;
+    bool in_use;
+} CachedStatement;
+
+typedef struct {
+    std::string path;
+    sqlite3 *db;
+    SceUID mutex;
+    int users;
+    uint64_t last_used;
+    std::list<CachedStatement> statements;  // most recently used first
+} Connection;
+
+DbCounters db_counters;
+static std::vector<Connection*> connections;
+static SceUID connections_mutex = -1;
+
+// the index of the thumbnails db matched last, DownloadThumbnails goes through one category at a time
+static ThumbnailIndex thumbnail_index;
+static SceUID thumbnail_index_mutex = -1;
+// per game boot settings by rom path, dirty ones are waiting for game_settings_thread
+static std::map<std::string, BootSettings> psp_game_settings;
+static std::map<std::string, std::string> rom_core_settings;
+static std::set<std::string> dirty_psp_game_settings;
+static std::set<std::string> dirty_rom_core_settings;
+static bool game_settings_loaded = false;
+static SceUID game_settings_mutex = -1;
+static SceUID game_settings_write_mutex = -1;
+static SceUID game_settings_pending = -1;
+static SceUID game_settings_thid = -1;
+
+static const char *ROMAN_NUMERALS[] = {"I", "II", "III", "IV", "V", "VI", "VII", "VIII"};
+
 namespace DB {
+    static void LockConnections()
+    {
+        if (connections_mutex < 0)
+        {
+            connections_mutex = sceKernelCreateMutex("db_connections_mutex", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
+        }
+        sceKernelLockMutex(connections_mutex, 1, NULL);
+    }
+
+    static void UnlockConnections()
+    {
+        sceKernelUnlockMutex(connections_mutex, 1);
+    }
+
+    static Connection* FindConnection(sqlite3 *db)
+    {
+        for (int i=0; i < connections.size(); i++)
+        {
+            if (connections[i]->db == db)
+            {
+                return connections[i];
+            }
+        }
+        return nullptr;
+    }
+
+    static void CloseConnection(Connection *connection)
+    {
+        for (std::list<CachedStatement>::iterator it=connection->statements.begin(); it!=connection->statements.end(); ++it)
+        {
+            sqlite3_finalize(it->stmt);
+        }
+        sqlite3_close(connection->db);
+        sceKernelDeleteMutex(connection->mutex);
+        delete connection;
+    }
+
+    // the least recently used connection nobody holds makes room for a new one
+    static void EvictConnection()
+    {
+        int oldest = -1;
+        for (int i=0; i < connections.size(); i++)
+        {
+            if (connections[i]->users == 0 && (oldest < 0 || connections[i]->last_used < connections[oldest]->last_used))
+            {
+                oldest = i;
+            }
+        }
+
+        if (oldest >= 0)
+        {
+            CloseConnection(connections[oldest]);
+            connections.erase(connections.begin() + oldest);
+        }
+    }
+
+    static int BusyHandler(void *data, int count)
+    {
+        if ((count + 1) * DB_BUSY_RETRY_DELAY > DB_BUSY_TIMEOUT)
+        {
+            return 0;
+        }
+        db_counters.busy_waits++;
+        sceKernelDelayThread(DB_BUSY_RETRY_DELAY);
+        return 1;
+    }
+
+    int Open(const char *path, sqlite3 **db)
+    {
+        int rc = sqlite3_open(path, db);
+        sqlite3_busy_handler(*db, BusyHandler, nullptr);
+        return rc;
+    }
+
+    sqlite3* Acquire(const char *path)
+    {
+        LockConnections();
+        Connection *connection = nullptr;
+        for (int i=0; i < connections.size(); i++)
+        {
+            if (connections[i]->path == path)
+            {
+                connection = connections[i];
+                break;
+            }
+        }
+
+        if (connection == nullptr)
+        {
+            if (connections.size() >= DB_MAX_CONNECTIONS)
+            {
+                EvictConnection();
+            }
+            connection = new Connection();
+            connection->path = path;
+            connection->mutex = sceKernelCreateMutex("db_connection_mutex", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
+            connection->users = 0;
+            Open(path, &connection->db);
+            db_counters.opens++;
+            connections.push_back(connection);
+        }
+        connection->users++;
+        connection->last_used = sceKernelGetProcessTimeWide();
+        UnlockConnections();
+
+        sceKernelLockMutex(connection->mutex, 1, NULL);
+        return connection->db;
+    }
+
+    void Release(sqlite3 *db)
+    {
+        LockConnections();
+        Connection *connection = FindConnection(db);
+        if (connection != nullptr)
+        {
+            connection->users--;
+            sceKernelUnlockMutex(connection->mutex, 1);
+        }
+        UnlockConnections();
+    }
+
+    // Statements of connections that did not come from Acquire are not cached,
+    // their owner closes them.
+    int Prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt)
+    {
+        LockConnections();
+        Connection *connection = FindConnection(db);
+        UnlockConnections();
+
+        if (connection != nullptr)
+        {
+            std::list<CachedStatement> &statements = connection->statements;
+            for (std::list<CachedStatement>::iterator it=statements.begin(); it!=statements.end(); ++it)
+            {
+                if (!it->in_use && it->sql == sql)
+                {
+                    it->in_use = true;
+                    *stmt = it->stmt;
+                    statements.splice(statements.begin(), statements, it);
+                    db_counters.cached_prepares++;
+                    return SQLITE_OK;
+                }
+            }
+        }
+
+        db_counters.prepares++;
+        int rc = sqlite3_prepare_v2(db, sql, -1, stmt, nullptr);
+        if (rc != SQLITE_OK || connection == nullptr)
+        {
+            return rc;
+        }
+
+        CachedStatement cached;
+        cached.sql = sql;
+        cached.stmt = *stmt;
+        cached.in_use = true;
+        connection->statements.push_front(cached);
+        if (connection->statements.size() > DB_STATEMENT_CACHE_SIZE)
+        {
+            std::list<CachedStatement>::reverse_iterator oldest = connection->statements.rbegin();
+            while (oldest != connection->statements.rend() && oldest->in_use)
+            {
+                ++oldest;
+            }
+            if (oldest != connection->statements.rend())
+            {
+                sqlite3_finalize(oldest->stmt);
+                connection->statements.erase(--(oldest.base()));
+            }
+        }
+        return rc;
+    }
+
+    int Step(sqlite3_stmt *stmt)
+    {
+        db_counters.steps++;
+        return sqlite3_step(stmt);
+    }
+
+    // puts a cached statement back for the next Prepare of the same sql
+    void Finish(sqlite3_stmt *stmt)
+    {
+        if (stmt == nullptr)
+        {
+            return;
+        }
+
+        LockConnections();
+        Connection *connection = FindConnection(sqlite3_db_handle(stmt));
+        UnlockConnections();
+
+        if (connection != nullptr)
+        {
+            for (std::list<CachedStatement>::iterator it=connection->statements.begin(); it!=connection->statements.end(); ++it)
+            {
+                if (it->stmt == stmt)
+                {
+                    sqlite3_reset(stmt);
+                    sqlite3_clear_bindings(stmt);
+                    it->in_use = false;
+                    return;
+                }
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    // connections a thread still holds stay open
+    void CloseConnections()
+    {
+        LockConnections();
+        for (std::vector<Connection*>::iterator it=connections.begin(); it!=connections.end(); )
+        {
+            if ((*it)->users == 0)
+            {
+                CloseConnection(*it);
+                it = connections.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        UnlockConnections();
+    }
+
+    void LogCounters(const char *label)
+    {
+        ArenaStats arena;
+        ARENA::GetStats(&arena);
+        char line[448];
+        snprintf(line, 448, "%s db_opens=%d db_prepares=%d db_cached_prepares=%d db_steps=%d db_busy_waits=%d"
+            " vfs_reads=%d vfs_read_hits=%d vfs_io_reads=%d vfs_io_read_kb=%lld vfs_writes=%d vfs_io_writes=%d vfs_invalidations=%d"
+            " arena_strings=%d arena_blocks=%d arena_used_kb=%d arena_wasted_kb=%d arena_shared_kb=%d\n",
+            label, db_counters.opens, db_counters.prepares, db_counters.cached_prepares, db_counters.steps, db_counters.busy_waits,
+            vfs_cache_stats.reads, vfs_cache_stats.read_hits, vfs_cache_stats.backend_reads,
+            (long long)(vfs_cache_stats.backend_read_bytes / 1024), vfs_cache_stats.writes,
+            vfs_cache_stats.backend_writes, vfs_cache_stats.invalidations,
+            arena.strings, arena.blocks, (int)(arena.used / 1024), (int)(arena.wasted / 1024), (int)(arena.shared / 1024));
+        FS::AppendText(SCAN_STATS_LOG_FILE, line);
+    }
+
     bool TableExists(sqlite3 *database, char* table_name)
     {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         bool found = false;
         std::string sql = "SELECT name FROM sqlite_master WHERE type='table' AND name=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
         
         if (rc == SQLITE_OK) {
             sqlite3_bind_text(res, 1, table_name, strlen(table_name), NULL);
 
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
             if (step == SQLITE_ROW) {
                 found = true;
             }
@@ -33,7 +317,7 @@ namespace DB {
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
         return found;
     }
@@ -43,17 +327,17 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         bool found = false;
         std::string sql = std::string("PRAGMA table_info(") + table_name + ")";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
         
         if (rc == SQLITE_OK) {
             char db_col_name[256];
-            while (sqlite3_step(res) == SQLITE_ROW)
+            while (Step(res) == SQLITE_ROW)
             {
                 sprintf(db_col_name, "%s", sqlite3_column_text(res, 1));
                 if (strcmp(db_col_name, column_name) == 0)
@@ -62,44 +346,55 @@ namespace DB {
                     break;
                 }
             }
-            sqlite3_finalize(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
         return found;
     }
 
-    void GetVitaDbGames()
+    // the bubbles app.db lists, count and rows come from the same query
+    void GetVitaDbGames(std::vector<Game> &games)
     {
         sqlite3 *db;
         sqlite3_stmt *res;
 
-        int rc = sqlite3_open(VITA_APP_DB_FILE, &db);
+        db = Acquire(VITA_APP_DB_FILE);
+        int rc;
         std::string sql = std::string("select titleId,val,folder_id ") +
             "from tbl_appinfo left join app_folders on tbl_appinfo.titleId = app_folders.id " +
             "where tbl_appinfo.key=572932585 and tbl_appinfo.titleID not like 'NPXS%'";
         bool app_folder_exists = TableExists(db, APP_FOLDERS_TABLE);
         if (!app_folder_exists)
+        {
+            // the system can rebuild app.db, which drops the folders of the bubbles
+            std::string create = std::string("CREATE TABLE ") + APP_FOLDERS_TABLE + "(" +
+                COL_ID + " TEXT," +
+                COL_FOLDER_ID + " INTEGER," +
+                "PRIMARY KEY(" + COL_ID +"))";
+            app_folder_exists = sqlite3_exec(db, create.c_str(), NULL, NULL, NULL) == SQLITE_OK;
+        }
+        if (!app_folder_exists)
         {
             sql = "select titleId,val from tbl_appinfo where key=572932585 and titleID not like 'NPXS%'";
         }
-        rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        rc = Prepare(db, sql.c_str(), &res);
     
-        int step = sqlite3_step(res);
+        int step = Step(res);
         while (step == SQLITE_ROW)
         {
-            Game game;
-            sprintf(game.id, "%s", sqlite3_column_text(res, 0));
-            if (!GAME::IsMatchPrefixes(game.id, hidden_title_ids) || strcmp(game.id, "PSPEMUCFW")==0)
+            const char *id = (const char*)sqlite3_column_text(res, 0);
+            if (!GAME::IsMatchPrefixes(id, hidden_title_ids) || strcmp(id, "PSPEMUCFW")==0)
             {
+                Game game;
+                game.id = ARENA::Copy(id);
                 std::string title = std::string((const char*)sqlite3_column_text(res, 1));
                 std::replace( title.begin(), title.end(), '\n', ' ');
-                sprintf(game.category, "%s", GAME::GetGameCategory(game.id));
-                sprintf(game.title, "%s", title.c_str());
-                sprintf(game.rom_path, "%s", "");
+                game.category = GAME::GetGameCategory(game.id);
+                game.title = ARENA::Copy(title.c_str());
                 if (app_folder_exists)
                 {
                     game.folder_id = sqlite3_column_int(res, 2);
@@ -110,46 +405,61 @@ namespace DB {
                 }
                 game.tex = no_icon;
                 game.type = TYPE_BUBBLE;
-
-                Folder *folder = GAME::FindFolder(categoryMap[game.category], game.folder_id);
-                if (folder != nullptr)
-                {
-                    folder->games.push_back(game);
-                }
-                else
-                {
-                    game.folder_id = 0;
-                    categoryMap[game.category]->current_folder->games.push_back(game);
-                }
-
-                game_scan_inprogress = game;
+                games.push_back(game);
             }
-            games_scanned++;
-            step = sqlite3_step(res); 
+            step = Step(res); 
         }
-        sqlite3_finalize(res);
-        sqlite3_close(db);
+        Finish(res);
+        Release(db);
     }
 
-    int GetVitaDbGamesCount()
+    static int GetUserVersion(sqlite3 *db)
     {
-        sqlite3 *db;
         sqlite3_stmt *res;
-
-        int rc = sqlite3_open(VITA_APP_DB_FILE, &db);
-        std::string sql = "select count(distinct(titleId)) from tbl_appinfo where key=572932585 and titleID not like 'NPXS%'";
-        rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
-    
-        int step = sqlite3_step(res);
-        int count = 0;
-        if (step == SQLITE_ROW)
+        int version = 0;
+        int rc = Prepare(db, "PRAGMA user_version", &res);
+        if (rc == SQLITE_OK)
         {
-            count = sqlite3_column_int(res, 0);
+            if (Step(res) == SQLITE_ROW)
+            {
+                version = sqlite3_column_int(res, 0);
+            }
+            Finish(res);
         }
-        sqlite3_finalize(res);
-        sqlite3_close(db);
+        return version;
+    }
 
-        return count;
+    static void SetUserVersion(sqlite3 *db, int version)
+    {
+        char sql[48];
+        sprintf(sql, "PRAGMA user_version=%d", version);
+        sqlite3_exec(db, sql, NULL, NULL, NULL);
+    }
+
+    // category held the name of the category before rows kept its index in game_categories
+    static void MigrateCategoryIds(sqlite3 *db, const char *table)
+    {
+        std::string sql = std::string("ALTER TABLE ") + table +
+            " ADD " + COL_CATEGORY_ID + " INTEGER DEFAULT -1";
+        sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+
+        sqlite3_stmt *res;
+        sql = std::string("UPDATE ") + table + " SET " + COL_CATEGORY_ID + "=? WHERE " + COL_CATEGORY + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
+        if (rc == SQLITE_OK) {
+            for (int i=0; i<TOTAL_CATEGORY; i++)
+            {
+                sqlite3_bind_int(res, 1, i);
+                sqlite3_bind_text(res, 2, game_categories[i].category, strlen(game_categories[i].category), NULL);
+                Step(res);
+                sqlite3_reset(res);
+            }
+            Finish(res);
+        }
+
+        // names no category goes by anymore
+        sql = std::string("DELETE FROM ") + table + " WHERE " + COL_CATEGORY_ID + "<0";
+        sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
     }
 
     void SetupDatabase(sqlite3 *database)
@@ -158,7 +468,7 @@ namespace DB {
 
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         if (!TableExists(db, GAMES_TABLE))
@@ -167,17 +477,17 @@ namespace DB {
                 COL_TITLE_ID + " TEXT," +
                 COL_TITLE + " TEXT," +
                 COL_TYPE + " INTEGER," +
-                COL_CATEGORY + " TEXT," +
+                COL_CATEGORY_ID + " INTEGER," +
                 COL_ROM_PATH + " TEXT," +
                 COL_FOLDER_ID + " INTEGER DEFAULT 0)";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX games_index ON ") + GAMES_TABLE + "(" + 
-                COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY + ")";
+                COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY_ID + ")";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX games_index_folder_cat ON ") + GAMES_TABLE + "(" + 
-                COL_FOLDER_ID + "," + COL_CATEGORY + ")";
+                COL_FOLDER_ID + "," + COL_CATEGORY_ID + ")";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX games_index_rom_path ON ") + GAMES_TABLE + "(" + 
@@ -191,17 +501,17 @@ namespace DB {
                 COL_TITLE_ID + " TEXT," +
                 COL_TITLE + " TEXT," +
                 COL_TYPE + " INTEGER," +
-                COL_CATEGORY + " TEXT," +
+                COL_CATEGORY_ID + " INTEGER," +
                 COL_ROM_PATH + " TEXT," +
                 COL_FOLDER_ID + " INTEGER DEFAULT 0)";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX favorites_index ON ") + FAVORITES_TABLE + "(" + 
-                COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY + ")";
+                COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY_ID + ")";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX favorites_index_folder_cat ON ") + FAVORITES_TABLE + "(" + 
-                COL_FOLDER_ID + "," + COL_CATEGORY + ")";
+                COL_FOLDER_ID + "," + COL_CATEGORY_ID + ")";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX favorites_index_rom_path ON ") + FAVORITES_TABLE + "(" + 
@@ -214,39 +524,27 @@ namespace DB {
             std::string sql = std::string("CREATE TABLE ") + FOLDERS_TABLE + "(" +
                 COL_ID + " INTEGER," +
                 COL_TITLE + " TEXT," +
-                COL_CATEGORY + " TEXT," +
+                COL_CATEGORY_ID + " INTEGER," +
                 COL_ICON_PATH + " TEXT," +
                 "PRIMARY KEY(" + COL_ID +"))";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
         }
 
-        if (database == nullptr)
-        {
-            sqlite3_close(db);
-        }
+        SetupFileManifest(db);
+        SetupDirSignatures(db);
+        SetupScanState(db, false);
+        SetUserVersion(db, CACHE_DB_VERSION);
 
-        sqlite3 *vita_app_db;
-        sqlite3_open(VITA_APP_DB_FILE, &vita_app_db);
-        if (!TableExists(vita_app_db, APP_FOLDERS_TABLE))
+        if (database == nullptr)
         {
-            std::string sql = std::string("CREATE TABLE ") + APP_FOLDERS_TABLE + "(" +
-                COL_ID + " TEXT," +
-                COL_FOLDER_ID + " INTEGER," +
-                "PRIMARY KEY(" + COL_ID +"))";
-            sqlite3_exec(vita_app_db, sql.c_str(), NULL, NULL, NULL);
+            Release(db);
         }
-        sqlite3_close(vita_app_db);
     }
 
-    void UpdateDatabase(sqlite3 *database)
+    // cache.db files from before user_version was kept can be at any of the
+    // older schemas, each change is probed for
+    static void UpgradeLegacyDatabase(sqlite3 *db)
     {
-        sqlite3 *db = database;
-
-        if (db == nullptr)
-        {
-            sqlite3_open(CACHE_DB_FILE, &db);
-        }
-
         if (!TableColumnExists(db, GAMES_TABLE, COL_FOLDER_ID))
         {
             std::string sql = std::string("ALTER TABLE ") + GAMES_TABLE +
@@ -254,7 +552,7 @@ namespace DB {
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX games_index_folder_cat ON ") + GAMES_TABLE + "(" + 
-                COL_FOLDER_ID + "," + COL_CATEGORY + ")";
+                COL_FOLDER_ID + "," + COL_CATEGORY_ID + ")";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX games_index_rom_path ON ") + GAMES_TABLE + "(" + 
@@ -269,7 +567,7 @@ namespace DB {
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX favorites_index_folder_cat ON ") + FAVORITES_TABLE + "(" + 
-                COL_FOLDER_ID + "," + COL_CATEGORY + ")";
+                COL_FOLDER_ID + "," + COL_CATEGORY_ID + ")";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
             sql = std::string("CREATE INDEX favorites_index_rom_path ON ") + FAVORITES_TABLE + "(" + 
@@ -277,33 +575,108 @@ namespace DB {
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
         }
 
+        if (!TableColumnExists(db, GAMES_TABLE, COL_CATEGORY_ID))
+        {
+            MigrateCategoryIds(db, GAMES_TABLE);
+            MigrateCategoryIds(db, FAVORITES_TABLE);
+
+            const char *indexes[] = { "games_index", "games_index_folder_cat", "favorites_index", "favorites_index_folder_cat" };
+            for (int i=0; i<4; i++)
+            {
+                std::string sql = std::string("DROP INDEX IF EXISTS ") + indexes[i];
+                sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+            }
+
+            std::string sql = std::string("CREATE INDEX games_index ON ") + GAMES_TABLE + "(" + 
+                COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY_ID + ")";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+
+            sql = std::string("CREATE INDEX games_index_folder_cat ON ") + GAMES_TABLE + "(" + 
+                COL_FOLDER_ID + "," + COL_CATEGORY_ID + ")";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+
+            sql = std::string("CREATE INDEX favorites_index ON ") + FAVORITES_TABLE + "(" + 
+                COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY_ID + ")";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+
+            sql = std::string("CREATE INDEX favorites_index_folder_cat ON ") + FAVORITES_TABLE + "(" + 
+                COL_FOLDER_ID + "," + COL_CATEGORY_ID + ")";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+        }
+
         if (!TableExists(db, FOLDERS_TABLE))
         {
             std::string sql = std::string("CREATE TABLE ") + FOLDERS_TABLE + "(" +
                 COL_ID + " INTEGER," +
                 COL_TITLE + " TEXT," +
-                COL_CATEGORY + " TEXT," +
+                COL_CATEGORY_ID + " INTEGER," +
                 COL_ICON_PATH + " TEXT," +
                 "PRIMARY KEY(" + COL_ID +"))";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
         }
+        else if (!TableColumnExists(db, FOLDERS_TABLE, COL_CATEGORY_ID))
+        {
+            MigrateCategoryIds(db, FOLDERS_TABLE);
+        }
 
-        if (database == nullptr)
+        SetupFileManifest(db);
+        SetupDirSignatures(db);
+    }
+
+    // the entries and names_hash columns were written but never compared, the
+    // signatures are only a cache so the next scan lists every folder once
+    static void DropDirSignatureCounts(sqlite3 *db)
+    {
+        std::string sql = std::string("DROP TABLE IF EXISTS ") + DIR_SIGNATURES_TABLE;
+        sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+        SetupDirSignatures(db);
+    }
+
+    // there was no way to tell an interrupted scan apart, the caches are taken as complete
+    static void AddScanState(sqlite3 *db)
+    {
+        SetupScanState(db, true);
+    }
+
+    // cache_db_migrations[i] takes cache.db from user_version i to i+1
+    typedef void (*Migration)(sqlite3 *db);
+    static Migration cache_db_migrations[CACHE_DB_VERSION] = {
+        UpgradeLegacyDatabase,
+        DropDirSignatureCounts,
+        AddScanState,
+    };
+
+    void UpdateDatabase(sqlite3 *database)
+    {
+        sqlite3 *db = database;
+
+        if (db == nullptr)
         {
-            sqlite3_close(db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
-        sqlite3 *vita_app_db;
-        sqlite3_open(VITA_APP_DB_FILE, &vita_app_db);
-        if (!TableExists(vita_app_db, APP_FOLDERS_TABLE))
+        int version = GetUserVersion(db);
+        if (version < CACHE_DB_VERSION)
         {
-            std::string sql = std::string("CREATE TABLE ") + APP_FOLDERS_TABLE + "(" +
-                COL_ID + " TEXT," +
-                COL_FOLDER_ID + " INTEGER," +
-                "PRIMARY KEY(" + COL_ID +"))";
-            sqlite3_exec(vita_app_db, sql.c_str(), NULL, NULL, NULL);
+            uint64_t start_time = sceKernelGetProcessTimeWide();
+            sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+            for (int i=version; i < CACHE_DB_VERSION; i++)
+            {
+                cache_db_migrations[i](db);
+            }
+            SetUserVersion(db, CACHE_DB_VERSION);
+            sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+            char line[96];
+            snprintf(line, 96, "migrate cache.db from=%d to=%d time=%llu\n", version, CACHE_DB_VERSION,
+                sceKernelGetProcessTimeWide() - start_time);
+            FS::AppendText(SCAN_STATS_LOG_FILE, line);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
         }
-        sqlite3_close(vita_app_db);
     }
 
     void InsertFavorite(sqlite3 *database, Game *game)
@@ -312,27 +685,27 @@ namespace DB {
 
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("INSERT INTO ") + FAVORITES_TABLE + "(" + COL_TITLE_ID + "," +
-            COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY + "," + COL_ROM_PATH + ") VALUES (?, ?, ?, ?, ?)";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+            COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY_ID + "," + COL_ROM_PATH + ") VALUES (?, ?, ?, ?, ?)";
+        int rc = Prepare(db, sql.c_str(), &res);
     
         if (rc == SQLITE_OK) {
             sqlite3_bind_text(res, 1, game->id, strlen(game->id), NULL);
             sqlite3_bind_text(res, 2, game->title, strlen(game->title), NULL);
             sqlite3_bind_int(res, 3, game->type);
-            sqlite3_bind_text(res, 4, game->category, strlen(game->category), NULL);
+            sqlite3_bind_int(res, 4, game->category);
             sqlite3_bind_text(res, 5, game->rom_path, strlen(game->rom_path), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -341,25 +714,25 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("DELETE FROM ") + FAVORITES_TABLE + " WHERE " + COL_TITLE + "=? AND " +
-            COL_TYPE + "=? AND " + COL_CATEGORY + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+            COL_TYPE + "=? AND " + COL_CATEGORY_ID + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
 
         if (rc == SQLITE_OK) {
             sqlite3_bind_text(res, 1, game->title, strlen(game->title), NULL);
             sqlite3_bind_int(res, 2, game->type);
-            sqlite3_bind_text(res, 3, game->category, strlen(game->category), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            sqlite3_bind_int(res, 3, game->category);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -368,34 +741,35 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("SELECT ") + COL_TITLE_ID + "," + COL_TITLE + "," +
-            COL_TYPE + "," + COL_CATEGORY + "," + COL_ROM_PATH + " FROM " + FAVORITES_TABLE;
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+            COL_TYPE + "," + COL_CATEGORY_ID + "," + COL_ROM_PATH + " FROM " + FAVORITES_TABLE;
+        int rc = Prepare(db, sql.c_str(), &res);
 
-        int step = sqlite3_step(res);
+        int step = Step(res);
         while (step == SQLITE_ROW)
         {
             Game game;
-            sprintf(game.id, "%s", sqlite3_column_text(res, 0));
-            sprintf(game.title, "%s", sqlite3_column_text(res, 1));
+            game.id = ARENA::Copy((const char*)sqlite3_column_text(res, 0));
+            game.title = ARENA::Copy((const char*)sqlite3_column_text(res, 1));
             game.type = sqlite3_column_int(res, 2);
-            sprintf(game.category, "%s", sqlite3_column_text(res, 3));
-            sprintf(game.rom_path, "%s", sqlite3_column_text(res, 4));
+            game.category = sqlite3_column_int(res, 3);
+            game.rom_path = ARENA::Copy((const char*)sqlite3_column_text(res, 4));
             game.tex = no_icon;
             games_scanned++;
             game_scan_inprogress = game;
             category->current_folder->games.push_back(game);
-            step = sqlite3_step(res);
+            step = Step(res);
         }
-        sqlite3_finalize(res);
+        Finish(res);
+        GAME::InvalidateGameIndex(category);
         
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -405,37 +779,123 @@ namespace DB {
 
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("INSERT INTO ") + GAMES_TABLE + "(" + COL_TITLE_ID + "," + 
-            COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY + "," + COL_ROM_PATH + ") VALUES (?, ?, ?, ?, ?)";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+            COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY_ID + "," + COL_ROM_PATH + ") VALUES (?, ?, ?, ?, ?)";
+        int rc = Prepare(db, sql.c_str(), &res);
     
         if (rc == SQLITE_OK) {
             sqlite3_bind_text(res, 1, game->id, strlen(game->id), NULL);
             sqlite3_bind_text(res, 2, game->title, strlen(game->title), NULL);
             sqlite3_bind_int(res, 3, game->type);
-            sqlite3_bind_text(res, 4, game->category, strlen(game->category), NULL);
+            sqlite3_bind_int(res, 4, game->category);
             sqlite3_bind_text(res, 5, game->rom_path, strlen(game->rom_path), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
    }
 
+    void BeginBulkInsert(sqlite3 *database, BulkInsert *bulk, int batch_size)
+    {
+        bulk->db = database;
+        bulk->insert_game = nullptr;
+        bulk->batch_size = batch_size;
+        bulk->batch_rows = 0;
+        bulk->rows = 0;
+        bulk->insert_time = 0;
+
+        if (batch_size > 1)
+        {
+            std::string sql = std::string("INSERT INTO ") + GAMES_TABLE + "(" + COL_TITLE_ID + "," + 
+                COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY_ID + "," + COL_ROM_PATH + ") VALUES (?, ?, ?, ?, ?)";
+            if (sqlite3_prepare_v2(database, sql.c_str(), -1, &bulk->insert_game, nullptr) != SQLITE_OK)
+            {
+                bulk->insert_game = nullptr;
+            }
+        }
+    }
+
+    void BulkInsertGame(BulkInsert *bulk, Game *game)
+    {
+        uint64_t start_time = sceKernelGetProcessTimeWide();
+        if (bulk->insert_game == nullptr)
+        {
+            InsertGame(bulk->db, game);
+        }
+        else
+        {
+            if (bulk->batch_rows == 0)
+            {
+                sqlite3_exec(bulk->db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+            }
+
+            sqlite3_stmt *res = bulk->insert_game;
+            sqlite3_bind_text(res, 1, game->id, strlen(game->id), NULL);
+            sqlite3_bind_text(res, 2, game->title, strlen(game->title), NULL);
+            sqlite3_bind_int(res, 3, game->type);
+            sqlite3_bind_int(res, 4, game->category);
+            sqlite3_bind_text(res, 5, game->rom_path, strlen(game->rom_path), NULL);
+            Step(res);
+            sqlite3_reset(res);
+            sqlite3_clear_bindings(res);
+
+            bulk->batch_rows++;
+            if (bulk->batch_rows >= bulk->batch_size)
+            {
+                FlushBulkInsert(bulk);
+            }
+        }
+        bulk->rows++;
+        bulk->insert_time += sceKernelGetProcessTimeWide() - start_time;
+    }
+
+    // commits the rows inserted so far, the other connections wait for cache.db until then
+    void FlushBulkInsert(BulkInsert *bulk)
+    {
+        if (bulk->batch_rows > 0)
+        {
+            sqlite3_exec(bulk->db, "COMMIT", NULL, NULL, NULL);
+            bulk->batch_rows = 0;
+        }
+    }
+
+    void EndBulkInsert(BulkInsert *bulk)
+    {
+        uint64_t start_time = sceKernelGetProcessTimeWide();
+        FlushBulkInsert(bulk);
+        if (bulk->insert_game != nullptr)
+        {
+            sqlite3_finalize(bulk->insert_game);
+            bulk->insert_game = nullptr;
+        }
+        bulk->insert_time += sceKernelGetProcessTimeWide() - start_time;
+
+        if (bulk->rows > 0)
+        {
+            // compare runs with insert_batch_size=1 in config.ini to get the row by row numbers
+            char line[128];
+            uint64_t rows_per_sec = bulk->insert_time > 0 ? (uint64_t)bulk->rows * 1000000 / bulk->insert_time : 0;
+            snprintf(line, 128, "insert_batch_size=%d rows=%d time_us=%llu rows_per_sec=%llu\n",
+                bulk->batch_size, bulk->rows, bulk->insert_time, rows_per_sec);
+            FS::AppendText(SCAN_STATS_LOG_FILE, line);
+        }
+    }
+
    bool GameExists(sqlite3 *database, Game *game)
    {
         sqlite3 *db = database;
 
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
@@ -451,7 +911,7 @@ namespace DB {
                 COL_TITLE_ID + "=? AND " + COL_TYPE + "=?";
         }
         
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
 
         bool found = false;
         if (rc == SQLITE_OK) {
@@ -465,17 +925,17 @@ namespace DB {
             }
             
             sqlite3_bind_int(res, 2, game->type);
-            int step = sqlite3_step(res);
+            int step = Step(res);
             if (step == SQLITE_ROW)
             {
                 found = true;
             }
-            sqlite3_finalize(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
 
         return found;
@@ -487,40 +947,40 @@ namespace DB {
 
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("SELECT MAX(") + COL_ID + ") FROM " + FOLDERS_TABLE;
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
 
         int max_id = 0;
         if (rc == SQLITE_OK) {
-            int step = sqlite3_step(res);
+            int step = Step(res);
             if (step == SQLITE_ROW)
             {
                 max_id = sqlite3_column_int(res, 0);
             }
-            sqlite3_finalize(res);
+            Finish(res);
         }
         folder->id = max_id + 1;
 
         sql = std::string("INSERT INTO ") + FOLDERS_TABLE + "(" + COL_ID + "," + 
-            COL_TITLE + "," + COL_CATEGORY + "," + COL_ICON_PATH + ") VALUES (?, ?, ?, ?)";
-        rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+            COL_TITLE + "," + COL_CATEGORY_ID + "," + COL_ICON_PATH + ") VALUES (?, ?, ?, ?)";
+        rc = Prepare(db, sql.c_str(), &res);
     
         if (rc == SQLITE_OK) {
             sqlite3_bind_int(res, 1, folder->id);
             sqlite3_bind_text(res, 2, folder->title, strlen(folder->title), NULL);
-            sqlite3_bind_text(res, 3, folder->category, strlen(folder->category), NULL);
+            sqlite3_bind_int(res, 3, folder->category);
             sqlite3_bind_text(res, 4, folder->icon_path, strlen(folder->icon_path), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -529,7 +989,7 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
@@ -537,18 +997,18 @@ namespace DB {
             COL_TITLE + "=?, " +
             COL_ICON_PATH + "=? " +
             " WHERE " + COL_ID + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK) {
             sqlite3_bind_text(res, 1, folder->title, strlen(folder->title), NULL);
             sqlite3_bind_text(res, 2, folder->icon_path, strlen(folder->icon_path), NULL);
             sqlite3_bind_int(res, 3, folder->id);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -557,24 +1017,24 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("select count(1) from ") + GAMES_TABLE;
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
     
-        int step = sqlite3_step(res);
+        int step = Step(res);
         int count = 0;
         if (step == SQLITE_ROW)
         {
             count = sqlite3_column_int(res, 0);
         }
-        sqlite3_finalize(res);
+        Finish(res);
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
 
         return count;
@@ -585,28 +1045,28 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("SELECT ") + COL_TITLE_ID + "," + COL_TITLE + "," +
-            COL_TYPE + "," + COL_CATEGORY + "," + COL_ROM_PATH + "," + COL_FOLDER_ID + " FROM " + GAMES_TABLE;
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+            COL_TYPE + "," + COL_CATEGORY_ID + "," + COL_ROM_PATH + "," + COL_FOLDER_ID + " FROM " + GAMES_TABLE;
+        int rc = Prepare(db, sql.c_str(), &res);
     
-        int step = sqlite3_step(res);
+        int step = Step(res);
         while (step == SQLITE_ROW)
         {
             Game game;
-            sprintf(game.id, "%s", sqlite3_column_text(res, 0));
-            sprintf(game.title, "%s", sqlite3_column_text(res, 1));
+            game.id = ARENA::Copy((const char*)sqlite3_column_text(res, 0));
+            game.title = ARENA::Copy((const char*)sqlite3_column_text(res, 1));
             game.type = sqlite3_column_int(res, 2);
-            sprintf(game.category, "%s", sqlite3_column_text(res, 3));
-            sprintf(game.rom_path, "%s", sqlite3_column_text(res, 4));
+            game.category = sqlite3_column_int(res, 3);
+            game.rom_path = ARENA::Copy((const char*)sqlite3_column_text(res, 4));
             game.folder_id = sqlite3_column_int(res, 5);
             game.tex = no_icon;
             games_scanned++;
             game_scan_inprogress = game;
-            Folder *folder = GAME::FindFolder(categoryMap[game.category], game.folder_id);
+            Folder *folder = GAME::FindFolder(&game_categories[game.category], game.folder_id);
             if (folder != nullptr)
             {
                 folder->games.push_back(game);
@@ -614,12 +1074,12 @@ namespace DB {
             else
             {
                 game.folder_id = 0;
-                categoryMap[game.category]->current_folder->games.push_back(game);
+                game_categories[game.category].current_folder->games.push_back(game);
             }
             
-            step = sqlite3_step(res);
+            step = Step(res);
         }
-        sqlite3_finalize(res);
+        Finish(res);
         
         for (int i=0; i<TOTAL_CATEGORY; i++)
         {
@@ -627,20 +1087,21 @@ namespace DB {
             for (int j=1; j<category->folders.size(); j++)
             {
                 Game game;
-                sprintf(game.id, "%d", category->folders[j].id);
-                sprintf(game.title, "%s", category->folders[j].title);
-                sprintf(game.category, "%s", category->folders[j].category);
+                game.id = ARENA::Format("%d", category->folders[j].id);
+                game.title = ARENA::Copy(category->folders[j].title);
+                game.category = category->id;
                 game.type = TYPE_FOLDER;
                 game.folder_id = category->folders[j].id;
                 game.favorite = false;
                 game.tex = no_icon;
                 category->folders[0].games.insert(category->folders[0].games.begin(), game);
             }
+            GAME::InvalidateGameIndex(category);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -649,23 +1110,23 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("SELECT ") + COL_ID + "," + COL_TITLE + "," +
-            COL_CATEGORY + "," + COL_ICON_PATH + " FROM " + FOLDERS_TABLE +
-            " WHERE " + COL_CATEGORY + "=? ORDER BY " + COL_TITLE;
+            COL_CATEGORY_ID + "," + COL_ICON_PATH + " FROM " + FOLDERS_TABLE +
+            " WHERE " + COL_CATEGORY_ID + "=? ORDER BY " + COL_TITLE;
 
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK) {
-            sqlite3_bind_text(res, 1, category->category, strlen(category->category), NULL);
-            while (sqlite3_step(res) == SQLITE_ROW)
+            sqlite3_bind_int(res, 1, category->id);
+            while (Step(res) == SQLITE_ROW)
             {
                 Folder folder;
                 folder.id = sqlite3_column_int(res, 0);
                 sprintf(folder.title, "%s", sqlite3_column_text(res, 1));
-                sprintf(folder.category, "%s", sqlite3_column_text(res, 2));
+                folder.category = sqlite3_column_int(res, 2);
                 sprintf(folder.icon_path, "%s", sqlite3_column_text(res, 3));
                 folder.max_page = 1;
                 folder.page_num = 1;
@@ -674,11 +1135,11 @@ namespace DB {
             }
         }
         category->current_folder = &category->folders[0];
-        sqlite3_finalize(res);
+        Finish(res);
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -687,22 +1148,22 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("DELETE FROM ") + GAMES_TABLE + " WHERE " + COL_ROM_PATH + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
     
         if (rc == SQLITE_OK) {
             sqlite3_bind_text(res, 1, game->rom_path, strlen(game->rom_path), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -711,24 +1172,24 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("DELETE FROM ") + FOLDERS_TABLE + " WHERE " + COL_ID + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
     
         if (rc == SQLITE_OK) {
             sqlite3_bind_int(res, 1, folder->id);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         ResetGamesFolderId(db, folder);
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -737,48 +1198,48 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("UPDATE ") + GAMES_TABLE + " SET " + COL_FOLDER_ID + "=0" +
-            " WHERE " + COL_FOLDER_ID + "=? AND " + COL_CATEGORY + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+            " WHERE " + COL_FOLDER_ID + "=? AND " + COL_CATEGORY_ID + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
     
         if (rc == SQLITE_OK) {
             sqlite3_bind_int(res, 1, folder->id);
-            sqlite3_bind_text(res, 2, folder->category, strlen(folder->category), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            sqlite3_bind_int(res, 2, folder->category);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
-    void DeleteGamesByCategoryAndType(sqlite3 *database, const char* category, int type)
+    void DeleteGamesByCategoryAndType(sqlite3 *database, int category, int type)
     {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
-        std::string sql = std::string("DELETE FROM ") + GAMES_TABLE + " WHERE " + COL_TYPE + "=? AND " + COL_CATEGORY + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        std::string sql = std::string("DELETE FROM ") + GAMES_TABLE + " WHERE " + COL_TYPE + "=? AND " + COL_CATEGORY_ID + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK) {
             sqlite3_bind_int(res, 1, type);
-            sqlite3_bind_text(res, 2, category, strlen(category), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            sqlite3_bind_int(res, 2, category);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
    }
 
@@ -787,21 +1248,21 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("DELETE FROM ") + GAMES_TABLE + " WHERE " + COL_TYPE + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK) {
             sqlite3_bind_int(res, 1, type);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
    }
 
@@ -810,22 +1271,22 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
-        std::string sql = std::string("UPDATE ") + FAVORITES_TABLE + " SET " + COL_CATEGORY + "=? WHERE " + COL_TITLE_ID + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        std::string sql = std::string("UPDATE ") + FAVORITES_TABLE + " SET " + COL_CATEGORY_ID + "=? WHERE " + COL_TITLE_ID + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK) {
-            sqlite3_bind_text(res, 1, game->category, strlen(game->category), NULL);
+            sqlite3_bind_int(res, 1, game->category);
             sqlite3_bind_text(res, 2, game->id, strlen(game->id), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
    }
 
@@ -834,22 +1295,22 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
-        std::string sql = std::string("UPDATE ") + FAVORITES_TABLE + " SET " + COL_CATEGORY + "=? WHERE " + COL_ROM_PATH + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        std::string sql = std::string("UPDATE ") + FAVORITES_TABLE + " SET " + COL_CATEGORY_ID + "=? WHERE " + COL_ROM_PATH + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK) {
-            sqlite3_bind_text(res, 1, game->category, strlen(game->category), NULL);
+            sqlite3_bind_int(res, 1, game->category);
             sqlite3_bind_text(res, 2, game->rom_path, strlen(game->rom_path), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
    }
 
@@ -858,28 +1319,28 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("UPDATE ") + GAMES_TABLE + " SET " + 
-            COL_CATEGORY + "=?, " +
+            COL_CATEGORY_ID + "=?, " +
             COL_TITLE + "=?, " +
             COL_FOLDER_ID + "=? " +
             " WHERE " + COL_ROM_PATH + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK) {
-            sqlite3_bind_text(res, 1, game->category, strlen(game->category), NULL);
+            sqlite3_bind_int(res, 1, game->category);
             sqlite3_bind_text(res, 2, game->title, strlen(game->title), NULL);
             sqlite3_bind_int(res, 3, game->folder_id);
             sqlite3_bind_text(res, 4, game->rom_path, strlen(game->rom_path), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
    }
 
@@ -888,22 +1349,22 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("UPDATE ") + GAMES_TABLE + " SET " + COL_TITLE + "=? WHERE " + COL_ROM_PATH + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK) {
             sqlite3_bind_text(res, 1, game->title, strlen(game->title), NULL);
             sqlite3_bind_text(res, 2, game->rom_path, strlen(game->rom_path), NULL);
-            int step = sqlite3_step(res);
-            sqlite3_finalize(res);
+            int step = Step(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
    }
 
@@ -912,26 +1373,26 @@ namespace DB {
         sqlite3 *db = database;
         if (db == nullptr)
         {
-            sqlite3_open(CACHE_DB_FILE, &db);
+            db = Acquire(CACHE_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("select max(title_id) from games where type=?");
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
 
         if (rc == SQLITE_OK) {
             sqlite3_bind_int(res, 1, type);
-            int step = sqlite3_step(res);
+            int step = Step(res);
             if (step == SQLITE_ROW)
             {
                 sprintf(max_title_id, "%s", sqlite3_column_text(res, 0));
             }
-            sqlite3_finalize(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
@@ -940,13 +1401,14 @@ namespace DB {
         char db_path[64];
         sprintf(db_path, "ux0:app/SMLA00001/thumbnails/%s.db", db_name);
         sqlite3 *db;
-        sqlite3_open(db_path, &db);
+        db = Acquire(db_path);
         bool found = FindMatchingThumbnail(db, tokens, thumbnail);
-        sqlite3_close(db);
+        Release(db);
         return found;
     }
 
-    bool FindMatchingThumbnail(sqlite3 *database, std::vector<std::string> &tokens, char* thumbnail)
+    // thumbnails dbs without the token index, every attempt scans the whole table
+    static bool FindThumbnailByLike(sqlite3 *database, std::vector<std::string> &tokens, char* thumbnail)
     {
         sqlite3 *db = database;
         bool found = false;
@@ -998,40 +1460,404 @@ namespace DB {
                     sql += "filename like '%" + tokens[i] + "%'";
             }
             sql += " order by length(filename) asc";
-            int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+            int rc = Prepare(db, sql.c_str(), &res);
 
             if (rc == SQLITE_OK) {
-                int step = sqlite3_step(res);
+                int step = Step(res);
                 if (step == SQLITE_ROW)
                 {
                     sprintf(thumbnail, "%s", sqlite3_column_text(res, 0));
                     found = true;
                 }
-                sqlite3_finalize(res);
+                Finish(res);
             }
             --tokens_to_try;
         }
 
         return found;
     }
-    
-    void SetupPerGameSettingsDatabase()
+
+    static void GetDatabaseFile(sqlite3 *db, std::string &file)
     {
-        sqlite3 *db;
-        sqlite3_open(PER_GAME_SETTINGS_DB_FILE, &db);
+        sqlite3_stmt *res;
+        int rc = Prepare(db, "PRAGMA database_list", &res);
 
-        if (!TableExists(db, PSP_GAME_SETTINGS_TABLE))
+        if (rc == SQLITE_OK)
         {
-            std::string sql = std::string("CREATE TABLE ") + PSP_GAME_SETTINGS_TABLE + "(" +
-                COL_ROM_PATH + " TEXT," +
-                COL_DRIVERS + " INTEGER," +
-                COL_EXECUTE + " INTEGER," +
-                COL_CUSTOMIZED + " INTEGER," +
-                COL_PSBUTTON_MODE + " INTEGER," +
-                COL_SUSPEND_THREADS + " INTEGER," +
-                COL_PLUGINS + " INTEGER," +
-                COL_NONPDRM + " INTEGER," +
-                COL_HIGH_MEMORY + " INTEGER," +
+            while (Step(res) == SQLITE_ROW)
+            {
+                if (strcmp((const char*)sqlite3_column_text(res, 1), "main") == 0 && sqlite3_column_text(res, 2) != nullptr)
+                {
+                    file = (const char*)sqlite3_column_text(res, 2);
+                    break;
+                }
+            }
+            Finish(res);
+        }
+    }
+
+    void LoadThumbnailIndex(sqlite3 *database, ThumbnailIndex *index)
+    {
+        index->indexed = false;
+        index->token_pool.clear();
+        index->token_offsets.clear();
+        index->postings.clear();
+        index->posting_offsets.clear();
+        index->ranks.clear();
+        if (!TableExists(database, THUMBNAIL_TOKENS_TABLE) || !TableExists(database, THUMBNAIL_RANKS_TABLE))
+        {
+            return;
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("SELECT token, postings FROM ") + THUMBNAIL_TOKENS_TABLE + " ORDER BY token";
+        int rc = Prepare(database, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            while (Step(res) == SQLITE_ROW)
+            {
+                const char *token = (const char*)sqlite3_column_text(res, 0);
+                index->token_offsets.push_back(index->token_pool.size());
+                index->token_pool.insert(index->token_pool.end(), token, token + strlen(token) + 1);
+
+                // ascending ranks stored as LEB128 deltas
+                const unsigned char *blob = (const unsigned char*)sqlite3_column_blob(res, 1);
+                int bytes = sqlite3_column_bytes(res, 1);
+                index->posting_offsets.push_back(index->postings.size());
+                uint32_t rank = 0;
+                uint32_t delta = 0;
+                int shift = 0;
+                for (int i = 0; i < bytes; i++)
+                {
+                    delta |= (uint32_t)(blob[i] & 0x7F) << shift;
+                    shift += 7;
+                    if (blob[i] < 0x80)
+                    {
+                        rank += delta;
+                        index->postings.push_back(rank);
+                        delta = 0;
+                        shift = 0;
+                    }
+                }
+            }
+            index->posting_offsets.push_back(index->postings.size());
+            Finish(res);
+        }
+
+        sql = std::string("SELECT rowids FROM ") + THUMBNAIL_RANKS_TABLE + " WHERE id=0";
+        rc = Prepare(database, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            if (Step(res) == SQLITE_ROW)
+            {
+                index->ranks.resize(sqlite3_column_bytes(res, 0) / sizeof(uint32_t));
+                memcpy(index->ranks.data(), sqlite3_column_blob(res, 0), index->ranks.size() * sizeof(uint32_t));
+                index->indexed = true;
+            }
+            Finish(res);
+        }
+    }
+
+    static int FindThumbnailToken(const ThumbnailIndex *index, const char *token)
+    {
+        int low = 0;
+        int high = (int)index->token_offsets.size() - 1;
+        while (low <= high)
+        {
+            int middle = (low + high) / 2;
+            int cmp = strcmp(&index->token_pool[index->token_offsets[middle]], token);
+            if (cmp == 0)
+            {
+                return middle;
+            }
+            else if (cmp < 0)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle - 1;
+            }
+        }
+        return -1;
+    }
+
+    static void AppendThumbnailPostings(const ThumbnailIndex *index, int token, std::vector<uint32_t> &ranks)
+    {
+        ranks.insert(ranks.end(), index->postings.begin() + index->posting_offsets[token],
+            index->postings.begin() + index->posting_offsets[token+1]);
+    }
+
+    // the ranks of the names filename like '%token%' matches, or those of a numeral and its alias
+    static void MatchThumbnailToken(const ThumbnailIndex *index, const std::string &token, std::vector<uint32_t> &ranks)
+    {
+        ranks.clear();
+        int numeral = 0;
+        if (token.length() == 1 && token[0] >= '1' && token[0] <= '8')
+        {
+            numeral = token[0] - '0';
+        }
+        for (int i = 0; i < 8 && numeral == 0; i++)
+        {
+            if (token == ROMAN_NUMERALS[i])
+            {
+                numeral = i + 1;
+            }
+        }
+
+        if (numeral > 0)
+        {
+            char key[4];
+            snprintf(key, 4, "#%d", numeral);
+            int found = FindThumbnailToken(index, key);
+            if (found >= 0)
+            {
+                AppendThumbnailPostings(index, found, ranks);
+            }
+            return;
+        }
+
+        std::string lower = token;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        for (int i = 0; i < index->token_offsets.size(); i++)
+        {
+            const char *name = &index->token_pool[index->token_offsets[i]];
+            if (name[0] != '#' && strstr(name, lower.c_str()) != nullptr)
+            {
+                AppendThumbnailPostings(index, i, ranks);
+            }
+        }
+        std::sort(ranks.begin(), ranks.end());
+        ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+    }
+
+    // Same result as FindThumbnailByLike. The names matching the most leading tokens
+    // are the intersection of their postings, the lowest rank is the shortest name.
+    static bool FindIndexedRank(const ThumbnailIndex *index, std::vector<std::string> &tokens, uint32_t *rank)
+    {
+        std::vector<uint32_t> matches;
+        std::vector<uint32_t> token_ranks;
+        std::vector<uint32_t> both;
+        bool matched = false;
+        uint32_t best = 0;
+        for (int i = 0; i < tokens.size(); i++)
+        {
+            MatchThumbnailToken(index, tokens[i], token_ranks);
+            if (i == 0)
+            {
+                matches.swap(token_ranks);
+            }
+            else
+            {
+                both.clear();
+                std::set_intersection(matches.begin(), matches.end(), token_ranks.begin(), token_ranks.end(), std::back_inserter(both));
+                matches.swap(both);
+            }
+
+            if (matches.empty())
+            {
+                break;
+            }
+            best = matches[0];
+            matched = true;
+        }
+
+        if (!matched || best >= index->ranks.size())
+        {
+            return false;
+        }
+        *rank = best;
+        return true;
+    }
+
+    static bool FindIndexedThumbnail(sqlite3 *db, const ThumbnailIndex *index, std::vector<std::string> &tokens, char* thumbnail)
+    {
+        uint32_t best;
+        if (!FindIndexedRank(index, tokens, &best))
+        {
+            return false;
+        }
+
+        bool found = false;
+        sqlite3_stmt *res;
+        std::string sql = std::string("SELECT filename FROM ") + THUMBNAILS_TABLE + " WHERE rowid=?";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_int64(res, 1, index->ranks[best]);
+            if (Step(res) == SQLITE_ROW)
+            {
+                sprintf(thumbnail, "%s", sqlite3_column_text(res, 0));
+                found = true;
+            }
+            Finish(res);
+        }
+        return found;
+    }
+
+    static void LoadCurrentThumbnailIndex(sqlite3 *database)
+    {
+        if (thumbnail_index_mutex < 0)
+        {
+            thumbnail_index_mutex = sceKernelCreateMutex("thumbnail_index_mutex", 0, 0, NULL);
+        }
+        sceKernelLockMutex(thumbnail_index_mutex, 1, NULL);
+
+        std::string file;
+        GetDatabaseFile(database, file);
+        if (file.empty() || file != thumbnail_index.file)
+        {
+            LoadThumbnailIndex(database, &thumbnail_index);
+            thumbnail_index.file = file;
+        }
+    }
+
+    bool FindMatchingThumbnail(sqlite3 *database, std::vector<std::string> &tokens, char* thumbnail)
+    {
+        LoadCurrentThumbnailIndex(database);
+
+        bool found;
+        if (thumbnail_index.indexed)
+        {
+            found = FindIndexedThumbnail(database, &thumbnail_index, tokens, thumbnail);
+        }
+        else
+        {
+            found = FindThumbnailByLike(database, tokens, thumbnail);
+        }
+
+        sceKernelUnlockMutex(thumbnail_index_mutex, 1);
+        return found;
+    }
+
+    // filename like '%token%' on a name already lower cased, with the numeral aliases
+    static bool NameContainsToken(const std::string &name, const std::string &token)
+    {
+        int numeral = 0;
+        if (token.length() == 1 && token[0] >= '1' && token[0] <= '8')
+        {
+            numeral = token[0] - '0';
+        }
+        for (int i = 0; i < 8 && numeral == 0; i++)
+        {
+            if (token == ROMAN_NUMERALS[i])
+            {
+                numeral = i + 1;
+            }
+        }
+
+        if (numeral > 0)
+        {
+            std::string alias = ROMAN_NUMERALS[numeral-1];
+            std::transform(alias.begin(), alias.end(), alias.begin(), ::tolower);
+            return name.find('0' + numeral) != std::string::npos || name.find(alias) != std::string::npos;
+        }
+
+        std::string lower = token;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        return name.find(lower) != std::string::npos;
+    }
+
+    // Same result as calling FindMatchingThumbnail for every title, but the
+    // thumbnails table is read once. thumbnails[i] is empty when titles[i] has no match.
+    void FindMatchingThumbnails(sqlite3 *database, std::vector<std::vector<std::string>> &titles, std::vector<std::string> &thumbnails)
+    {
+        thumbnails.assign(titles.size(), std::string());
+        LoadCurrentThumbnailIndex(database);
+
+        sqlite3_stmt *res;
+        if (thumbnail_index.indexed)
+        {
+            std::map<int64_t, std::vector<int>> wanted;
+            for (int i = 0; i < titles.size(); i++)
+            {
+                uint32_t best;
+                if (FindIndexedRank(&thumbnail_index, titles[i], &best))
+                {
+                    wanted[thumbnail_index.ranks[best]].push_back(i);
+                }
+            }
+
+            std::string sql = std::string("SELECT rowid, filename FROM ") + THUMBNAILS_TABLE;
+            if (!wanted.empty() && Prepare(database, sql.c_str(), &res) == SQLITE_OK)
+            {
+                while (Step(res) == SQLITE_ROW)
+                {
+                    std::map<int64_t, std::vector<int>>::iterator it = wanted.find(sqlite3_column_int64(res, 0));
+                    if (it != wanted.end())
+                    {
+                        for (int i = 0; i < it->second.size(); i++)
+                        {
+                            thumbnails[it->second[i]] = (const char*)sqlite3_column_text(res, 1);
+                        }
+                    }
+                }
+                Finish(res);
+            }
+        }
+        else
+        {
+            std::vector<std::string> names;
+            std::vector<std::string> lower_names;
+            std::string sql = std::string("SELECT filename FROM ") + THUMBNAILS_TABLE + " ORDER BY length(filename) ASC";
+            int rc = Prepare(database, sql.c_str(), &res);
+            if (rc == SQLITE_OK)
+            {
+                while (Step(res) == SQLITE_ROW)
+                {
+                    std::string name = (const char*)sqlite3_column_text(res, 0);
+                    names.push_back(name);
+                    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                    lower_names.push_back(name);
+                }
+                Finish(res);
+            }
+
+            for (int i = 0; i < titles.size(); i++)
+            {
+                std::vector<std::string> &tokens = titles[i];
+                for (int tokens_to_try = tokens.size(); tokens_to_try > 0 && thumbnails[i].empty(); tokens_to_try--)
+                {
+                    for (int j = 0; j < lower_names.size(); j++)
+                    {
+                        int k = 0;
+                        while (k < tokens_to_try && NameContainsToken(lower_names[j], tokens[k]))
+                        {
+                            k++;
+                        }
+                        if (k == tokens_to_try)
+                        {
+                            thumbnails[i] = names[j];
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        sceKernelUnlockMutex(thumbnail_index_mutex, 1);
+    }
+
+    void SetupPerGameSettingsDatabase()
+    {
+        sqlite3 *db;
+        db = Acquire(PER_GAME_SETTINGS_DB_FILE);
+
+        if (!TableExists(db, PSP_GAME_SETTINGS_TABLE))
+        {
+            std::string sql = std::string("CREATE TABLE ") + PSP_GAME_SETTINGS_TABLE + "(" +
+                COL_ROM_PATH + " TEXT," +
+                COL_DRIVERS + " INTEGER," +
+                COL_EXECUTE + " INTEGER," +
+                COL_CUSTOMIZED + " INTEGER," +
+                COL_PSBUTTON_MODE + " INTEGER," +
+                COL_SUSPEND_THREADS + " INTEGER," +
+                COL_PLUGINS + " INTEGER," +
+                COL_NONPDRM + " INTEGER," +
+                COL_HIGH_MEMORY + " INTEGER," +
                 COL_CPU_SPEED + " INTEGER)";
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
@@ -1052,80 +1878,87 @@ namespace DB {
             sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
         }
 
-        sqlite3_close(db);
+        Release(db);
+    }
+
+    static void LockGameSettings()
+    {
+        if (game_settings_mutex < 0)
+        {
+            game_settings_mutex = sceKernelCreateMutex("game_settings_mutex", 0, 0, NULL);
+            game_settings_write_mutex = sceKernelCreateMutex("game_settings_write_mutex", 0, 0, NULL);
+            game_settings_pending = sceKernelCreateSema("game_settings_pending", 0, 0, 1, NULL);
+        }
+        sceKernelLockMutex(game_settings_mutex, 1, NULL);
+    }
+
+    static void UnlockGameSettings()
+    {
+        sceKernelUnlockMutex(game_settings_mutex, 1);
     }
 
-    void GetPspGameSettings(char* rom_path, BootSettings *settings)
+    // called with the settings locked
+    static void ReadGameSettings()
     {
+        if (game_settings_loaded)
+        {
+            return;
+        }
+
         sqlite3 *db;
-        sqlite3_open(PER_GAME_SETTINGS_DB_FILE, &db);
+        db = Acquire(PER_GAME_SETTINGS_DB_FILE);
 
         sqlite3_stmt *res;
-        std::string sql = std::string("SELECT ") + COL_DRIVERS + "," + COL_EXECUTE + "," + 
+        std::string sql = std::string("SELECT ") + COL_ROM_PATH + "," + COL_DRIVERS + "," + COL_EXECUTE + "," + 
             COL_CUSTOMIZED + "," + COL_PSBUTTON_MODE + "," + COL_SUSPEND_THREADS + "," + COL_PLUGINS + "," + 
-            COL_NONPDRM + "," + COL_HIGH_MEMORY + "," + COL_CPU_SPEED + " FROM " + PSP_GAME_SETTINGS_TABLE +
-            " WHERE " + COL_ROM_PATH + "=?";
-
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+            COL_NONPDRM + "," + COL_HIGH_MEMORY + "," + COL_CPU_SPEED + " FROM " + PSP_GAME_SETTINGS_TABLE;
+        int rc = Prepare(db, sql.c_str(), &res);
 
         if (rc == SQLITE_OK)
         {
-            sqlite3_bind_text(res, 1, rom_path, strlen(rom_path), NULL);
-            int step = sqlite3_step(res);
-            if (step == SQLITE_ROW)
+            while (Step(res) == SQLITE_ROW)
             {
-                settings->driver = sqlite3_column_int(res, 0);
-                settings->execute = sqlite3_column_int(res, 1);
-                settings->customized = sqlite3_column_int(res, 2);
-                settings->ps_button_mode = sqlite3_column_int(res, 3);
-                settings->suspend_threads = sqlite3_column_int(res, 4);
-                settings->plugins = sqlite3_column_int(res, 5);
-                settings->nonpdrm = sqlite3_column_int(res, 6);
-                settings->high_memory = sqlite3_column_int(res, 7);
-                settings->cpu_speed = sqlite3_column_int(res, 8);
+                BootSettings settings;
+                settings.driver = (DRIVERS)sqlite3_column_int(res, 1);
+                settings.execute = (EXECUTE)sqlite3_column_int(res, 2);
+                settings.customized = sqlite3_column_int(res, 3);
+                settings.ps_button_mode = (PSBUTTON_MODE)sqlite3_column_int(res, 4);
+                settings.suspend_threads = (SUSPEND_THREADS)sqlite3_column_int(res, 5);
+                settings.plugins = (PLUGINS)sqlite3_column_int(res, 6);
+                settings.nonpdrm = (NONPDRM)sqlite3_column_int(res, 7);
+                settings.high_memory = (HIGH_MEMORY)sqlite3_column_int(res, 8);
+                settings.cpu_speed = (CPU_SPEED)sqlite3_column_int(res, 9);
+                psp_game_settings[std::string((const char*)sqlite3_column_text(res, 0))] = settings;
             }
-            sqlite3_finalize(res);
+            Finish(res);
         }
 
-        sqlite3_close(db);
-    }
-
-    void GetRomCoreSettings(char* rom_path, char* core)
-    {
-        sqlite3 *db;
-        sqlite3_open(PER_GAME_SETTINGS_DB_FILE, &db);
-
-        sqlite3_stmt *res;
-        std::string sql = std::string("SELECT ") + COL_RETRO_CORE + " FROM " + 
-            RETROROM_GAME_SETTINGS_TABLE + " WHERE " + COL_ROM_PATH + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        sql = std::string("SELECT ") + COL_ROM_PATH + "," + COL_RETRO_CORE + " FROM " + RETROROM_GAME_SETTINGS_TABLE;
+        rc = Prepare(db, sql.c_str(), &res);
 
         if (rc == SQLITE_OK)
         {
-            sqlite3_bind_text(res, 1, rom_path, strlen(rom_path), NULL);
-            int step = sqlite3_step(res);
-            if (step == SQLITE_ROW)
+            while (Step(res) == SQLITE_ROW)
             {
-                sprintf(core, "%s", sqlite3_column_text(res, 0));
+                rom_core_settings[std::string((const char*)sqlite3_column_text(res, 0))] =
+                    std::string((const char*)sqlite3_column_text(res, 1));
             }
-            sqlite3_finalize(res);
+            Finish(res);
         }
 
-        sqlite3_close(db);
+        Release(db);
+        game_settings_loaded = true;
     }
 
-    void SavePspGameSettings(char* rom_path, BootSettings *settings)
+    static void WritePspGameSettings(sqlite3 *db, const char* rom_path, BootSettings *settings)
     {
-        sqlite3 *db;
-        sqlite3_open(PER_GAME_SETTINGS_DB_FILE, &db);
-
         sqlite3_stmt *res;
         std::string sql = std::string("UPDATE ") + PSP_GAME_SETTINGS_TABLE + " SET " + 
                 COL_DRIVERS + "=?, " + COL_EXECUTE + "=?, " + COL_CUSTOMIZED + "=?, " +
                 COL_PSBUTTON_MODE + "=?, " + COL_SUSPEND_THREADS + "=?, " + COL_PLUGINS + "=?, " + 
                 COL_NONPDRM + "=?, " + COL_HIGH_MEMORY + "=?, " + COL_CPU_SPEED + "=? " + 
                 "WHERE " + COL_ROM_PATH + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK) {
             sqlite3_bind_int(res, 1, settings->driver);
             sqlite3_bind_int(res, 2, settings->execute);
@@ -1137,9 +1970,9 @@ namespace DB {
             sqlite3_bind_int(res, 8, settings->high_memory);
             sqlite3_bind_int(res, 9, settings->cpu_speed);
             sqlite3_bind_text(res, 10, rom_path, strlen(rom_path), NULL);
-            int step = sqlite3_step(res);
+            int step = Step(res);
             int updated = sqlite3_changes(db);
-            sqlite3_finalize(res);
+            Finish(res);
 
             if (updated == 0)
             {
@@ -1148,7 +1981,7 @@ namespace DB {
                     COL_PSBUTTON_MODE + ", " + COL_SUSPEND_THREADS + ", " + COL_PLUGINS + ", " + 
                     COL_NONPDRM + ", " + COL_HIGH_MEMORY + ", " + COL_CPU_SPEED + ") " + 
                     "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
-                rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+                rc = Prepare(db, sql.c_str(), &res);
             
                 if (rc == SQLITE_OK)
                 {
@@ -1162,140 +1995,318 @@ namespace DB {
                     sqlite3_bind_int(res, 8, settings->nonpdrm);
                     sqlite3_bind_int(res, 9, settings->high_memory);
                     sqlite3_bind_int(res, 10, settings->cpu_speed);
-                    step = sqlite3_step(res);
-                    sqlite3_finalize(res);
+                    step = Step(res);
+                    Finish(res);
                 }
             }
         }
-
-        sqlite3_close(db);
     }
 
-    void SaveRomCoreSettings(char* rom_path, char* core)
+    static void WriteRomCoreSettings(sqlite3 *db, const char* rom_path, const char* core)
     {
-        sqlite3 *db;
-        sqlite3_open(PER_GAME_SETTINGS_DB_FILE, &db);
-
         sqlite3_stmt *res;
         std::string sql = std::string("UPDATE ") + RETROROM_GAME_SETTINGS_TABLE + " SET " + 
             COL_RETRO_CORE + "=? WHERE " + COL_ROM_PATH + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
         if (rc == SQLITE_OK)
         {
             sqlite3_bind_text(res, 1, core, strlen(core), NULL);
             sqlite3_bind_text(res, 2, rom_path, strlen(rom_path), NULL);
-            int step = sqlite3_step(res);
+            int step = Step(res);
             int updated = sqlite3_changes(db);
-            sqlite3_finalize(res);
+            Finish(res);
 
             if (updated == 0)
             {
                 sql = std::string("INSERT INTO ") + RETROROM_GAME_SETTINGS_TABLE + "(" +
                     COL_ROM_PATH + "," + COL_RETRO_CORE + ") VALUES (?, ?)";
-                rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+                rc = Prepare(db, sql.c_str(), &res);
             
                 if (rc == SQLITE_OK)
                 {
                     sqlite3_bind_text(res, 1, rom_path, strlen(rom_path), NULL);
                     sqlite3_bind_text(res, 2, core, strlen(core), NULL);
-                    step = sqlite3_step(res);
-                    sqlite3_finalize(res);
+                    step = Step(res);
+                    Finish(res);
                 }
             }
         }
-        sqlite3_close(db);
     }
 
-    bool GetMameRomName(sqlite3 *database, char* rom_name, char* name)
+    static void WriteGameSettings()
+    {
+        if (game_settings_mutex < 0)
+        {
+            return;
+        }
+
+        sceKernelLockMutex(game_settings_write_mutex, 1, NULL);
+        std::vector<std::pair<std::string, BootSettings>> psp_settings;
+        std::vector<std::pair<std::string, std::string>> cores;
+        LockGameSettings();
+        for (std::set<std::string>::iterator it=dirty_psp_game_settings.begin(); it!=dirty_psp_game_settings.end(); ++it)
+        {
+            psp_settings.push_back(std::make_pair(*it, psp_game_settings[*it]));
+        }
+        for (std::set<std::string>::iterator it=dirty_rom_core_settings.begin(); it!=dirty_rom_core_settings.end(); ++it)
+        {
+            cores.push_back(std::make_pair(*it, rom_core_settings[*it]));
+        }
+        dirty_psp_game_settings.clear();
+        dirty_rom_core_settings.clear();
+        UnlockGameSettings();
+
+        if (psp_settings.size() > 0 || cores.size() > 0)
+        {
+            sqlite3 *db;
+            db = Acquire(PER_GAME_SETTINGS_DB_FILE);
+            sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+            for (int i=0; i<psp_settings.size(); i++)
+            {
+                WritePspGameSettings(db, psp_settings[i].first.c_str(), &psp_settings[i].second);
+            }
+            for (int i=0; i<cores.size(); i++)
+            {
+                WriteRomCoreSettings(db, cores[i].first.c_str(), cores[i].second.c_str());
+            }
+            sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+            Release(db);
+        }
+        sceKernelUnlockMutex(game_settings_write_mutex, 1);
+    }
+
+    static int GameSettingsThread(SceSize args, void *argp)
+    {
+        while (true)
+        {
+            sceKernelWaitSema(game_settings_pending, 1, NULL);
+            // settings changed one after another go out in one transaction
+            sceKernelDelayThread(GAME_SETTINGS_WRITE_DELAY);
+            WriteGameSettings();
+        }
+        return sceKernelExitDeleteThread(0);
+    }
+
+    // called with the settings locked
+    static void SetGameSettingsDirty()
+    {
+        if (game_settings_thid < 0)
+        {
+            game_settings_thid = sceKernelCreateThread("game_settings_thread", (SceKernelThreadEntry)GameSettingsThread, 0x10000100, 0x4000, 0, 0, NULL);
+            if (game_settings_thid >= 0)
+            {
+                sceKernelStartThread(game_settings_thid, 0, NULL);
+            }
+        }
+        sceKernelSignalSema(game_settings_pending, 1);
+    }
+
+    void LoadGameSettings()
+    {
+        LockGameSettings();
+        ReadGameSettings();
+        UnlockGameSettings();
+    }
+
+    // writes the pending settings now, before the launcher exits or boots a game
+    void FlushGameSettings()
+    {
+        WriteGameSettings();
+    }
+
+    void GetPspGameSettings(const char* rom_path, BootSettings *settings)
+    {
+        LockGameSettings();
+        ReadGameSettings();
+        std::map<std::string, BootSettings>::iterator it = psp_game_settings.find(rom_path);
+        if (it != psp_game_settings.end())
+        {
+            *settings = it->second;
+        }
+        UnlockGameSettings();
+    }
+
+    void GetRomCoreSettings(const char* rom_path, char* core)
+    {
+        LockGameSettings();
+        ReadGameSettings();
+        std::map<std::string, std::string>::iterator it = rom_core_settings.find(rom_path);
+        if (it != rom_core_settings.end())
+        {
+            sprintf(core, "%s", it->second.c_str());
+        }
+        UnlockGameSettings();
+    }
+
+    void SavePspGameSettings(const char* rom_path, BootSettings *settings)
+    {
+        LockGameSettings();
+        ReadGameSettings();
+        psp_game_settings[rom_path] = *settings;
+        dirty_psp_game_settings.insert(rom_path);
+        SetGameSettingsDirty();
+        UnlockGameSettings();
+    }
+
+    void SaveRomCoreSettings(const char* rom_path, const char* core)
+    {
+        LockGameSettings();
+        ReadGameSettings();
+        rom_core_settings[rom_path] = core;
+        dirty_rom_core_settings.insert(rom_path);
+        SetGameSettingsDirty();
+        UnlockGameSettings();
+    }
+
+    bool GetMameRomName(sqlite3 *database, const char* rom_name, char* name)
     {
         sqlite3 *db = database;
         if (database == nullptr)
         {
-            sqlite3_open(MAME_ROM_NAME_MAPPINGS_FILE, &db);
+            db = Acquire(MAME_ROM_NAME_MAPPINGS_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("SELECT name FROM mappings WHERE rom_name=?");
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
 
         bool found = false;
         if (rc == SQLITE_OK)
         {
             sqlite3_bind_text(res, 1, rom_name, strlen(rom_name), NULL);
-            int step = sqlite3_step(res);
+            int step = Step(res);
             if (step == SQLITE_ROW)
             {
                 strlcpy(name, sqlite3_column_text(res, 0), 128);
                 found = true;
             }
-            sqlite3_finalize(res);
+            Finish(res);
         }
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
 
         return found;
     }
 
-    void InsertVitaAppFolder(sqlite3 *database, char* title_id, int folder_id)
+    void LoadMameNameTable(sqlite3 *database, MameNameTable *table)
     {
         sqlite3 *db = database;
         if (database == nullptr)
         {
-            sqlite3_open(VITA_APP_DB_FILE, &db);
+            db = Acquire(MAME_ROM_NAME_MAPPINGS_FILE);
         }
 
+        table->pool.clear();
+        table->index.clear();
         sqlite3_stmt *res;
-        std::string sql = std::string("INSERT INTO ") + APP_FOLDERS_TABLE + 
-            "(" + COL_ID + ", " + COL_FOLDER_ID + ") VALUES (?,?)";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        std::string sql = std::string("SELECT rom_name, name FROM mappings");
+        int rc = Prepare(db, sql.c_str(), &res);
 
         if (rc == SQLITE_OK)
         {
-            sqlite3_bind_text(res, 1, title_id, strlen(title_id), NULL);
-            sqlite3_bind_int(res, 2, folder_id);
-            sqlite3_step(res);
-        }
-        sqlite3_finalize(res);
-
+            while (Step(res) == SQLITE_ROW)
+            {
+                const char *rom_name = (const char*)sqlite3_column_text(res, 0);
+                const char *name = (const char*)sqlite3_column_text(res, 1);
+                if (rom_name == nullptr || name == nullptr)
+                {
+                    continue;
+                }
+                table->index.push_back(table->pool.size());
+                table->pool.insert(table->pool.end(), rom_name, rom_name + strlen(rom_name) + 1);
+                table->pool.insert(table->pool.end(), name, name + strlen(name) + 1);
+            }
+            Finish(res);
+        }
+
+        const char *pool = table->pool.data();
+        std::sort(table->index.begin(), table->index.end(), [pool](uint32_t a, uint32_t b) {
+            return strcmp(pool + a, pool + b) < 0;
+        });
+
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
-    int UpdateVitaAppFolder(sqlite3 *database, char* title_id, int folder_id)
+    bool FindMameRomName(const MameNameTable *table, const char* rom_name, char* name)
+    {
+        const char *pool = table->pool.data();
+        std::vector<uint32_t>::const_iterator it = std::lower_bound(table->index.begin(), table->index.end(), rom_name,
+            [pool](uint32_t offset, const char *key) {
+                return strcmp(pool + offset, key) < 0;
+            });
+
+        if (it == table->index.end() || strcmp(pool + *it, rom_name) != 0)
+        {
+            return false;
+        }
+        const char *rom = pool + *it;
+        strlcpy(name, rom + strlen(rom) + 1, 128);
+        return true;
+    }
+
+    void InsertVitaAppFolder(sqlite3 *database, const char* title_id, int folder_id)
     {
         sqlite3 *db = database;
         if (database == nullptr)
         {
-            sqlite3_open(VITA_APP_DB_FILE, &db);
+            db = Acquire(VITA_APP_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("INSERT INTO ") + APP_FOLDERS_TABLE + 
+            "(" + COL_ID + ", " + COL_FOLDER_ID + ") VALUES (?,?)";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_text(res, 1, title_id, strlen(title_id), NULL);
+            sqlite3_bind_int(res, 2, folder_id);
+            Step(res);
+        }
+        Finish(res);
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    int UpdateVitaAppFolder(sqlite3 *database, const char* title_id, int folder_id)
+    {
+        sqlite3 *db = database;
+        if (database == nullptr)
+        {
+            db = Acquire(VITA_APP_DB_FILE);
         }
 
         sqlite3_stmt *res;
         int count = 0;
         std::string sql = std::string("UPDATE ") + APP_FOLDERS_TABLE + " SET " +
             COL_FOLDER_ID + "=? WHERE " + COL_ID + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
 
         if (rc == SQLITE_OK)
         {
             sqlite3_bind_int(res, 1, folder_id);
             sqlite3_bind_text(res, 2, title_id, strlen(title_id), NULL);
-            rc = sqlite3_step(res);
+            rc = Step(res);
 
             if (rc == SQLITE_DONE)
             {
                 count = sqlite3_changes(db);
             }
         }
-        sqlite3_finalize(res);
+        Finish(res);
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
 
         return count;
@@ -1306,50 +2317,471 @@ namespace DB {
         sqlite3 *db = database;
         if (database == nullptr)
         {
-            sqlite3_open(VITA_APP_DB_FILE, &db);
+            db = Acquire(VITA_APP_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("DELETE FROM ") + APP_FOLDERS_TABLE +
             " WHERE " + COL_FOLDER_ID + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
 
         if (rc == SQLITE_OK)
         {
             sqlite3_bind_int(res, 1, folder_id);
-            sqlite3_step(res);
+            Step(res);
         }
-        sqlite3_finalize(res);
+        Finish(res);
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 
-    void DeleteVitaAppFolderById(sqlite3 *database, char* title_id)
+    void DeleteVitaAppFolderById(sqlite3 *database, const char* title_id)
     {
         sqlite3 *db = database;
         if (database == nullptr)
         {
-            sqlite3_open(VITA_APP_DB_FILE, &db);
+            db = Acquire(VITA_APP_DB_FILE);
         }
 
         sqlite3_stmt *res;
         std::string sql = std::string("DELETE FROM ") + APP_FOLDERS_TABLE +
             " WHERE " + COL_ID + "=?";
-        int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &res, nullptr);
+        int rc = Prepare(db, sql.c_str(), &res);
 
         if (rc == SQLITE_OK)
         {
             sqlite3_bind_text(res, 1, title_id, strlen(title_id), NULL);
-            sqlite3_step(res);
+            Step(res);
+        }
+        Finish(res);
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void SetupFileManifest(sqlite3 *database)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        if (!TableExists(db, FILE_MANIFEST_TABLE))
+        {
+            std::string sql = std::string("CREATE TABLE ") + FILE_MANIFEST_TABLE + "(" +
+                COL_ROOT + " TEXT," +
+                COL_PATH + " TEXT," +
+                COL_SIZE + " INTEGER," +
+                COL_MTIME + " INTEGER," +
+                COL_IS_DIR + " INTEGER," +
+                "PRIMARY KEY(" + COL_ROOT + "," + COL_PATH + "))";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void GetFileManifest(sqlite3 *database, const char* root, std::map<std::string, FileManifestEntry> &manifest)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("SELECT ") + COL_PATH + "," + COL_SIZE + "," + COL_MTIME + "," +
+            COL_IS_DIR + " FROM " + FILE_MANIFEST_TABLE + " WHERE " + COL_ROOT + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_text(res, 1, root, strlen(root), NULL);
+            while (Step(res) == SQLITE_ROW)
+            {
+                FileManifestEntry entry;
+                entry.size = sqlite3_column_int64(res, 1);
+                entry.mtime = sqlite3_column_int64(res, 2);
+                entry.is_dir = sqlite3_column_int(res, 3);
+                entry.seen = false;
+                manifest[std::string((const char*)sqlite3_column_text(res, 0))] = entry;
+            }
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void SaveFileManifestEntry(sqlite3 *database, const char* root, const char* path, FileManifestEntry *entry)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("INSERT OR REPLACE INTO ") + FILE_MANIFEST_TABLE + "(" + COL_ROOT + "," +
+            COL_PATH + "," + COL_SIZE + "," + COL_MTIME + "," + COL_IS_DIR + ") VALUES (?, ?, ?, ?, ?)";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_text(res, 1, root, strlen(root), NULL);
+            sqlite3_bind_text(res, 2, path, strlen(path), NULL);
+            sqlite3_bind_int64(res, 3, entry->size);
+            sqlite3_bind_int64(res, 4, entry->mtime);
+            sqlite3_bind_int(res, 5, entry->is_dir);
+            Step(res);
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void DeleteFileManifestEntry(sqlite3 *database, const char* root, const char* path)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("DELETE FROM ") + FILE_MANIFEST_TABLE + " WHERE " +
+            COL_ROOT + "=? AND " + COL_PATH + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_text(res, 1, root, strlen(root), NULL);
+            sqlite3_bind_text(res, 2, path, strlen(path), NULL);
+            Step(res);
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void SetupDirSignatures(sqlite3 *database)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        if (!TableExists(db, DIR_SIGNATURES_TABLE))
+        {
+            std::string sql = std::string("CREATE TABLE ") + DIR_SIGNATURES_TABLE + "(" +
+                COL_ROOT + " TEXT," +
+                COL_PATH + " TEXT," +
+                COL_MTIME + " INTEGER," +
+                "PRIMARY KEY(" + COL_ROOT + "," + COL_PATH + "))";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
         }
-        sqlite3_finalize(res);
+    }
+
+    void GetDirSignatures(sqlite3 *database, const char* root, DirSignatures &signatures)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("SELECT ") + COL_PATH + "," + COL_MTIME + " FROM " +
+            DIR_SIGNATURES_TABLE + " WHERE " + COL_ROOT + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_text(res, 1, root, strlen(root), NULL);
+            while (Step(res) == SQLITE_ROW)
+            {
+                DirSignature signature;
+                signature.mtime = sqlite3_column_int64(res, 1);
+                signature.seen = false;
+                signature.listed = false;
+                signatures[std::string((const char*)sqlite3_column_text(res, 0))] = signature;
+            }
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void SaveDirSignature(sqlite3 *database, const char* root, const char* path, DirSignature *signature)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("INSERT OR REPLACE INTO ") + DIR_SIGNATURES_TABLE + "(" + COL_ROOT + "," +
+            COL_PATH + "," + COL_MTIME + ") VALUES (?, ?, ?)";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_text(res, 1, root, strlen(root), NULL);
+            sqlite3_bind_text(res, 2, path, strlen(path), NULL);
+            sqlite3_bind_int64(res, 3, signature->mtime);
+            Step(res);
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void DeleteDirSignature(sqlite3 *database, const char* root, const char* path)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("DELETE FROM ") + DIR_SIGNATURES_TABLE + " WHERE " +
+            COL_ROOT + "=? AND " + COL_PATH + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_text(res, 1, root, strlen(root), NULL);
+            sqlite3_bind_text(res, 2, path, strlen(path), NULL);
+            Step(res);
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void SetupImageMetadata(sqlite3 *database)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(IMAGE_METADATA_DB_FILE);
+        }
+
+        if (!TableExists(db, IMAGE_METADATA_TABLE))
+        {
+            std::string sql = std::string("CREATE TABLE ") + IMAGE_METADATA_TABLE + "(" +
+                COL_FINGERPRINT + " TEXT PRIMARY KEY," +
+                COL_TITLE_ID + " TEXT," +
+                COL_TITLE + " TEXT," +
+                COL_TYPE + " INTEGER," +
+                COL_CATEGORY_ID + " INTEGER)";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+        }
+        else if (!TableColumnExists(db, IMAGE_METADATA_TABLE, COL_CATEGORY_ID))
+        {
+            MigrateCategoryIds(db, IMAGE_METADATA_TABLE);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void GetImageMetadata(sqlite3 *database, std::map<std::string, Game> &metadata)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(IMAGE_METADATA_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("SELECT ") + COL_FINGERPRINT + "," + COL_TITLE_ID + "," + COL_TITLE + "," +
+            COL_TYPE + "," + COL_CATEGORY_ID + " FROM " + IMAGE_METADATA_TABLE;
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            while (Step(res) == SQLITE_ROW)
+            {
+                Game game;
+                game.id = ARENA::Copy((const char*)sqlite3_column_text(res, 1), 19);
+                game.title = ARENA::Copy((const char*)sqlite3_column_text(res, 2), 127);
+                game.type = sqlite3_column_int(res, 3);
+                game.category = sqlite3_column_int(res, 4);
+                metadata[std::string((const char*)sqlite3_column_text(res, 0))] = game;
+            }
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void SaveImageMetadata(sqlite3 *database, const char* fingerprint, Game *game)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(IMAGE_METADATA_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("INSERT OR REPLACE INTO ") + IMAGE_METADATA_TABLE + "(" + COL_FINGERPRINT + "," +
+            COL_TITLE_ID + "," + COL_TITLE + "," + COL_TYPE + "," + COL_CATEGORY_ID + ") VALUES (?, ?, ?, ?, ?)";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_text(res, 1, fingerprint, strlen(fingerprint), NULL);
+            sqlite3_bind_text(res, 2, game->id, strlen(game->id), NULL);
+            sqlite3_bind_text(res, 3, game->title, strlen(game->title), NULL);
+            sqlite3_bind_int(res, 4, game->type);
+            sqlite3_bind_int(res, 5, game->category);
+            Step(res);
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    void GetMaxImageMetadataTitleId(sqlite3 *database, int type, char* max_title_id)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(IMAGE_METADATA_DB_FILE);
+        }
+
+        sqlite3_stmt *res;
+        std::string sql = std::string("SELECT max(") + COL_TITLE_ID + ") FROM " + IMAGE_METADATA_TABLE + " WHERE " + COL_TYPE + "=?";
+        int rc = Prepare(db, sql.c_str(), &res);
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_bind_int(res, 1, type);
+            if (Step(res) == SQLITE_ROW && sqlite3_column_type(res, 0) != SQLITE_NULL)
+            {
+                snprintf(max_title_id, 20, "%s", sqlite3_column_text(res, 0));
+            }
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    // a single row telling whether the last scan of the emulator folders ran to the end
+    void SetupScanState(sqlite3 *database, bool complete)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        if (!TableExists(db, SCAN_STATE_TABLE))
+        {
+            std::string sql = std::string("CREATE TABLE ") + SCAN_STATE_TABLE + "(" +
+                COL_COMPLETE + " INTEGER)";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+
+            sql = std::string("INSERT INTO ") + SCAN_STATE_TABLE + "(" + COL_COMPLETE + ") VALUES (" +
+                (complete ? "1" : "0") + ")";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+    }
+
+    bool IsScanComplete(sqlite3 *database)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        bool complete = false;
+        sqlite3_stmt *res;
+        std::string sql = std::string("SELECT ") + COL_COMPLETE + " FROM " + SCAN_STATE_TABLE;
+        int rc = Prepare(db, sql.c_str(), &res);
+        if (rc == SQLITE_OK)
+        {
+            if (Step(res) == SQLITE_ROW)
+            {
+                complete = sqlite3_column_int(res, 0) != 0;
+            }
+            Finish(res);
+        }
+
+        if (database == nullptr)
+        {
+            Release(db);
+        }
+        return complete;
+    }
+
+    void SetScanComplete(sqlite3 *database, bool complete)
+    {
+        sqlite3 *db = database;
+        if (db == nullptr)
+        {
+            db = Acquire(CACHE_DB_FILE);
+        }
+
+        std::string sql = std::string("UPDATE ") + SCAN_STATE_TABLE + " SET " + COL_COMPLETE + "=" +
+            (complete ? "1" : "0");
+        sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
 
         if (database == nullptr)
         {
-            sqlite3_close(db);
+            Release(db);
         }
     }
 }
@@ -8,6 +8,11 @@
 #define PER_GAME_SETTINGS_DB_FILE "ux0:data/SMLA00001/game_settings.db"
 #define VITA_APP_DB_FILE "ur0:shell/db/app.db"
 #define MAME_ROM_NAME_MAPPINGS_FILE "ux0:app/SMLA00001/thumbnails/mame_mapping.db"
+#define IMAGE_METADATA_DB_FILE "ux0:data/SMLA00001/image_metadata.db"
+#define SCAN_STATS_LOG_FILE "ux0:data/SMLA00001/scan_stats.log"
+
+// PRAGMA user_version of an up to date cache.db, DB::UpdateDatabase migrates older ones
+#define CACHE_DB_VERSION 3
 
 #define GAMES_TABLE "games"
 #define FAVORITES_TABLE "favorites"
@@ -15,15 +20,30 @@
 #define PSP_GAME_SETTINGS_TABLE "psp_settings"
 #define RETROROM_GAME_SETTINGS_TABLE "retrorom_settings"
 #define APP_FOLDERS_TABLE "app_folders"
+#define FILE_MANIFEST_TABLE "file_manifest"
+#define IMAGE_METADATA_TABLE "image_metadata"
+#define DIR_SIGNATURES_TABLE "dir_signatures"
+#define THUMBNAILS_TABLE "thumbnails"
+#define THUMBNAIL_TOKENS_TABLE "thumbnail_tokens"
+#define THUMBNAIL_RANKS_TABLE "thumbnail_ranks"
+#define SCAN_STATE_TABLE "scan_state"
 
 #define COL_TITLE_ID "title_id"
 #define COL_TYPE "type"
 #define COL_TITLE "title"
 #define COL_CATEGORY "category"
+#define COL_CATEGORY_ID "category_id"
 #define COL_ROM_PATH "rom_path"
 #define COL_ID "id"
 #define COL_FOLDER_ID "folder_id"
 #define COL_ICON_PATH "icon_path"
+#define COL_ROOT "root"
+#define COL_PATH "path"
+#define COL_SIZE "size"
+#define COL_MTIME "mtime"
+#define COL_IS_DIR "is_dir"
+#define COL_FINGERPRINT "fingerprint"
+#define COL_COMPLETE "complete"
 
 #define COL_DRIVERS                   "drivers"
 #define COL_EXECUTE                   "execute"
@@ -37,14 +57,85 @@
 
 #define COL_RETRO_CORE                "retro_code"
 
+// Keeps the games insert prepared and commits every batch_size rows.
+// A batch_size of 1 or less falls back to InsertGame, one implicit commit per row.
+typedef struct {
+    sqlite3 *db;
+    sqlite3_stmt *insert_game;
+    int batch_size;
+    int batch_rows;
+    int rows;
+    uint64_t insert_time;
+} BulkInsert;
+
+// Connections handed out by DB::Acquire stay open between calls and keep their
+// last DB_STATEMENT_CACHE_SIZE prepared statements, keyed by sql text. A connection
+// belongs to one thread from Acquire to Release.
+#define DB_MAX_CONNECTIONS 8
+#define DB_STATEMENT_CACHE_SIZE 24
+
+// Connections opened through DB::Open wait this long for the lock another one
+// holds, the scan writer keeps cache.db locked for one batch at a time. Write
+// transactions on cache.db start with BEGIN IMMEDIATE so the wait happens there
+// and not halfway through, where sqlite gives up right away.
+#define DB_BUSY_TIMEOUT 5000000
+#define DB_BUSY_RETRY_DELAY 10000
+
+// The per game boot settings are read from game_settings.db once. Saving only
+// changes them in memory, a thread writes what changed in one transaction
+// GAME_SETTINGS_WRITE_DELAY microseconds after the first change.
+#define GAME_SETTINGS_WRITE_DELAY 1000000
+
+typedef struct {
+    int opens;
+    int prepares;
+    int cached_prepares;
+    int steps;
+    int busy_waits;
+} DbCounters;
+
+extern DbCounters db_counters;
+
+// rom_name/name pairs of mame_mapping.db packed into one string pool, each rom
+// name followed by its name. index holds the pool offsets sorted by rom name.
+typedef struct {
+    std::vector<char> pool;
+    std::vector<uint32_t> index;
+} MameNameTable;
+
+// thumbnail_tokens and thumbnail_ranks of one thumbnails db, written by
+// thumbnails_db/build_token_index.py. Token i is the string at token_offsets[i]
+// in token_pool, its postings run from posting_offsets[i] to posting_offsets[i+1].
+// A posting is a rank, the position of a file name in length then rowid order.
+typedef struct {
+    std::string file;
+    bool indexed;
+    std::vector<char> token_pool;
+    std::vector<uint32_t> token_offsets;
+    std::vector<uint32_t> postings;
+    std::vector<uint32_t> posting_offsets;
+    std::vector<uint32_t> ranks;
+} ThumbnailIndex;
+
 namespace DB {
+    int Open(const char *path, sqlite3 **db);
+    sqlite3* Acquire(const char *path);
+    void Release(sqlite3 *db);
+    int Prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt);
+    int Step(sqlite3_stmt *stmt);
+    void Finish(sqlite3_stmt *stmt);
+    void CloseConnections();
+    void LogCounters(const char *label);
     bool TableExists(sqlite3 *db, char* table_name);
     bool TableColumnExists(sqlite3 *db, char* table_name, char* column_name);
-    void GetVitaDbGames();
-    int GetVitaDbGamesCount();
+    void GetVitaDbGames(std::vector<Game> &games);
     void SetupDatabase(sqlite3 *database);
     void UpdateDatabase(sqlite3 *database);
     void InsertGame(sqlite3 *database, Game *game);
+    void BeginBulkInsert(sqlite3 *database, BulkInsert *bulk, int batch_size);
+    void BulkInsertGame(BulkInsert *bulk, Game *game);
+    void FlushBulkInsert(BulkInsert *bulk);
+    void EndBulkInsert(BulkInsert *bulk);
     void InsertFolder(sqlite3 *database, Folder *folder);
     void UpdateFolder(sqlite3 *database, Folder *folder);
     void GetFolders(sqlite3 *database, GameCategory *category);
@@ -57,7 +148,7 @@ namespace DB {
     void DeleteFavorite(sqlite3 *database, Game *game);
     void InsertFavorite(sqlite3 *database, Game *game);
     void GetFavorites(sqlite3 *database, GameCategory *category);
-    void DeleteGamesByCategoryAndType(sqlite3 *database, const char* category, int type);
+    void DeleteGamesByCategoryAndType(sqlite3 *database, int category, int type);
     void DeleteGamesByType(sqlite3 *database, int type);
     void UpdateFavoritesGameCategoryById(sqlite3 *database, Game *game);
     void UpdateFavoritesGameCategoryByRomPath(sqlite3 *database, Game *game);
@@ -66,16 +157,37 @@ namespace DB {
     void GetMaxTitleIdByType(sqlite3 *database, int type, char* max_title_id);
     bool FindMatchingThumbnail(char* db_name, std::vector<std::string> &tokens, char* thumbnail);
     bool FindMatchingThumbnail(sqlite3 *database, std::vector<std::string> &tokens, char* thumbnail);
+    void FindMatchingThumbnails(sqlite3 *database, std::vector<std::vector<std::string>> &titles, std::vector<std::string> &thumbnails);
+    void LoadThumbnailIndex(sqlite3 *database, ThumbnailIndex *index);
     void SetupPerGameSettingsDatabase();
-    void GetPspGameSettings(char* rom_path, BootSettings *settings);
-    void GetRomCoreSettings(char* rom_path, char* core);
-    void SavePspGameSettings(char* rom_path, BootSettings *settings);
-    void SaveRomCoreSettings(char* rom_path, char* core);
-    bool GetMameRomName(sqlite3 *database, char* rom_name, char* name);
-    void InsertVitaAppFolder(sqlite3 *database, char* title_id, int folder_id);
-    int UpdateVitaAppFolder(sqlite3 *database, char* title_id, int folder_id);
+    void LoadGameSettings();
+    void FlushGameSettings();
+    void GetPspGameSettings(const char* rom_path, BootSettings *settings);
+    void GetRomCoreSettings(const char* rom_path, char* core);
+    void SavePspGameSettings(const char* rom_path, BootSettings *settings);
+    void SaveRomCoreSettings(const char* rom_path, const char* core);
+    bool GetMameRomName(sqlite3 *database, const char* rom_name, char* name);
+    void LoadMameNameTable(sqlite3 *database, MameNameTable *table);
+    bool FindMameRomName(const MameNameTable *table, const char* rom_name, char* name);
+    void InsertVitaAppFolder(sqlite3 *database, const char* title_id, int folder_id);
+    int UpdateVitaAppFolder(sqlite3 *database, const char* title_id, int folder_id);
     void DeleteVitaAppFolder(sqlite3 *database, int folder_id);
-    void DeleteVitaAppFolderById(sqlite3 *database, char* title_id);
+    void DeleteVitaAppFolderById(sqlite3 *database, const char* title_id);
+    void SetupFileManifest(sqlite3 *database);
+    void GetFileManifest(sqlite3 *database, const char* root, std::map<std::string, FileManifestEntry> &manifest);
+    void SaveFileManifestEntry(sqlite3 *database, const char* root, const char* path, FileManifestEntry *entry);
+    void DeleteFileManifestEntry(sqlite3 *database, const char* root, const char* path);
+    void SetupDirSignatures(sqlite3 *database);
+    void GetDirSignatures(sqlite3 *database, const char* root, DirSignatures &signatures);
+    void SaveDirSignature(sqlite3 *database, const char* root, const char* path, DirSignature *signature);
+    void DeleteDirSignature(sqlite3 *database, const char* root, const char* path);
+    void SetupImageMetadata(sqlite3 *database);
+    void GetImageMetadata(sqlite3 *database, std::map<std::string, Game> &metadata);
+    void SaveImageMetadata(sqlite3 *database, const char* fingerprint, Game *game);
+    void GetMaxImageMetadataTitleId(sqlite3 *database, int type, char* max_title_id);
+    void SetupScanState(sqlite3 *database, bool complete);
+    bool IsScanComplete(sqlite3 *database);
+    void SetScanComplete(sqlite3 *database, bool complete);
 }
 
 #endif
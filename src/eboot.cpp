@@ -19,7 +19,7 @@ int maxbuffer = 1024;
 
 namespace EBOOT {
 
-    void Extract(char* eboot_path, char* rom_folder)
+    void Extract(const char* eboot_path, const char* rom_folder)
     {
         void *infile;
         void *outfile;
@@ -2,7 +2,7 @@
 #define LAUNCHER_EBOOT_H
 
 namespace EBOOT {
-    void Extract(char* path, char* title_id);
+    void Extract(const char* path, const char* title_id);
 }
 
 #endif
\ No newline at end of file
@@ -6,10 +6,44 @@
 #include <psp2/net/net.h>
 
 #include <algorithm>
+#include <cstring>
+#include <strings.h>
+#include <map>
 
 #define ERRNO_EEXIST (int)(0x80010000 + SCE_NET_EEXIST)
 #define ERRNO_ENOENT (int)(0x80010000 + SCE_NET_ENOENT)
 
+static uint64_t DateTimeToTimestamp(const SceDateTime &time)
+{
+    return ((((((uint64_t)time.year * 12 + time.month) * 31 + time.day) * 24 + time.hour) * 60 + time.minute) * 60 + time.second) * 1000000 + time.microsecond;
+}
+
+#define EXTENSION_KEY_LENGTH 8
+#define EXTENSION_SEED_ATTEMPTS 32
+
+// extensions longer than a key are not packed and go to the long list
+static bool PackExtension(const char *ext, std::size_t length, uint64_t *key)
+{
+    if (length == 0 || length > EXTENSION_KEY_LENGTH)
+        return false;
+
+    uint64_t packed = 0;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        unsigned char c = ext[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        packed = (packed << 8) | c;
+    }
+    *key = packed;
+    return true;
+}
+
+static inline uint32_t ExtensionSlot(uint64_t key, uint64_t seed, int shift)
+{
+    return (uint32_t)((key * seed) >> shift);
+}
+
 namespace FS {
     void MkDirs(const std::string& ppath)
     {
@@ -46,6 +80,20 @@ namespace FS {
         return stat.st_size;
     }
 
+    bool GetFileInfo(const std::string& path, FileInfo *info)
+    {
+        SceIoStat stat;
+        if (sceIoGetstat(path.c_str(), &stat) < 0)
+        {
+            return false;
+        }
+        info->path = path;
+        info->size = stat.st_size;
+        info->mtime = DateTimeToTimestamp(stat.st_mtime);
+        info->is_dir = SCE_S_ISDIR(stat.st_mode);
+        return true;
+    }
+
     bool FileExists(const std::string& path)
     {
         SceIoStat stat;
@@ -157,6 +205,15 @@ namespace FS {
         }
     }
 
+    void AppendText(const std::string& path, const char* text)
+    {
+        SceUID fd = sceIoOpen(path.c_str(), SCE_O_WRONLY | SCE_O_CREAT | SCE_O_APPEND, 0777);
+        if (fd < 0)
+            return;
+        sceIoWrite(fd, text, strlen(text));
+        sceIoClose(fd);
+    }
+
     std::vector<std::string> ListDir(const std::string& path)
     {
         const auto fd = sceIoDopen(path.c_str());
@@ -184,42 +241,285 @@ namespace FS {
         return out;
     }
 
-    std::vector<std::string> ListFiles(const std::string& path)
+    static bool IsExcluded(const char *name, const std::vector<std::string> *exclude)
     {
-        const auto fd = sceIoDopen(path.c_str());
-        if (static_cast<uint32_t>(fd) == 0x80010002)
-            return {};
+        if (exclude == nullptr)
+            return false;
+        return std::find(exclude->begin(), exclude->end(), name) != exclude->end();
+    }
+
+    // full_path and file.path are grown and shrunk in place while descending
+    static bool WalkDir(std::string &full_path, FileInfo &file, uint64_t mtime, int depth, const WalkOptions &options, const WalkVisitor &visitor);
+
+    // an unchanged directory only needs the subdirectories it had last time checked
+    static bool WalkKnownDirs(std::string &full_path, FileInfo &file, int depth, const WalkOptions &options, const WalkVisitor &visitor)
+    {
+        if (options.max_depth >= 0 && depth >= options.max_depth)
+            return true;
+
+        const std::string prefix = file.path.length() > 0 ? file.path + "/" : "";
+        std::vector<std::string> children;
+        for (DirSignatures::iterator it = options.signatures->lower_bound(prefix);
+             it != options.signatures->end() && it->first.compare(0, prefix.length(), prefix) == 0; ++it)
+        {
+            if (it->first.length() > prefix.length() && it->first.find('/', prefix.length()) == std::string::npos)
+                children.push_back(it->first.substr(prefix.length()));
+        }
+
+        const std::size_t full_length = full_path.length();
+        const std::size_t path_length = file.path.length();
+        bool keep_walking = true;
+        for (std::size_t i = 0; keep_walking && i < children.size(); i++)
+        {
+            full_path.push_back('/');
+            full_path.append(children[i]);
+            SceIoStat stat;
+            if (sceIoGetstat(full_path.c_str(), &stat) >= 0 && SCE_S_ISDIR(stat.st_mode))
+            {
+                if (path_length > 0)
+                    file.path.push_back('/');
+                file.path.append(children[i]);
+                file.size = stat.st_size;
+                file.mtime = DateTimeToTimestamp(stat.st_mtime);
+                file.is_dir = true;
+
+                if (options.include_dirs)
+                    keep_walking = visitor(file);
+                if (keep_walking)
+                    keep_walking = WalkDir(full_path, file, file.mtime, depth + 1, options, visitor);
+                file.path.resize(path_length);
+            }
+            full_path.resize(full_length);
+        }
+        return keep_walking;
+    }
+
+    static bool WalkDir(std::string &full_path, FileInfo &file, uint64_t mtime, int depth, const WalkOptions &options, const WalkVisitor &visitor)
+    {
+        if (options.signatures != nullptr && mtime != 0)
+        {
+            DirSignatures::iterator known = options.signatures->find(file.path);
+            if (known != options.signatures->end() && known->second.mtime == mtime)
+            {
+                known->second.seen = true;
+                known->second.listed = false;
+                return WalkKnownDirs(full_path, file, depth, options, visitor);
+            }
+        }
+
+        const auto fd = sceIoDopen(full_path.c_str());
         if (fd < 0)
-            return std::vector<std::string>(0);
+            return true;
 
-        std::vector<std::string> out;
-        while (true)
+        const std::size_t full_length = full_path.length();
+        const std::size_t path_length = file.path.length();
+        bool keep_walking = true;
+        SceIoDirent dirent;
+        while (keep_walking && sceIoDread(fd, &dirent) > 0)
         {
-            SceIoDirent dirent;
-            const auto ret = sceIoDread(fd, &dirent);
-            if (ret < 0) {
-                sceIoDclose(fd);
-                return out;
+            bool is_dir = SCE_S_ISDIR(dirent.d_stat.st_mode);
+            if ((is_dir && IsExcluded(dirent.d_name, options.exclude)) || (!is_dir && options.extensions != nullptr && MatchExtension(options.extensions, dirent.d_name, strlen(dirent.d_name)) == 0))
+                continue;
+
+            if (path_length > 0)
+                file.path.push_back('/');
+            file.path.append(dirent.d_name);
+            file.size = dirent.d_stat.st_size;
+            file.mtime = DateTimeToTimestamp(dirent.d_stat.st_mtime);
+            file.is_dir = is_dir;
+
+            if (!is_dir || options.include_dirs)
+                keep_walking = visitor(file);
+
+            if (keep_walking && is_dir && (options.max_depth < 0 || depth < options.max_depth))
+            {
+                full_path.push_back('/');
+                full_path.append(dirent.d_name);
+                keep_walking = WalkDir(full_path, file, file.mtime, depth + 1, options, visitor);
+                full_path.resize(full_length);
             }
-            else if (ret == 0)
-                break;
+            file.path.resize(path_length);
+        }
+        sceIoDclose(fd);
 
-            if (SCE_S_ISDIR(dirent.d_stat.st_mode))
+        // a listing cut short must not be taken for the whole directory
+        if (keep_walking && options.signatures != nullptr && mtime != 0)
+        {
+            DirSignature &signature = (*options.signatures)[file.path];
+            signature.mtime = mtime;
+            signature.seen = true;
+            signature.listed = true;
+        }
+        return keep_walking;
+    }
+
+    bool Walk(const std::string& path, const WalkOptions &options, WalkVisitor visitor)
+    {
+        std::string full_path = path;
+        FileInfo file;
+        uint64_t mtime = 0;
+        SceIoStat stat;
+        if (options.signatures != nullptr && sceIoGetstat(path.c_str(), &stat) >= 0)
+        {
+            mtime = DateTimeToTimestamp(stat.st_mtime);
+        }
+        return WalkDir(full_path, file, mtime, 0, options, visitor);
+    }
+
+    WalkOptions FilesWithExtensions(const ExtensionMatcher *extensions)
+    {
+        WalkOptions options;
+        options.extensions = extensions;
+        options.exclude = nullptr;
+        options.max_depth = -1;
+        options.include_dirs = false;
+        options.signatures = nullptr;
+        return options;
+    }
+
+    void ClearExtensionMatcher(ExtensionMatcher *matcher)
+    {
+        matcher->keys.clear();
+        matcher->values.clear();
+        matcher->long_extensions.clear();
+        matcher->long_values.clear();
+        matcher->seed = 0;
+        matcher->shift = 64;
+    }
+
+    void AddExtensions(ExtensionMatcher *matcher, const std::vector<std::string> &extensions, uint64_t value)
+    {
+        for (std::vector<std::string>::const_iterator it=extensions.begin(); it!=extensions.end(); ++it)
+        {
+            const char *ext = it->c_str();
+            std::size_t length = it->length();
+            if (length > 0 && ext[0] == '.')
             {
-                std::vector<std::string> files = FS::ListFiles(path + "/" + dirent.d_name);
-                for (std::vector<std::string>::iterator it=files.begin(); it!=files.end(); )
+                ext++;
+                length--;
+            }
+
+            uint64_t key;
+            if (PackExtension(ext, length, &key))
+            {
+                // the table is not hashed yet, keys are kept in insertion order
+                std::vector<uint64_t>::iterator found = std::find(matcher->keys.begin(), matcher->keys.end(), key);
+                if (found != matcher->keys.end())
+                {
+                    matcher->values[found - matcher->keys.begin()] |= value;
+                }
+                else
                 {
-                    out.push_back(std::string(dirent.d_name) + "/" + *it);
-                    ++it;
+                    matcher->keys.push_back(key);
+                    matcher->values.push_back(value);
                 }
             }
-            else
+            else if (length > 0)
             {
-                out.push_back(dirent.d_name);
+                std::size_t i = 0;
+                while (i < matcher->long_extensions.size() && (matcher->long_extensions[i].length() != length ||
+                    strncasecmp(ext, matcher->long_extensions[i].c_str(), length) != 0))
+                {
+                    i++;
+                }
+                if (i < matcher->long_extensions.size())
+                {
+                    matcher->long_values[i] |= value;
+                }
+                else
+                {
+                    matcher->long_extensions.push_back(std::string(ext, length));
+                    matcher->long_values.push_back(value);
+                }
             }
         }
-        sceIoDclose(fd);
-        return out;
     }
 
+    void CompileExtensionMatcher(ExtensionMatcher *matcher)
+    {
+        std::vector<uint64_t> keys;
+        std::vector<uint64_t> values;
+        for (std::size_t i = 0; i < matcher->keys.size(); i++)
+        {
+            if (matcher->keys[i] != 0)
+            {
+                keys.push_back(matcher->keys[i]);
+                values.push_back(matcher->values[i]);
+            }
+        }
+
+        matcher->keys.clear();
+        matcher->values.clear();
+        matcher->seed = 0;
+        matcher->shift = 64;
+        if (keys.size() == 0)
+            return;
+
+        // grow the table until some seed puts every key in its own slot
+        int bits = 1;
+        while ((1u << bits) < keys.size() * 2)
+            bits++;
+
+        while (true)
+        {
+            uint32_t table_size = 1u << bits;
+            uint64_t seed = 0x9E3779B97F4A7C15ULL;
+            for (int attempt = 0; attempt < EXTENSION_SEED_ATTEMPTS; attempt++, seed += 0x6A09E667F3BCC908ULL)
+            {
+                std::vector<uint64_t> table_keys(table_size, 0);
+                std::vector<uint64_t> table_values(table_size, 0);
+                std::size_t i = 0;
+                for (; i < keys.size(); i++)
+                {
+                    uint32_t slot = ExtensionSlot(keys[i], seed | 1, 64 - bits);
+                    if (table_keys[slot] != 0)
+                        break;
+                    table_keys[slot] = keys[i];
+                    table_values[slot] = values[i];
+                }
+
+                if (i == keys.size())
+                {
+                    matcher->keys.swap(table_keys);
+                    matcher->values.swap(table_values);
+                    matcher->seed = seed | 1;
+                    matcher->shift = 64 - bits;
+                    return;
+                }
+            }
+            bits++;
+        }
+    }
+
+    uint64_t MatchExtension(const ExtensionMatcher *matcher, const char *name, std::size_t length)
+    {
+        std::size_t dot = length;
+        while (dot > 0 && name[dot-1] != '.' && name[dot-1] != '/')
+            dot--;
+        if (dot == 0 || name[dot-1] != '.')
+            return 0;
+
+        const char *ext = name + dot;
+        std::size_t ext_length = length - dot;
+        uint64_t key;
+        if (PackExtension(ext, ext_length, &key))
+        {
+            if (matcher->keys.size() == 0)
+                return 0;
+            uint32_t slot = ExtensionSlot(key, matcher->seed, matcher->shift);
+            return matcher->keys[slot] == key ? matcher->values[slot] : 0;
+        }
+
+        for (std::size_t i = 0; i < matcher->long_extensions.size(); i++)
+        {
+            if (matcher->long_extensions[i].length() == ext_length && strncasecmp(ext, matcher->long_extensions[i].c_str(), ext_length) == 0)
+                return matcher->long_values[i];
+        }
+        return 0;
+    }
+
+    uint64_t MatchExtension(const ExtensionMatcher *matcher, const std::string &name)
+    {
+        return MatchExtension(matcher, name.c_str(), name.length());
+    }
 }
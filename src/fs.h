@@ -5,14 +5,62 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <map>
 
 #include <cstdint>
 
+typedef struct {
+    std::string path;
+    int64_t size;
+    uint64_t mtime;
+    bool is_dir;
+} FileInfo;
+
+// Extensions are packed case folded into a uint64 key and looked up through a
+// collision free multiplicative hash, so matching a file name never allocates.
+// Each extension carries a value, a category bit mask for the reverse lookup.
+typedef struct {
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> values;
+    uint64_t seed;
+    int shift;
+    std::vector<std::string> long_extensions;
+    std::vector<uint64_t> long_values;
+} ExtensionMatcher;
+
+// What a directory looked like the last time it was listed. Adding, removing or
+// renaming an entry changes the directory mtime, so a matching mtime means the
+// listing can be skipped. Rewriting a file in place does not change it, callers
+// that track files have to stat the ones they know in a skipped directory.
+typedef struct {
+    uint64_t mtime;
+    bool seen;      // still exists, set by Walk
+    bool listed;    // listed by this walk rather than skipped
+} DirSignature;
+
+// keyed by path relative to the walked folder, "" is the folder itself
+typedef std::map<std::string, DirSignature> DirSignatures;
+
+typedef struct {
+    const ExtensionMatcher *extensions;         // nullptr accepts every file
+    const std::vector<std::string> *exclude;    // names of directories that are not entered
+    int max_depth;                              // -1 for no limit, 0 for the top folder only
+    bool include_dirs;
+    DirSignatures *signatures;                  // nullptr lists every directory
+} WalkOptions;
+
+// FileInfo.path is relative to the walked folder and only valid during the call.
+// Return false to stop the walk. Files in a directory skipped through its signature
+// are not visited, its subdirectories are.
+typedef std::function<bool(const FileInfo &file)> WalkVisitor;
+
 namespace FS {
     void MkDirs(const std::string& path);
     void Rm(const std::string& file);
     void RmDir(const std::string& path);
     int64_t GetSize(const char* path);
+    bool GetFileInfo(const std::string& path, FileInfo *info);
 
     bool FileExists(const std::string& path);
     bool FolderExists(const std::string& path);
@@ -39,9 +87,21 @@ namespace FS {
 
     std::vector<char> Load(const std::string& path);
     void Save(const std::string& path, const void* data, uint32_t size);
+    void AppendText(const std::string& path, const char* text);
 
     std::vector<std::string> ListDir(const std::string& path);
-    std::vector<std::string> ListFiles(const std::string& path);
+
+    // visits every file below path without building any lists, returns false if the visitor stopped it
+    bool Walk(const std::string& path, const WalkOptions &options, WalkVisitor visitor);
+    WalkOptions FilesWithExtensions(const ExtensionMatcher *extensions);
+
+    void ClearExtensionMatcher(ExtensionMatcher *matcher);
+    // ORs value into what the extensions already map to, call CompileExtensionMatcher when done adding
+    void AddExtensions(ExtensionMatcher *matcher, const std::vector<std::string> &extensions, uint64_t value);
+    void CompileExtensionMatcher(ExtensionMatcher *matcher);
+    // returns the value of the extension of name, or 0 when it has none or it is not in the matcher
+    uint64_t MatchExtension(const ExtensionMatcher *matcher, const char *name, std::size_t length);
+    uint64_t MatchExtension(const ExtensionMatcher *matcher, const std::string &name);
 }
 
 #endif
\ No newline at end of file
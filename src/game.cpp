@@ -4,6 +4,9 @@
 #include <algorithm>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_set>
+#include <memory>
 #include <vitasdk.h>
 #include <cstring>
 
@@ -19,6 +22,8 @@
 #include "iso.h"
 #include "cso.h"
 #include "net.h"
+#include "scanner.h"
+#include "snapshot.h"
 
 //#include "debugnet.h"
 extern "C" {
@@ -31,6 +36,9 @@ GameCategory game_categories[TOTAL_CATEGORY];
 std::map<std::string, GameCategory*> categoryMap;
 std::vector<std::string> psp_iso_extensions;
 std::vector<std::string> eboot_extensions;
+ExtensionMatcher psp_iso_extension_matcher;
+ExtensionMatcher eboot_extension_matcher;
+ExtensionMatcher rom_category_matcher;
 std::vector<std::string> hidden_title_ids;
 char pspemu_path[16];
 char pspemu_iso_path[32];
@@ -38,7 +46,7 @@ char pspemu_eboot_path[32];
 char game_uninstalled = 0;
 
 GameCategory *current_category;
-std::vector<Game*> selected_games;
+std::vector<GameHandle> selected_games;
 
 int games_to_scan = 1;
 int games_scanned = 0;
@@ -55,201 +63,564 @@ char adernaline_launcher_title_id[12];
 BootSettings defaul_boot_settings;
 
 bool use_game_db = true;
+volatile bool scan_cancelled = false;
+// hash of the bubbles last read from app.db, saved with the library snapshot
+uint64_t vita_games_signature = 0;
+
+// held by the ui while it draws the launcher and by whoever changes the games under it,
+// recursive as Launch saves the library snapshot from inside the ui's lock
+static SceUID categories_mutex = -1;
+// only one scan thread runs at a time, a new refresh cancels the one in progress
+static SceUID scan_slot = -1;
+
+// what each GameHandle.slot refers to, slot 0 stands for no game
+typedef struct {
+    uint32_t generation;
+    int category;
+    std::string key;    // GetGameKey of the game
+    int folder_id;      // of the folder, for folder handles
+    bool folder;
+    bool used;
+} GameSlot;
+
+static std::vector<GameSlot> game_slots(1);
+static std::vector<uint32_t> free_game_slots;
 
 namespace GAME {
 
     void Init() {
+        ARENA::Init();
+        categories_mutex = sceKernelCreateMutex("categories_mutex", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
+        scan_slot = sceKernelCreateSema("scan_slot", 0, 1, 1, NULL);
     }
 
-    void Scan()
+    void LockCategories()
+    {
+        sceKernelLockMutex(categories_mutex, 1, NULL);
+    }
+
+    // false when the lock was not free within timeout microseconds
+    bool LockCategories(SceUInt timeout)
+    {
+        return sceKernelLockMutex(categories_mutex, 1, &timeout) >= 0;
+    }
+
+    void UnlockCategories()
+    {
+        sceKernelUnlockMutex(categories_mutex, 1);
+    }
+
+    static uint64_t GetVitaGamesSignature(std::vector<Game> &games)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (int i=0; i < games.size(); i++)
+        {
+            char record[192];
+            int length = snprintf(record, sizeof(record), "%s|%s|%d|%d", games[i].id, games[i].title, games[i].category, games[i].folder_id);
+            for (int j=0; j < length && j < sizeof(record); j++)
+            {
+                hash = (hash ^ (unsigned char)record[j]) * 0x100000001b3ULL;
+            }
+        }
+        return hash;
+    }
+
+    static void AddVitaGame(Game &game)
+    {
+        GameCategory *category = &game_categories[game.category];
+        Folder *folder = FindFolder(category, game.folder_id);
+        if (folder == nullptr)
+        {
+            game.folder_id = 0;
+            folder = category->current_folder;
+        }
+        folder->games.push_back(game);
+        IndexGame(category, folder, folder->games.size()-1);
+        game_scan_inprogress = game;
+        games_scanned++;
+    }
+
+    // Brings the bubbles loaded from the snapshot in line with app.db. Only the
+    // games that were added, removed or changed are touched and only their
+    // categories are sorted again.
+    static void UpdateVitaGames(std::vector<Game> &games)
+    {
+        std::map<std::string, Game*> wanted;
+        for (int i=0; i < games.size(); i++)
+        {
+            if (FindFolder(&game_categories[games[i].category], games[i].folder_id) == nullptr)
+            {
+                games[i].folder_id = 0;
+            }
+            wanted[games[i].id] = &games[i];
+        }
+
+        std::set<std::string> favorites;
+        std::vector<Game> &favorite_games = game_categories[FAVORITES].current_folder->games;
+        for (int i=0; i < favorite_games.size(); i++)
+        {
+            if (favorite_games[i].type == TYPE_BUBBLE)
+            {
+                favorites.insert(favorite_games[i].id);
+            }
+        }
+
+        bool changed[TOTAL_CATEGORY] = {false};
+        std::set<std::string> kept;
+        for (int i=0; i < TOTAL_CATEGORY; i++)
+        {
+            if (i == FAVORITES)
+            {
+                continue;
+            }
+            for (int j=0; j < game_categories[i].folders.size(); j++)
+            {
+                std::vector<Game> &folder_games = game_categories[i].folders[j].games;
+                for (std::vector<Game>::iterator it=folder_games.begin(); it!=folder_games.end(); )
+                {
+                    if (it->type != TYPE_BUBBLE)
+                    {
+                        ++it;
+                        continue;
+                    }
+                    std::map<std::string, Game*>::iterator game = wanted.find(it->id);
+                    if (game != wanted.end() && game->second->category == i &&
+                        game->second->folder_id == it->folder_id && strcmp(game->second->title, it->title) == 0)
+                    {
+                        kept.insert(it->id);
+                        ++it;
+                    }
+                    else
+                    {
+                        it = folder_games.erase(it);
+                        changed[i] = true;
+                    }
+                }
+            }
+        }
+
+        for (int i=0; i < games.size(); i++)
+        {
+            if (kept.find(games[i].id) == kept.end())
+            {
+                games[i].favorite = favorites.find(games[i].id) != favorites.end();
+                AddVitaGame(games[i]);
+                changed[games[i].category] = true;
+            }
+            else
+            {
+                games_scanned++;
+            }
+        }
+
+        for (int i=0; i < TOTAL_CATEGORY; i++)
+        {
+            if (changed[i])
+            {
+                SortGames(&game_categories[i]);
+            }
+        }
+    }
+
+    // Loads what is already known about the games. Returns true when the
+    // emulator folders still have to be scanned by ScanInBackground, which is
+    // also the case until a scan that was interrupted has been run to the end.
+    bool Scan(bool rescan)
     {
         current_category = &game_categories[VITA_GAMES];
+        bool first_scan = !FS::FileExists(CACHE_DB_FILE);
 
         if (!FS::FileExists(PER_GAME_SETTINGS_DB_FILE))
         {
             DB::SetupPerGameSettingsDatabase();
         }
+        DB::LoadGameSettings();
 
-        if (!FS::FileExists(CACHE_DB_FILE))
+        sqlite3 *db;
+        DB::Open(CACHE_DB_FILE, &db);
+        bool from_snapshot = false;
+        bool vita_games = false;
+        bool scan_complete = false;
+        if (first_scan)
         {
-            sprintf(scan_message, "%s", "Reading game info from vita app database");
-            games_to_scan = DB::GetVitaDbGamesCount();
-            games_scanned = 0;
-            DB::GetVitaDbGames();
-            
-            sqlite3 *db;
-            sqlite3_open(CACHE_DB_FILE, &db);
             DB::SetupDatabase(db);
-            ScanRetroGames(db);
-            ScanAdrenalineIsoGames(db);
-            ScanAdrenalineEbootGames(db);
-            ScanScummVMGames(db);
-            sqlite3_close(db);
         }
-        else {
-            sqlite3 *db;
-            sqlite3_open(CACHE_DB_FILE, &db);
+        else
+        {
             DB::UpdateDatabase(db);
-            for (int i=0; i < TOTAL_CATEGORY; i++)
+            // the snapshot of an interrupted scan only holds the games it got to
+            scan_complete = DB::IsScanComplete(db);
+            from_snapshot = !rescan && scan_complete && SNAPSHOT::Load(&vita_games, &vita_games_signature);
+            for (int i=0; i < TOTAL_CATEGORY && !from_snapshot; i++)
             {
                 DB::GetFolders(db, &game_categories[i]);
             }
+        }
 
+        if (!vita_games)
+        {
             sprintf(scan_message, "%s", "Reading game info from vita app database");
-            games_to_scan = DB::GetVitaDbGamesCount();
+            std::vector<Game> vita_db_games;
+            DB::GetVitaDbGames(vita_db_games);
+            games_to_scan = vita_db_games.size();
             games_scanned = 0;
-            DB::GetVitaDbGames();
-            
-            LoadGamesCache(db);
-            sqlite3_close(db);
+            uint64_t signature = GetVitaGamesSignature(vita_db_games);
+            if (from_snapshot)
+            {
+                // app.db was written since the snapshot, often without the bubbles changing
+                if (signature != vita_games_signature)
+                {
+                    UpdateVitaGames(vita_db_games);
+                }
+                vita_games = true;
+            }
+            else
+            {
+                for (int i=0; i < vita_db_games.size(); i++)
+                {
+                    AddVitaGame(vita_db_games[i]);
+                }
+            }
+            vita_games_signature = signature;
         }
 
-        DB::GetFavorites(nullptr, &game_categories[FAVORITES]);
+        if (!first_scan && !from_snapshot)
+        {
+            LoadGamesCache(db);
+        }
+        sqlite3_close(db);
 
-        for (std::vector<Game>::iterator it=game_categories[FAVORITES].current_folder->games.begin(); 
-             it!=game_categories[FAVORITES].current_folder->games.end(); )
+        if (!from_snapshot)
         {
-            GameCategory *category = categoryMap[it->category];
-            Game* game = FindGame(category, &*it);
-            if (game != nullptr)
-            {
-                game->favorite = true;
-            }
-            ++it;
+            DB::GetFavorites(nullptr, &game_categories[FAVORITES]);
         }
 
         for (int i=0; i < TOTAL_CATEGORY; i++)
         {
-            SortGames(&game_categories[i]);
+            if (!vita_games)
+            {
+                SortGames(&game_categories[i]);
+            }
             game_categories[i].current_folder->page_num = 1;
             SetMaxPage(&game_categories[i]);
         }
 
+        // after sorting, which leaves the categories indexed for FindGame
+        if (!vita_games)
+        {
+            MarkFavorites();
+        }
+
         if (game_categories[FAVORITES].current_folder->games.size() > 0)
         {
             current_category = &game_categories[FAVORITES];
             grid_rows = current_category->rows;
         }
+
+        return rescan || !scan_complete;
     }
 
-    std::string str_tolower(std::string s) {
-        std::transform(s.begin(), s.end(), s.begin(), 
-                [](unsigned char c){ return std::tolower(c); });
-        return s;
+    void MarkFavorites(GameCategory *category)
+    {
+        for (std::vector<Game>::iterator it=game_categories[FAVORITES].current_folder->games.begin(); 
+             it!=game_categories[FAVORITES].current_folder->games.end(); )
+        {
+            if (category == nullptr || it->category == category->id)
+            {
+                Game* game = FindGame(&game_categories[it->category], &*it);
+                if (game != nullptr)
+                {
+                    game->favorite = true;
+                }
+            }
+            ++it;
+        }
     }
 
-    bool IsRomExtension(std::string str, std::vector<std::string> &file_filters)
+    // sorts and pages a category the background scan has finished, the caller holds the categories lock
+    void PublishCategory(GameCategory *category)
     {
-        if (std::find(file_filters.begin(), file_filters.end(), str_tolower(str)) != file_filters.end()) {
-            return true;
-        } else {
-            return false;
+        if (!category->scan_pending)
+        {
+            return;
         }
+        SortGames(category);
+        MarkFavorites(category);
+        category->current_folder->page_num = 1;
+        SetMaxPage(category);
+        category->scan_pending = false;
     }
 
-    void PopulateIsoGameInfo(Game *game, std::string rom, int game_index)
+    // Runs after the launcher is showing. The scanned categories stay hidden
+    // until their games are sorted and paged. The current category and the
+    // ones holding favorites are scanned first, the writer publishes each
+    // category when its jobs are done.
+    void ScanInBackground(bool incremental)
     {
-        int dot_index = rom.find_last_of(".");
-        sprintf(game->id, "%s%04d", "SMLAP", game_index);
-        char sfo_path[192];
-        char icon_path[192];
-        sprintf(sfo_path, "ux0:data/SMLA00001/data/%s", game->id);
-        FS::MkDirs(sfo_path);
-        sprintf(game->rom_path, "%s/%s", pspemu_iso_path, rom.c_str());
-        sprintf(sfo_path, "ux0:data/SMLA00001/data/%s/param.sfo", game->id);
-        sprintf(icon_path, "ux0:data/SMLA00001/data/%s/icon0.png", game->id);
+        std::vector<GameCategory*> retro_categories;
+        GetRetroCategories(retro_categories);
+
+        LockCategories();
+        bool priority[TOTAL_CATEGORY];
+        memset(priority, 0, sizeof(priority));
+        priority[current_category->id] = true;
+        std::vector<Game> &favorites = game_categories[FAVORITES].current_folder->games;
+        for (int i=0; i < favorites.size(); i++)
+        {
+            priority[favorites[i].category] = true;
+        }
+        UnlockCategories();
+
+        std::vector<GameCategory*> categories;
+        for (int i=0; i < retro_categories.size(); i++)
+        {
+            if (priority[retro_categories[i]->id])
+            {
+                categories.push_back(retro_categories[i]);
+            }
+        }
+        int priority_count = categories.size();
+        for (int i=0; i < retro_categories.size(); i++)
+        {
+            if (!priority[retro_categories[i]->id])
+            {
+                categories.push_back(retro_categories[i]);
+            }
+        }
+
+        std::vector<GameCategory*> pending = categories;
+        pending.push_back(&game_categories[PSP_GAMES]);
+        pending.push_back(&game_categories[PS_MIMI_GAMES]);
+        pending.push_back(&game_categories[SCUMMVM_GAMES]);
+
+        LockCategories();
+        for (int i=0; i < pending.size(); i++)
+        {
+            pending[i]->scan_pending = true;
+        }
+        UnlockCategories();
+
+        sceKernelChangeThreadPriority(0, SCAN_BACKGROUND_THREAD_PRIORITY);
+        sqlite3 *db;
+        DB::Open(CACHE_DB_FILE, &db);
+        DB::SetScanComplete(db, false);
+        SCANNER::ScanGames(db, categories, true, true, incremental, priority_count);
+        if (!scan_cancelled)
+        {
+            LockCategories();
+            if (incremental)
+            {
+                RemoveGamesFromCategoryByType(db, &game_categories[SCUMMVM_GAMES], TYPE_SCUMMVM);
+            }
+            ScanScummVMGames(db);
+            UnlockCategories();
+        }
+        if (!scan_cancelled)
+        {
+            DB::SetScanComplete(db, true);
+        }
+        sqlite3_close(db);
+
+        // whatever the writer did not publish, scummvm and the categories of a cancelled scan
+        LockCategories();
+        for (int i=0; i < pending.size(); i++)
+        {
+            PublishCategory(pending[i]);
+        }
+        UnlockCategories();
+    }
+
+    bool IsRomExtension(const std::string &rom, const ExtensionMatcher *matcher)
+    {
+        return FS::MatchExtension(matcher, rom) != 0;
+    }
+
+    void CompileExtensionMatchers()
+    {
+        FS::ClearExtensionMatcher(&rom_category_matcher);
+        for (int i=0; i < TOTAL_CATEGORY; i++)
+        {
+            GameCategory *category = &game_categories[i];
+            FS::ClearExtensionMatcher(&category->rom_extensions);
+            FS::AddExtensions(&category->rom_extensions, category->file_filters, 1);
+            FS::CompileExtensionMatcher(&category->rom_extensions);
+            FS::AddExtensions(&rom_category_matcher, category->file_filters, 1ULL << category->id);
+        }
+        FS::CompileExtensionMatcher(&rom_category_matcher);
+
+        FS::ClearExtensionMatcher(&psp_iso_extension_matcher);
+        FS::AddExtensions(&psp_iso_extension_matcher, psp_iso_extensions, 1);
+        FS::CompileExtensionMatcher(&psp_iso_extension_matcher);
+        FS::ClearExtensionMatcher(&eboot_extension_matcher);
+        FS::AddExtensions(&eboot_extension_matcher, eboot_extensions, 1);
+        FS::CompileExtensionMatcher(&eboot_extension_matcher);
+    }
+
+    void GetCategoriesByExtension(const std::string &rom, std::vector<GameCategory*> &categories)
+    {
+        uint64_t category_ids = FS::MatchExtension(&rom_category_matcher, rom);
+        for (int i=0; i < TOTAL_CATEGORY && category_ids != 0; i++)
+        {
+            if (category_ids & (1ULL << game_categories[i].id))
+            {
+                categories.push_back(&game_categories[i]);
+            }
+        }
+    }
+
+    // units of memory_budget one image holds from FindGameFiles until its files are saved
+    struct ExtractBudget
+    {
+        SceUID sema;
+        int kb;
+
+        ExtractBudget(SceUID sema) : sema(sema), kb(0) {}
+        ~ExtractBudget()
+        {
+            if (sema >= 0 && kb > 0)
+            {
+                sceKernelSignalSema(sema, kb);
+            }
+        }
 
-        if (ISO::isISO(game->rom_path))
+        void Take(int size_kb)
         {
-            ISO *iso = new ISO(game->rom_path);
-            iso->Extract(sfo_path, icon_path);
-            delete iso;
+            if (sema >= 0 && size_kb > 0)
+            {
+                sceKernelWaitSema(sema, size_kb, NULL);
+                kb = size_kb;
+            }
         }
-        else if (CSO::isCSO(game->rom_path))
+    };
+
+    void PopulateIsoGameInfo(Game *game, std::string rom, int game_index, IsoStageTimes *times, SceUID memory_budget)
+    {
+        IsoStageTimes local_times;
+        if (times == nullptr)
         {
-            CSO *cso = new CSO(game->rom_path);
-            cso->Extract(sfo_path, icon_path);
-            delete cso;
+            times = &local_times;
         }
 
+        int dot_index = rom.find_last_of(".");
+        game->id = ARENA::Format("%s%04d", "SMLAP", game_index);
+        game->rom_path = ARENA::Format("%s/%s", pspemu_iso_path, rom.c_str());
         game->type = TYPE_PSP_ISO;
         game->tex = no_icon;
-        if (FS::FileExists(sfo_path))
+
+        uint64_t stage_start = sceKernelGetProcessTimeWide();
+        int image_type = ISO::sniff(game->rom_path);
+        uint64_t now = sceKernelGetProcessTimeWide();
+        times->sniff += now - stage_start;
+        stage_start = now;
+
+        std::vector<char> sfo;
+        std::vector<char> icon;
+        // given back when this returns or throws, whatever the stage
+        ExtractBudget budget(memory_budget);
+        if (image_type != IMAGE_TYPE_UNKNOWN)
+        {
+            std::unique_ptr<ISO> iso(image_type == IMAGE_TYPE_ISO ? new ISO(game->rom_path) : new CSO(game->rom_path));
+            uint32_t sfo_size, icon_size;
+            if (iso->FindGameFiles(&sfo_size, &icon_size))
+            {
+                // hold back until the images already in memory are written out
+                budget.Take((sfo_size + icon_size + 1023) / 1024);
+                iso->ReadGameFiles(sfo, icon);
+            }
+        }
+        now = sceKernelGetProcessTimeWide();
+        times->extract += now - stage_start;
+        stage_start = now;
+
+        if (sfo.size() > 0)
         {
-            const auto sfo = FS::Load(sfo_path);
             std::string title = std::string(SFO::GetString(sfo.data(), sfo.size(), "TITLE"));
             std::replace( title.begin(), title.end(), '\n', ' ');
-            sprintf(game->title, "%s", title.c_str());
+            game->title = ARENA::Copy(title.c_str());
 
             char* cat = SFO::GetString(sfo.data(), sfo.size(), "CATEGORY");
             char* disc_id = SFO::GetString(sfo.data(), sfo.size(), "DISC_ID");
             if (strcmp(cat, "ME") ==0)
             {
-                sprintf(game->category, "%s", game_categories[PS1_GAMES].category);
+                game->category = PS1_GAMES;
             }
             else if (strcmp(cat, "UG") ==0 || (disc_id != NULL && IsMatchPrefixes(disc_id, game_categories[PSP_GAMES].valid_title_ids)))
             {
-                sprintf(game->category, "%s", game_categories[PSP_GAMES].category);
+                game->category = PSP_GAMES;
             }
             else
             {
-                sprintf(game->category, "%s", game_categories[PS_MIMI_GAMES].category);
+                game->category = PS_MIMI_GAMES;
             }
         }
         else
         {
-            sprintf(game->title, "%s", rom.substr(0, dot_index).c_str());
-            sprintf(game->category, "%s", game_categories[PSP_GAMES].category);
-        }        
+            game->title = ARENA::Copy(rom.c_str(), dot_index);
+            game->category = PSP_GAMES;
+        }
+        now = sceKernelGetProcessTimeWide();
+        times->parse += now - stage_start;
+        stage_start = now;
+
+        char path[192];
+        sprintf(path, "ux0:data/SMLA00001/data/%s", game->id);
+        FS::MkDirs(path);
+        if (sfo.size() > 0)
+        {
+            sprintf(path, "ux0:data/SMLA00001/data/%s/param.sfo", game->id);
+            FS::Save(path, sfo.data(), sfo.size());
+        }
+        if (icon.size() > 0)
+        {
+            sprintf(path, "ux0:data/SMLA00001/data/%s/icon0.png", game->id);
+            FS::Save(path, icon.data(), icon.size());
+        }
+        times->persist += sceKernelGetProcessTimeWide() - stage_start;
+        times->images++;
     }
 
-    void ScanAdrenalineIsoGames(sqlite3 *db)
+    bool GetImageFingerprint(const char *path, int64_t size, uint64_t mtime, char *fingerprint)
     {
-        sprintf(scan_message, "Scanning for %s games in the %s folder", "ISO", pspemu_iso_path);
-        GameCategory *category = &game_categories[PSP_GAMES];
-        std::vector<std::string> files = FS::ListFiles(pspemu_iso_path);
-
-        games_to_scan = files.size();
-        games_scanned = 0;
+        SceUID fd = sceIoOpen(path, SCE_O_RDONLY, 0777);
+        if (fd < 0)
+        {
+            return false;
+        }
 
-        if (!FS::FolderExists("ux0:data/SMLA00001/data"))
+        // CSO and PBP headers are at the start, an ISO is identified by its primary volume descriptor
+        char header[IMAGE_FINGERPRINT_BYTES];
+        int read = sceIoRead(fd, header, IMAGE_FINGERPRINT_BYTES);
+        if (read >= 4 && memcmp(header, "CISO", 4) != 0 && memcmp(header, "\0PBP", 4) != 0)
+        {
+            sceIoLseek32(fd, 0x8000, SCE_SEEK_SET);
+            read = sceIoRead(fd, header, IMAGE_FINGERPRINT_BYTES);
+        }
+        sceIoClose(fd);
+        if (read <= 0)
         {
-            FS::MkDirs("ux0:data/SMLA00001/data");
+            return false;
         }
 
-        for(std::size_t j = 0; j < files.size(); ++j)
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (int i = 0; i < read; i++)
         {
-            int index = files[j].find_last_of(".");
-            if (index != std::string::npos && IsRomExtension(files[j].substr(index), psp_iso_extensions))
-            {
-                Game game;
-                try
-                {
-                    PopulateIsoGameInfo(&game, files[j], games_scanned);
-                    categoryMap[game.category]->current_folder->games.push_back(game);
-                    DB::InsertGame(db, &game);
-                    game_scan_inprogress = game;
-                    games_scanned++;
-                }
-                catch(const std::exception& e)
-                {
-                    games_to_scan--;
-                }
-                
-            }
-            else
-            {
-                games_to_scan--;
-            }
-            
+            hash = (hash ^ (unsigned char)header[i]) * 0x100000001b3ULL;
         }
+        snprintf(fingerprint, IMAGE_FINGERPRINT_LENGTH, "%llx:%llx:%016llx", size, mtime, hash);
+        return true;
+    }
+
+    void ScanAdrenalineIsoGames(sqlite3 *db, bool incremental)
+    {
+        std::vector<GameCategory*> categories;
+        SCANNER::ScanGames(db, categories, true, false, incremental);
     }
 
     void PopulateEbootGameInfo(Game *game, std::string rom, int game_index)
     {
-        sprintf(game->rom_path, "%s/%s", pspemu_eboot_path, rom.c_str());
+        game->rom_path = ARENA::Format("%s/%s", pspemu_eboot_path, rom.c_str());
         char param_sfo[192];
-        sprintf(game->id, "SMLAE%04d", game_index);
+        game->id = ARENA::Format("SMLAE%04d", game_index);
         sprintf(param_sfo, "ux0:data/SMLA00001/data/%s/param.sfo", game->id);
         
         EBOOT::Extract(game->rom_path, game->id);
@@ -261,127 +632,174 @@ namespace GAME {
         char* disc_id = SFO::GetString(sfo.data(), sfo.size(), "DISC_ID");
 
         game->type = TYPE_EBOOT;
-        sprintf(game->title, "%s", title.c_str());
+        game->title = ARENA::Copy(title.c_str());
         game->tex = no_icon;
         if (strcmp(cat, "ME") ==0)
         {
-            sprintf(game->category, "%s", game_categories[PS1_GAMES].category);
-            game_categories[PS1_GAMES].current_folder->games.push_back(*game);
+            game->category = PS1_GAMES;
         }
         else if (strcmp(cat, "UG") ==0 || (disc_id != NULL && IsMatchPrefixes(disc_id, game_categories[PSP_GAMES].valid_title_ids)))
         {
-            sprintf(game->category, "%s", game_categories[PSP_GAMES].category);
-            game_categories[PSP_GAMES].current_folder->games.push_back(*game);
+            game->category = PSP_GAMES;
         }
         else
         {
-            sprintf(game->category, "%s", game_categories[PS_MIMI_GAMES].category);
-            game_categories[PS_MIMI_GAMES].current_folder->games.push_back(*game);
+            game->category = PS_MIMI_GAMES;
         }
     }
 
-    void ScanAdrenalineEbootGames(sqlite3 *db)
+    void ScanAdrenalineEbootGames(sqlite3 *db, bool incremental)
     {
-        sprintf(scan_message, "Scanning for %s games in the %s folder", "EBOOT", pspemu_eboot_path);
-        std::vector<std::string> files = FS::ListFiles(pspemu_eboot_path);
+        std::vector<GameCategory*> categories;
+        SCANNER::ScanGames(db, categories, false, true, incremental);
+    }
 
-        games_to_scan = files.size();
-        games_scanned = 0;
+    void GetRomTitle(const std::string &rom, char *title)
+    {
+        size_t slash_index = rom.find_last_of("/");
+        size_t dot_index = rom.find_last_of(".");
+        size_t start = slash_index == std::string::npos ? 0 : slash_index + 1;
+        size_t length = dot_index == std::string::npos || dot_index < start ? rom.length() - start : dot_index - start;
+        strlcpy(title, rom.c_str() + start, std::min(length + 1, (size_t)128));
+    }
 
-        for(std::size_t j = 0; j < files.size(); ++j)
+    bool PopulateRomGameInfo(GameCategory *category, Game *game, const std::string &rom, sqlite3 *mame_mappings_db)
+    {
+        int dot_index = rom.find_last_of(".");
+        int rom_length = strlen(category->roms_path) + rom.length() + 1;
+        if (rom_length >= ROM_PATH_MAX || dot_index == std::string::npos || !IsRomExtension(rom, &category->rom_extensions))
         {
-            int index = files[j].find_last_of(".");
-            if (index != std::string::npos && IsRomExtension(files[j].substr(index), eboot_extensions))
-            {
-                Game game;
-                try
-                {
-                    PopulateEbootGameInfo(&game, files[j], games_scanned);
-                    DB::InsertGame(db, &game);
-                    game_scan_inprogress = game;
-                    games_scanned++;
-                }
-                catch(const std::exception& e)
-                {
-                    games_to_scan--;
-                }
-                
-            }
-            else
-            {
-                games_to_scan--;
-            }
+            return false;
+        }
+
+        game->type = TYPE_ROM;
+        // the categories outlive every game, no need for a copy
+        game->id = category->title;
+        game->category = category->id;
+        game->rom_path = ARENA::Format("%s/%s", category->roms_path, rom.c_str());
+        char title[128];
+        GetRomTitle(rom, title);
+        if (mame_mappings_db != nullptr)
+        {
+            DB::GetMameRomName(mame_mappings_db, title, title);
         }
+        game->title = ARENA::Copy(title);
+        game->tex = no_icon;
+        return true;
     }
 
-    void ScanRetroCategory(sqlite3 *db, GameCategory *category)
+    void ScanRetroCategory(sqlite3 *db, GameCategory *category, bool incremental)
     {
-        sprintf(scan_message, "Scanning for %s games in the %s folder", category->title, category->roms_path);
-        std::vector<std::string> files = FS::ListFiles(category->roms_path);
-        games_to_scan = files.size();
-        games_scanned = 0;
-        int rom_path_length = strlen(category->roms_path);
-        sqlite3 *mame_mappings_db;
+        std::vector<GameCategory*> categories;
+        categories.push_back(category);
+        SCANNER::ScanGames(db, categories, false, false, incremental);
+    }
 
-        if (category->id == MAME_2000_GAMES || category->id == MAME_2003_GAMES || category->id == NEOGEO_GAMES)
+    void GetRetroCategories(std::vector<GameCategory*> &categories)
+    {
+        for (int i=0; i<TOTAL_ROM_CATEGORY; i++)
         {
-            sqlite3_open(MAME_ROM_NAME_MAPPINGS_FILE, &mame_mappings_db);
+            categories.push_back(&game_categories[ROM_CATEGORIES[i]]);
         }
+    }
+
+    void ScanRetroGames(sqlite3 *db, bool incremental)
+    {
+        std::vector<GameCategory*> categories;
+        GetRetroCategories(categories);
+        SCANNER::ScanGames(db, categories, false, false, incremental);
+    }
+
+    void ScanAllGames(sqlite3 *db, bool incremental)
+    {
+        std::vector<GameCategory*> categories;
+        GetRetroCategories(categories);
+        SCANNER::ScanGames(db, categories, true, true, incremental);
+    }
 
-        int rom_length = 0;
-        for(std::size_t j = 0; j < files.size(); j++)
+    int CheckFileManifest(std::map<std::string, FileManifestEntry> &manifest, const FileInfo &file, FileManifestEntry *entry)
+    {
+        entry->size = file.size;
+        entry->mtime = file.mtime;
+        entry->is_dir = file.is_dir;
+        entry->seen = true;
+
+        std::map<std::string, FileManifestEntry>::iterator it = manifest.find(file.path);
+        if (it == manifest.end())
         {
-            int dot_index = files[j].find_last_of(".");
-            int slash_index = files[j].find_last_of("/");
-            rom_length = rom_path_length + files[j].length() + 1;
-            if (rom_length < 192 && dot_index != std::string::npos && IsRomExtension(files[j].substr(dot_index), category->file_filters))
-            {
-                Game game;
-                game.type = TYPE_ROM;
-                sprintf(game.id, "%s", category->title);
-                sprintf(game.category, "%s", category->category);
-                sprintf(game.rom_path, "%s/%s", category->roms_path, files[j].c_str());
-                if (slash_index != std::string::npos)
-                {
-                    strlcpy(game.title, files[j].substr(slash_index+1, dot_index-slash_index-1).c_str(), 128);
-                }
-                else
-                {
-                    strlcpy(game.title, files[j].substr(0, dot_index).c_str(), 128);
-                }
-                if (category->id == MAME_2000_GAMES || category->id == MAME_2003_GAMES || category->id == NEOGEO_GAMES)
-                {
-                    DB::GetMameRomName(mame_mappings_db, game.title, game.title);
-                }
-                game.tex = no_icon;
-                category->current_folder->games.push_back(game);
-                DB::InsertGame(db, &game);
-                game_scan_inprogress = game;
-            }
-            games_scanned++;
+            return FILE_ADDED;
         }
-        if (category->id == MAME_2000_GAMES || category->id == MAME_2003_GAMES)
+
+        it->second.seen = true;
+        if (it->second.size != file.size || it->second.mtime != file.mtime)
         {
-            sqlite3_close(mame_mappings_db);
+            return FILE_CHANGED;
         }
+        return FILE_UNCHANGED;
     }
 
-    void ScanRetroGames(sqlite3 *db)
+    void RemoveMissingGame(sqlite3 *db, const char* rom_path, int type, const char *id)
     {
-        for (int i=0; i<TOTAL_ROM_CATEGORY; i++)
+        Game game;
+        game.rom_path = rom_path;
+        game.type = type;
+
+        Game *existing = FindGameByRomPath(rom_path, type, nullptr, id);
+        if (existing != nullptr)
         {
-            int category_id = ROM_CATEGORIES[i];
-            GameCategory *category = &game_categories[category_id];
-            ScanRetroCategory(db, category);
+            game = *existing;
+            RemoveGameFromCategory(&game_categories[game.category], &game);
+            RemoveGameFromCategory(&game_categories[FAVORITES], &game);
+            DB::DeleteFavorite(db, &game);
         }
+        DB::DeleteGame(db, &game);
     }
 
-    void SetMaxPage(GameCategory *category)
+    int GetNextTitleIdIndex(sqlite3 *db, int type)
     {
-        for (int i=0; i<category->folders.size(); i++)
+        char title_id[20];
+        memset(title_id, 0, sizeof(title_id));
+        DB::GetMaxTitleIdByType(db, type, title_id);
+        if (strncmp(title_id, "SMLA", 4) == 0)
         {
-            Folder *folder = &category->folders[i];
-            folder->max_page = (folder->games.size() + category->games_per_page - 1) / category->games_per_page;
+            return atoi(title_id+5) + 1;
+        }
+        return 0;
+    }
+
+    // the add game dialogs skip the ids image_metadata keeps for images that
+    // can come back, the way the scanner does when it opens it
+    int GetNextImageIndex(sqlite3 *db, int type)
+    {
+        int index = GetNextTitleIdIndex(db, type);
+        char title_id[20];
+        memset(title_id, 0, sizeof(title_id));
+        DB::GetMaxImageMetadataTitleId(nullptr, type, title_id);
+        if (strncmp(title_id, "SMLA", 4) == 0 && atoi(title_id+5) + 1 > index)
+        {
+            index = atoi(title_id+5) + 1;
+        }
+        return index;
+    }
+
+    // an image added from the dialogs keeps its id when the cache is rebuilt
+    void SaveImageMetadata(Game *game)
+    {
+        FileInfo info;
+        char fingerprint[IMAGE_FINGERPRINT_LENGTH];
+        if (FS::GetFileInfo(game->rom_path, &info) && GetImageFingerprint(game->rom_path, info.size, info.mtime, fingerprint))
+        {
+            DB::SetupImageMetadata(nullptr);
+            DB::SaveImageMetadata(nullptr, fingerprint, game);
+        }
+    }
+
+    void SetMaxPage(GameCategory *category)
+    {
+        for (int i=0; i<category->folders.size(); i++)
+        {
+            Folder *folder = &category->folders[i];
+            folder->max_page = (folder->games.size() + category->games_per_page - 1) / category->games_per_page;
             if (folder->max_page == 0)
             {
                 folder->max_page = 1;
@@ -390,7 +808,15 @@ namespace GAME {
     }
 
     bool Launch(Game *game, BootSettings *settings, char* retro_core) {
-        GameCategory* category = categoryMap[game->category];
+        // the scan writer takes the categories lock the launcher window holds while calling this
+        UnlockCategories();
+        CancelScan();
+        LockCategories();
+        DB::LogCounters("launch");
+        DB::FlushGameSettings();
+        DB::CloseConnections();
+        SNAPSHOT::SaveIfChanged();
+        GameCategory* category = &game_categories[game->category];
         if (game->type == TYPE_BUBBLE)
         {
             char uri[35];
@@ -483,6 +909,9 @@ namespace GAME {
             sceKernelExitProcess(0);
 
         }
+
+        // nothing was launched, the next refresh may scan again
+        sceKernelSignalSema(scan_slot, 1);
     };
 
     std::string nextToken(std::vector<char> &buffer, int &nextTokenPos)
@@ -525,10 +954,120 @@ namespace GAME {
         DB::GetCachedGames(db);
     };
 
+    static void GetIconPath(Game *game, char *icon_path)
+    {
+        if (game->type == TYPE_BUBBLE && game->category == PS_MOBILE_GAMES)
+        {
+            sprintf(icon_path, "ur0:appmeta/%s/pic0.png", game->id);
+        }
+        else if (game->type == TYPE_BUBBLE)
+        {
+            sprintf(icon_path, "ur0:appmeta/%s/icon0.png", game->id);
+        }
+        else if (game->type == TYPE_EBOOT || game->type == TYPE_PSP_ISO)
+        {
+            sprintf(icon_path, "ux0:data/SMLA00001/data/%s/icon0.png", game->id);
+        }
+        else if (game->type == TYPE_SCUMMVM)
+        {
+            sprintf(icon_path, "%s/icon0.png", game->rom_path);
+        }
+        else if (game->type == TYPE_FOLDER)
+        {
+            GameCategory *cat = &game_categories[game->category];
+            Folder* folder = FindFolder(cat, game->folder_id);
+            if (folder != nullptr)
+            {
+                sprintf(icon_path, "%s", folder->icon_path);
+            }
+            else
+            {
+                sprintf(icon_path, "ux0:app/SMLA00001/folder.png");
+            }
+        }
+        else
+        {
+            GameCategory* category = &game_categories[game->category];
+            std::string rom_path = std::string(game->rom_path);
+            int dot_index = rom_path.find_last_of(".");
+            if (new_icon_method)
+            {
+                sprintf(icon_path, "%s.png", rom_path.substr(0, dot_index).c_str());
+            }
+            else
+            {
+                int slash_index = rom_path.find_last_of("/");
+                std::string rom_name = rom_path.substr(slash_index+1, dot_index-slash_index-1);
+                sprintf(icon_path, "%s/%s.png", category->icon_path, rom_name.c_str());
+            }
+        }
+    }
+
+    void LoadGameImage(Game *game) {
+        Tex tex;
+        tex = no_icon;
+
+        char icon_path[384];
+        GetIconPath(game, icon_path);
+        if (game->tex.id == no_icon.id)
+        {
+            if (Textures::LoadImageFile(icon_path, &tex))
+            {
+                game->tex = tex;
+            }
+            else
+            {
+                game->icon_missing = true;
+                game->tex = no_icon;
+            }
+        }
+    }
+
+    // For the loader threads. The categories are only locked around reading and
+    // setting the game, it may move or go away while its image is read.
+    static void LoadGameImage(GameHandle handle)
+    {
+        char icon_path[384];
+        LockCategories();
+        Game *game = GetGame(handle);
+        bool load = game != nullptr && game->tex.id == no_icon.id;
+        if (load)
+        {
+            GetIconPath(game, icon_path);
+        }
+        UnlockCategories();
+        if (!load)
+        {
+            return;
+        }
+
+        Tex tex = no_icon;
+        bool loaded = Textures::LoadImageFile(icon_path, &tex);
+        LockCategories();
+        game = GetGame(handle);
+        if (game == nullptr || game->tex.id != no_icon.id)
+        {
+            if (loaded)
+            {
+                Textures::Free(&tex);
+            }
+        }
+        else if (loaded)
+        {
+            game->tex = tex;
+        }
+        else
+        {
+            game->icon_missing = true;
+        }
+        UnlockCategories();
+    }
+
     void LoadGameImages(int category, int prev_page, int page, int games_per_page) {
         int high = 0;
         int low = 0;
 
+        LockCategories();
         if (game_categories[category].current_folder->max_page > NUM_CACHED_PAGES + 5)
         {
             int del_page = 0;
@@ -560,21 +1099,24 @@ namespace GAME {
 
         high = page * games_per_page;
         low = high - games_per_page;
+        std::vector<GameHandle> handles;
         for(std::size_t i = low; (i < high && i < game_categories[category].current_folder->games.size()); i++) {
             Game *game = &game_categories[category].current_folder->games[i];
-            if (page == current_category->current_folder->page_num && category == current_category->id)
+            if (game->tex.id == no_icon.id)
             {
-                if (game->tex.id == no_icon.id)
-                {
-                    LoadGameImage(game);
-                }
+                handles.push_back(GetGameHandle(&game_categories[category], game));
             }
-            else
+        }
+        UnlockCategories();
+
+        for (int i=0; i < handles.size(); i++)
+        {
+            if (page != current_category->current_folder->page_num || category != current_category->id)
             {
                 // No need to continue if page isn't in view
                 return;
             }
-            
+            LoadGameImage(handles[i]);
         }
     }
 
@@ -618,75 +1160,12 @@ namespace GAME {
         return new_page + current_category->current_folder->max_page;
     }
 
-    void LoadGameImage(Game *game) {
-        Tex tex;
-        tex = no_icon;
-
-        char icon_path[384];
-        if (game->type == TYPE_BUBBLE && strcmp(game->category, game_categories[PS_MOBILE_GAMES].category) == 0)
-        {
-            sprintf(icon_path, "ur0:appmeta/%s/pic0.png", game->id);
-        }
-        else if (game->type == TYPE_BUBBLE)
-        {
-            sprintf(icon_path, "ur0:appmeta/%s/icon0.png", game->id);
-        }
-        else if (game->type == TYPE_EBOOT || game->type == TYPE_PSP_ISO)
-        {
-            sprintf(icon_path, "ux0:data/SMLA00001/data/%s/icon0.png", game->id);
-        }
-        else if (game->type == TYPE_SCUMMVM)
-        {
-            sprintf(icon_path, "%s/icon0.png", game->rom_path);
-        }
-        else if (game->type == TYPE_FOLDER)
-        {
-            GameCategory *cat = categoryMap[game->category];
-            Folder* folder = FindFolder(cat, game->folder_id);
-            if (folder != nullptr)
-            {
-                sprintf(icon_path, "%s", folder->icon_path);
-            }
-            else
-            {
-                sprintf(icon_path, "ux0:app/SMLA00001/folder.png");
-            }
-        }
-        else
-        {
-            GameCategory* category = categoryMap[game->category];
-            std::string rom_path = std::string(game->rom_path);
-            int dot_index = rom_path.find_last_of(".");
-            if (new_icon_method)
-            {
-                sprintf(icon_path, "%s.png", rom_path.substr(0, dot_index).c_str());
-            }
-            else
-            {
-                int slash_index = rom_path.find_last_of("/");
-                std::string rom_name = rom_path.substr(slash_index+1, dot_index-slash_index-1);
-                sprintf(icon_path, "%s/%s.png", category->icon_path, rom_name.c_str());
-            }
-        }
-        
-        if (game->tex.id == no_icon.id)
-        {
-            if (Textures::LoadImageFile(icon_path, &tex))
-            {
-                game->tex = tex;
-            }
-            else
-            {
-                game->icon_missing = true;
-                game->tex = no_icon;
-            }
-        }
-    }
-
     int LoadGameImageThread(SceSize args, LoadImagesParams *params)
     {
-        int end = params->page_num+params->games_per_page;
+        std::vector<GameHandle> handles;
+        LockCategories();
         GameCategory *category = &game_categories[params->category];
+        int end = params->page_num+params->games_per_page;
         if (end > category->current_folder->games.size())
         {
             end = category->current_folder->games.size();
@@ -695,16 +1174,25 @@ namespace GAME {
         {
             if (category->current_folder->games[i].visible>0 && !category->current_folder->games[i].icon_missing)
             {
-                GAME::LoadGameImage(&category->current_folder->games[i]);
-                // For concurrency, game might be invisible after being visible.
-                if (category->current_folder->games[i].visible == 0 && category->current_folder->games[i].tex.id != no_icon.id)
-                {
-                    Tex tmp = category->current_folder->games[i].tex;
-                    category->current_folder->games[i].tex = no_icon;
-                    Textures::Free(&tmp);
-                }
+                handles.push_back(GetGameHandle(category, &category->current_folder->games[i]));
             }
         }
+        UnlockCategories();
+
+        for (int i=0; i < handles.size(); i++)
+        {
+            LoadGameImage(handles[i]);
+            // For concurrency, game might be invisible after being visible.
+            LockCategories();
+            Game *game = GetGame(handles[i]);
+            if (game != nullptr && game->visible == 0 && game->tex.id != no_icon.id)
+            {
+                Tex tmp = game->tex;
+                game->tex = no_icon;
+                Textures::Free(&tmp);
+            }
+            UnlockCategories();
+        }
         return sceKernelExitDeleteThread(0);
     }
 
@@ -723,6 +1211,10 @@ namespace GAME {
     }
 
     void Exit() {
+        CancelScan();
+        DB::FlushGameSettings();
+        DB::CloseConnections();
+        SNAPSHOT::SaveIfChanged();
     }
 
 	void StartLoadImagesThread(int category, int prev_page_num, int page, int games_per_page)
@@ -743,28 +1235,65 @@ namespace GAME {
         return sceKernelExitDeleteThread(0);
     }
 
-    void StartScanGamesThread()
+    // Stops the scan in progress once its writer has committed what it found, the
+    // rest is picked up by the next start. The slot is kept so no other scan can
+    // start writing before the process exits.
+    void CancelScan()
+    {
+        scan_cancelled = true;
+        sceKernelWaitSema(scan_slot, 1, NULL);
+    }
+
+    void StartScanGamesThread(bool rescan, bool rebuild)
     {
+        scan_cancelled = true;
+        ScanAllGamesParams params;
+        params.rescan = rescan || rebuild;
+        params.rebuild = rebuild;
         scan_games_thid = sceKernelCreateThread("scan_games_thread", (SceKernelThreadEntry)GAME::ScanGamesThread, 0x10000100, 0x4000, 0, 0, NULL);
 		if (scan_games_thid >= 0)
-			sceKernelStartThread(scan_games_thid, 0, NULL);
+			sceKernelStartThread(scan_games_thid, sizeof(ScanAllGamesParams), &params);
     }
 
-    int ScanGamesThread(SceSize args, void *argp)
+    int ScanGamesThread(SceSize args, ScanAllGamesParams *params)
     {
         gui_mode = GUI_MODE_SCAN;
+        sceKernelWaitSema(scan_slot, 1, NULL);
+        scan_cancelled = false;
         sceKernelDelayThread(10000);
+
+        LockCategories();
         for (int i=0; i < TOTAL_CATEGORY; i++)
         {
+            if (params->rescan)
+            {
+                // folders are read back from the cache by Scan
+                game_categories[i].folders.erase(game_categories[i].folders.begin()+1, game_categories[i].folders.end());
+                game_categories[i].current_folder = &game_categories[i].folders[0];
+            }
             game_categories[i].current_folder->games.clear();
+            InvalidateGameIndex(&game_categories[i]);
         }
+        if (params->rescan)
+        {
+            // every game is read again, nothing points into the arena anymore
+            game_scan_inprogress = Game();
+            ARENA::Reset();
+            ResetGameHandles();
+        }
+        UnlockCategories();
 
-        GAME::Scan();
-
-        if (game_categories[FAVORITES].current_folder->games.size() > 0)
+        if (params->rebuild)
         {
-            current_category = &game_categories[FAVORITES];
+            // the pooled connections must not keep the old file open
+            DB::CloseConnections();
+            FS::Rm(CACHE_DB_FILE);
         }
+
+        // a rescan and the resume of an interrupted scan both start from the cache
+        bool incremental = FS::FileExists(CACHE_DB_FILE);
+        bool scan_folders = GAME::Scan(params->rescan);
+
         current_category->current_folder->page_num = 1;
         view_mode = current_category->view_mode;
         gui_mode  = GUI_MODE_LAUNCHER;
@@ -772,251 +1301,832 @@ namespace GAME {
         {
             GAME::StartLoadImagesThread(current_category->id, 1, 1, current_category->games_per_page);
         }
+
+        if (scan_folders)
+        {
+            GAME::ScanInBackground(incremental);
+        }
+        if (!scan_cancelled)
+        {
+            SNAPSHOT::SaveIfChanged();
+        }
+        DB::LogCounters("scan");
+        sceKernelSignalSema(scan_slot, 1);
         return sceKernelExitDeleteThread(0);
     }
 
     void StartScanGamesCategoryThread(GameCategory *category)
     {
+        scan_cancelled = true;
         ScanGamesParams params;
         params.type = category->rom_type;
-        params.category = category->category;
+        params.category = category->id;
         scan_games_category_thid = sceKernelCreateThread("scan_games_category_thread", (SceKernelThreadEntry)GAME::ScanGamesCategoryThread, 0x10000100, 0x4000, 0, 0, NULL);
 		if (scan_games_category_thid >= 0)
 			sceKernelStartThread(scan_games_category_thid, sizeof(ScanGamesParams), &params);
     }
 
-    void RemoveGamesFromCategoryByType(sqlite3 *db, GameCategory *category, int rom_type)
+    int ScanGamesCategoryThread(SceSize args, ScanGamesParams *params)
+    {
+        gui_mode = GUI_MODE_SCAN;
+        sceKernelWaitSema(scan_slot, 1, NULL);
+        scan_cancelled = false;
+        sceKernelDelayThread(50000);
+        sqlite3 *db;
+        DB::Open(CACHE_DB_FILE, &db);
+        // an interrupted category scan has the next start scan everything again
+        bool scan_complete = DB::IsScanComplete(db);
+        DB::SetScanComplete(db, false);
+        if (params->type == TYPE_ROM  || params->category == PS1_GAMES)
+        {
+            ScanRetroCategory(db, &game_categories[params->category], true);
+        }
+        
+        if (params->type == TYPE_PSP_ISO)
+        {
+            ScanAdrenalineIsoGames(db, true);
+        }
+        
+        if (params->type == TYPE_EBOOT)
+        {
+            ScanAdrenalineEbootGames(db, true);
+        }
+
+        if (params->type == TYPE_SCUMMVM)
+        {
+            LockCategories();
+            RemoveGamesFromCategoryByType(db, &game_categories[params->category], params->type);
+            ScanScummVMGames(db);
+            UnlockCategories();
+        }
+
+        if (!scan_cancelled && scan_complete)
+        {
+            DB::SetScanComplete(db, true);
+        }
+        sqlite3_close(db);
+
+        // the image loaders and the handles read these folders under the lock
+        LockCategories();
+        if (params->type == TYPE_ROM || params->category == PS1_GAMES || params->type == TYPE_SCUMMVM)
+        {
+            GameCategory *category = &game_categories[params->category];
+            category->current_folder->page_num = 1;
+            SetMaxPage(category);
+            SortGames(category);
+            current_category = category;
+        }
+        
+        if (params->type == TYPE_EBOOT || params->type == TYPE_PSP_ISO)
+        {
+            game_categories[PSP_GAMES].current_folder->page_num = 1;
+            SetMaxPage(&game_categories[PSP_GAMES]);
+            SortGames(&game_categories[PSP_GAMES]);
+            game_categories[PS1_GAMES].current_folder->page_num = 1;
+            SetMaxPage(&game_categories[PS1_GAMES]);
+            SortGames(&game_categories[PS1_GAMES]);
+            game_categories[PS_MIMI_GAMES].current_folder->page_num = 1;
+            SetMaxPage(&game_categories[PS_MIMI_GAMES]);
+            SortGames(&game_categories[PS_MIMI_GAMES]);
+        }
+        UnlockCategories();
+
+        if (current_category->view_mode == VIEW_MODE_GRID)
+        {
+            GAME::StartLoadImagesThread(current_category->id, 1, 1, current_category->games_per_page);
+        }
+        gui_mode = GUI_MODE_LAUNCHER;
+        if (!scan_cancelled)
+        {
+            SNAPSHOT::SaveIfChanged();
+        }
+        sceKernelSignalSema(scan_slot, 1);
+        return sceKernelExitDeleteThread(0);
+    }
+
+    void DeleteGamesImages(GameCategory *category)
+    {
+        for (int i=0; i < category->current_folder->games.size(); i++)
+        {
+            Game *game = &category->current_folder->games[i];
+            game->visible = 0;
+            game->thread_started = false;
+            if (game->tex.id != no_icon.id)
+            {
+                Tex tmp = game->tex;
+                game->tex = no_icon;
+                Textures::Free(&tmp);
+            }
+        }
+    }
+
+    static std::string GetGameKey(Game *game)
+    {
+        if (game->type == TYPE_FOLDER)
+        {
+            char key[16];
+            sprintf(key, "/%d", game->folder_id);
+            return std::string(key);
+        }
+        else if (game->type == TYPE_ROM || game->type == TYPE_SCUMMVM)
+        {
+            return std::string(game->rom_path);
+        }
+        return std::string(game->id);
+    }
+
+    static int GetFolderIndex(GameCategory *category, Folder *folder)
+    {
+        int index = folder - category->folders.data();
+        if (index >= 0 && index < category->folders.size())
+        {
+            return index;
+        }
+        return -1;
+    }
+
+    static void BuildGameIndex(GameCategory *category)
+    {
+        category->game_index.clear();
+        for (int j=0; j < category->folders.size(); j++)
+        {
+            std::vector<Game> &games = category->folders[j].games;
+            for (int i=0; i < games.size(); i++)
+            {
+                GameLocation location = {j, i};
+                category->game_index.insert(std::make_pair(GetGameKey(&games[i]), location));
+            }
+        }
+        category->game_index_valid = true;
+    }
+
+    // positions from the given one on after the folder's games moved
+    static void ReindexFolder(GameCategory *category, int folder_index, int from_position)
     {
-        DB::DeleteGamesByCategoryAndType(db, category->category, rom_type);
-        for (std::vector<Game>::iterator it=category->current_folder->games.begin(); it!=category->current_folder->games.end(); )
+        if (!category->game_index_valid)
         {
-            if (it->type == rom_type)
+            return;
+        }
+
+        std::vector<Game> &games = category->folders[folder_index].games;
+        for (int i=from_position; i < games.size(); i++)
+        {
+            GameLocation location = {folder_index, i};
+            category->game_index[GetGameKey(&games[i])] = location;
+        }
+    }
+
+    // The index is only trusted when the game it points at has the same key,
+    // anything that moved games without telling it gets it rebuilt once.
+    static Game* LocateGame(GameCategory *category, const std::string &key, GameLocation *location)
+    {
+        for (int attempt=0; attempt < 2; attempt++)
+        {
+            if (!category->game_index_valid)
+            {
+                BuildGameIndex(category);
+            }
+
+            std::unordered_map<std::string, GameLocation>::iterator it = category->game_index.find(key);
+            if (it == category->game_index.end())
+            {
+                return nullptr;
+            }
+
+            GameLocation found = it->second;
+            if (found.folder < category->folders.size() && found.position < category->folders[found.folder].games.size())
+            {
+                Game *candidate = &category->folders[found.folder].games[found.position];
+                if (GetGameKey(candidate) == key)
+                {
+                    *location = found;
+                    return candidate;
+                }
+            }
+            category->game_index_valid = false;
+        }
+        return nullptr;
+    }
+
+    static Game* LocateGame(GameCategory *category, Game *game, GameLocation *location)
+    {
+        return LocateGame(category, GetGameKey(game), location);
+    }
+
+    // Roms are keyed by their path, they are looked up in the index of their
+    // category or else of the categories of their extension. Images are keyed
+    // by their title id, with the id they are looked up in the index of the
+    // categories they land in, without it those categories are walked.
+    Game* FindGameByRomPath(const char* rom_path, int type, GameCategory *category, const char *id)
+    {
+        if (type == TYPE_ROM || type == TYPE_SCUMMVM)
+        {
+            std::vector<GameCategory*> categories;
+            if (category != nullptr)
+            {
+                categories.push_back(category);
+            }
+            else if (type == TYPE_SCUMMVM)
             {
-                category->current_folder->games.erase(it);
+                categories.push_back(&game_categories[SCUMMVM_GAMES]);
             }
             else
             {
-                ++it;
+                GetCategoriesByExtension(rom_path, categories);
             }
+
+            std::string key = std::string(rom_path);
+            for (int i=0; i < categories.size(); i++)
+            {
+                GameLocation location;
+                Game *game = LocateGame(categories[i], key, &location);
+                if (game != nullptr && game->type == type)
+                {
+                    return game;
+                }
+            }
+            return nullptr;
         }
+
+        int image_categories[] = {PSP_GAMES, PS1_GAMES, PS_MIMI_GAMES};
+        if (id != nullptr)
+        {
+            std::string key = std::string(id);
+            for (int i=0; i < 3; i++)
+            {
+                GameLocation location;
+                Game *game = LocateGame(&game_categories[image_categories[i]], key, &location);
+                if (game != nullptr && game->type == type && strcmp(rom_path, game->rom_path) == 0)
+                {
+                    return game;
+                }
+            }
+            return nullptr;
+        }
+
+        for (int i=0; i < 3; i++)
+        {
+            GameCategory *image_category = &game_categories[image_categories[i]];
+            for (int j=0; j < image_category->folders.size(); j++)
+            {
+                std::vector<Game> &games = image_category->folders[j].games;
+                for (int k=0; k < games.size(); k++)
+                {
+                    if (games[k].type == type && strcmp(rom_path, games[k].rom_path) == 0)
+                    {
+                        return &games[k];
+                    }
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    static bool OwnsSlot(uint32_t slot, GameCategory *category, const std::string &key)
+    {
+        return slot != 0 && slot < game_slots.size() && game_slots[slot].used && !game_slots[slot].folder &&
+            game_slots[slot].category == category->id && game_slots[slot].key == key;
+    }
+
+    static uint32_t AllocateSlot(GameCategory *category, const std::string &key, int folder_id, bool folder)
+    {
+        uint32_t slot;
+        if (free_game_slots.size() > 0)
+        {
+            slot = free_game_slots.back();
+            free_game_slots.pop_back();
+        }
+        else
+        {
+            slot = game_slots.size();
+            game_slots.push_back(GameSlot());
+            game_slots[slot].generation = 0;
+        }
+        GameSlot *entry = &game_slots[slot];
+        entry->category = category->id;
+        entry->key = key;
+        entry->folder_id = folder_id;
+        entry->folder = folder;
+        entry->used = true;
+        return slot;
+    }
+
+    // handles to the slot go stale, the slot is handed out again with the next generation
+    static void ReleaseSlot(uint32_t slot)
+    {
+        game_slots[slot].generation++;
+        game_slots[slot].used = false;
+        game_slots[slot].key.clear();
+        free_game_slots.push_back(slot);
+    }
+
+    static GameSlot* FindSlot(GameHandle handle)
+    {
+        if (handle.slot == 0 || handle.slot >= game_slots.size() || !game_slots[handle.slot].used ||
+            game_slots[handle.slot].generation != handle.generation)
+        {
+            return nullptr;
+        }
+        return &game_slots[handle.slot];
+    }
+
+    static int RemoveGameAt(GameCategory *category, GameLocation location)
+    {
+        std::vector<Game> &games = category->folders[location.folder].games;
+        std::string key = GetGameKey(&games[location.position]);
+        if (OwnsSlot(games[location.position].slot, category, key))
+        {
+            ReleaseSlot(games[location.position].slot);
+        }
+        category->game_index.erase(key);
+        games.erase(games.begin()+location.position);
+        ReindexFolder(category, location.folder, location.position);
+        return location.position;
+    }
+
+    void IndexGame(GameCategory *category, Folder *folder, int position)
+    {
+        int folder_index = GetFolderIndex(category, folder);
+        if (!category->game_index_valid || folder_index < 0)
+        {
+            category->game_index_valid = false;
+            return;
+        }
+
+        GameLocation location = {folder_index, position};
+        category->game_index.insert(std::make_pair(GetGameKey(&folder->games[position]), location));
+    }
+
+    void InvalidateGameIndex(GameCategory *category)
+    {
+        category->game_index_valid = false;
+    }
+
+    // A game keeps the handle it was given for as long as it is in the category,
+    // moving between folders or being sorted included. Reading the games of a
+    // category again finds it by its key, removing it makes the handle stale.
+    GameHandle GetGameHandle(GameCategory *category, Game *game)
+    {
+        GameHandle handle;
+        if (game == nullptr)
+        {
+            return handle;
+        }
+
+        std::string key = GetGameKey(game);
+        uint32_t slot = game->slot;
+        if (!OwnsSlot(slot, category, key))
+        {
+            GameLocation location;
+            Game *stored = LocateGame(category, key, &location);
+            if (stored == nullptr)
+            {
+                return handle;
+            }
+            slot = OwnsSlot(stored->slot, category, key) ? stored->slot : AllocateSlot(category, key, 0, false);
+            stored->slot = slot;
+            game->slot = slot;
+        }
+        handle.slot = slot;
+        handle.generation = game_slots[slot].generation;
+        return handle;
+    }
+
+    GameHandle GetFolderHandle(GameCategory *category, Folder *folder)
+    {
+        GameHandle handle;
+        if (folder == nullptr)
+        {
+            return handle;
+        }
+
+        uint32_t slot = folder->slot;
+        if (slot == 0 || slot >= game_slots.size() || !game_slots[slot].used || !game_slots[slot].folder ||
+            game_slots[slot].category != category->id || game_slots[slot].folder_id != folder->id)
+        {
+            slot = AllocateSlot(category, std::string(), folder->id, true);
+            folder->slot = slot;
+        }
+        handle.slot = slot;
+        handle.generation = game_slots[slot].generation;
+        return handle;
+    }
+
+    Game* GetGame(GameHandle handle)
+    {
+        GameSlot *entry = FindSlot(handle);
+        if (entry == nullptr || entry->folder)
+        {
+            return nullptr;
+        }
+        GameLocation location;
+        Game *game = LocateGame(&game_categories[entry->category], entry->key, &location);
+        if (game != nullptr)
+        {
+            game->slot = handle.slot;
+        }
+        return game;
+    }
+
+    Folder* GetFolder(GameHandle handle)
+    {
+        GameSlot *entry = FindSlot(handle);
+        if (entry == nullptr || !entry->folder)
+        {
+            return nullptr;
+        }
+        return FindFolder(&game_categories[entry->category], entry->folder_id);
+    }
+
+    void ResetGameHandles()
+    {
+        for (uint32_t i=1; i < game_slots.size(); i++)
+        {
+            if (game_slots[i].used)
+            {
+                ReleaseSlot(i);
+            }
+        }
+    }
+
+    Game* FindGame(GameCategory *category, Game *game)
+    {
+        GameLocation location;
+        return LocateGame(category, game, &location);
+    }
+
+    int FindGamePosition(GameCategory *category, Game *game)
+    {
+        GameLocation location;
+        if (LocateGame(category, game, &location) != nullptr &&
+            location.folder == GetFolderIndex(category, category->current_folder))
+        {
+            return location.position;
+        }
+        return -1;
+    }
+
+    int RemoveGameFromCategory(GameCategory *category, Game *game)
+    {
+        GameLocation location;
+        if (LocateGame(category, game, &location) == nullptr)
+        {
+            return -1;
+        }
+        return RemoveGameAt(category, location);
+    }
+
+    int RemoveFolderFromCategory(GameCategory *category, int folder_id)
+    {
+        for (int i=0; i < category->folders.size(); i++)
+        {
+            if (category->folders[i].id == folder_id)
+            {
+                uint32_t slot = category->folders[i].slot;
+                if (slot != 0 && slot < game_slots.size() && game_slots[slot].used && game_slots[slot].folder &&
+                    game_slots[slot].category == category->id && game_slots[slot].folder_id == folder_id)
+                {
+                    ReleaseSlot(slot);
+                }
+                category->folders.erase(category->folders.begin()+i);
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    int RemoveGameFromFolder(Folder *folder, Game *game)
+    {
+        GameCategory *category = &game_categories[folder->category];
+        int folder_index = GetFolderIndex(category, folder);
+        GameLocation location;
+        if (folder_index >= 0 && LocateGame(category, game, &location) != nullptr && location.folder == folder_index)
+        {
+            return RemoveGameAt(category, location);
+        }
+
+        for (int i=0; i < folder->games.size(); i++)
+        {
+            if ((game->type == TYPE_FOLDER && folder->games[i].folder_id == game->folder_id) ||
+                (game->type != TYPE_ROM && game->type != TYPE_SCUMMVM && strcmp(game->id, folder->games[i].id) == 0) ||
+                ((game->type == TYPE_ROM || game->type == TYPE_SCUMMVM) && strcmp(game->rom_path, folder->games[i].rom_path) == 0))
+            {
+                folder->games.erase(folder->games.begin()+i);
+                if (folder_index >= 0)
+                {
+                    InvalidateGameIndex(category);
+                }
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    static bool IsArticle(const char *title, const char *article)
+    {
+        int length = strlen(article);
+        return strncasecmp(title, article, length) == 0 && title[length] == ' ' && title[length+1] != 0;
     }
 
-    int ScanGamesCategoryThread(SceSize args, ScanGamesParams *params)
+    // The title as it is compared when sorting: lower case, without a leading
+    // article, and every run of digits prefixed with its length so "Game 10"
+    // comes after "Game 9".
+    static const char* GetSortKey(Game *game)
     {
-        gui_mode = GUI_MODE_SCAN;
-        sceKernelDelayThread(50000);
-        sqlite3 *db;
-        sqlite3_open(CACHE_DB_FILE, &db);
-        if (params->type == TYPE_ROM || strcmp(params->category, "ps1") == 0 || params->type == TYPE_SCUMMVM)
+        if (game->sort_key != nullptr)
         {
-            GameCategory *category = categoryMap[params->category];
-            RemoveGamesFromCategoryByType(db, category, params->type);
+            return game->sort_key;
         }
-        
-        if (params->type == TYPE_EBOOT || params->type == TYPE_PSP_ISO)
+
+        const char *title = game->title;
+        if (IsArticle(title, "the"))
         {
-            DB::DeleteGamesByType(db, params->type);
-            for (int i=0; i<TOTAL_CATEGORY; i++)
+            title += 4;
+        }
+        else if (IsArticle(title, "an"))
+        {
+            title += 3;
+        }
+        else if (IsArticle(title, "a"))
+        {
+            title += 2;
+        }
+
+        char key[256];
+        int length = 0;
+        while (*title != 0 && length < sizeof(key)-1)
+        {
+            if (isdigit((unsigned char)*title))
             {
-                for (std::vector<Game>::iterator it=game_categories[i].current_folder->games.begin(); it!=game_categories[i].current_folder->games.end(); )
+                while (*title == '0' && isdigit((unsigned char)title[1]))
                 {
-                    if (it->type == params->type)
-                    {
-                        game_categories[i].current_folder->games.erase(it);
-                    }
-                    else
-                    {
-                        ++it;
-                    }
+                    title++;
+                }
+                int digits = 0;
+                while (isdigit((unsigned char)title[digits]))
+                {
+                    digits++;
+                }
+                if (length + digits + 1 >= sizeof(key))
+                {
+                    break;
                 }
+                // below every printable character, so a run can not tie with the punctuation of another title
+                key[length++] = SORT_KEY_DIGITS + (digits < SORT_KEY_MAX_DIGITS ? digits : SORT_KEY_MAX_DIGITS);
+                memcpy(&key[length], title, digits);
+                length += digits;
+                title += digits;
+            }
+            else
+            {
+                key[length++] = tolower((unsigned char)*title);
+                title++;
             }
         }
+        key[length] = 0;
+        game->sort_key = ARENA::Copy(key);
+        return game->sort_key;
+    }
 
-        if (params->type == TYPE_ROM  || strcmp(params->category, "ps1") == 0)
+    // folders first, then the platform when the category is sorted by it, then the sort key
+    static bool GameBefore(const Game *a, const Game *b, int sort_order)
+    {
+        if ((a->type == TYPE_FOLDER) != (b->type == TYPE_FOLDER))
         {
-            ScanRetroCategory(db, categoryMap[params->category]);
+            return a->type == TYPE_FOLDER;
         }
-        
-        if (params->type == TYPE_PSP_ISO)
+        if (sort_order == SORT_ORDER_PLATFORM && a->category != b->category)
         {
-            ScanAdrenalineIsoGames(db);
+            return game_categories[a->category].order < game_categories[b->category].order;
         }
-        
-        if (params->type == TYPE_EBOOT)
+        int result = strcmp(a->sort_key, b->sort_key);
+        if (result != 0)
         {
-            ScanAdrenalineEbootGames(db);
+            return result < 0;
         }
+        return strcmp(a->title, b->title) < 0;
+    }
 
-        if (params->type == TYPE_SCUMMVM)
+    // Sorts the indices of the games and then moves every game once, following the
+    // cycles of that permutation, instead of swapping them around while sorting.
+    static void SortFolder(Folder *folder, int sort_order)
+    {
+        std::vector<Game> &games = folder->games;
+        for (int i=0; i < games.size(); i++)
         {
-            ScanScummVMGames(db);
+            GetSortKey(&games[i]);
         }
 
-        sqlite3_close(db);
-
-        if (params->type == TYPE_ROM || strcmp(params->category, "ps1") == 0 || params->type == TYPE_SCUMMVM)
-        {
-            GameCategory *category = categoryMap[params->category];
-            category->current_folder->page_num = 1;
-            SetMaxPage(category);
-            SortGames(category);
-            current_category = category;
-        }
-        
-        if (params->type == TYPE_EBOOT || params->type == TYPE_PSP_ISO)
+        std::vector<int> order(games.size());
+        for (int i=0; i < order.size(); i++)
         {
-            game_categories[PSP_GAMES].current_folder->page_num = 1;
-            SetMaxPage(&game_categories[PSP_GAMES]);
-            SortGames(&game_categories[PSP_GAMES]);
-            game_categories[PS1_GAMES].current_folder->page_num = 1;
-            SetMaxPage(&game_categories[PS1_GAMES]);
-            SortGames(&game_categories[PS1_GAMES]);
-            game_categories[PS_MIMI_GAMES].current_folder->page_num = 1;
-            SetMaxPage(&game_categories[PS_MIMI_GAMES]);
-            SortGames(&game_categories[PS_MIMI_GAMES]);
+            order[i] = i;
         }
-        
+        std::stable_sort(order.begin(), order.end(), [&games, sort_order](int a, int b) {
+            return GameBefore(&games[a], &games[b], sort_order);
+        });
 
-        if (current_category->view_mode == VIEW_MODE_GRID)
+        std::vector<bool> placed(games.size(), false);
+        for (int i=0; i < order.size(); i++)
         {
-            GAME::StartLoadImagesThread(current_category->id, 1, 1, current_category->games_per_page);
+            if (placed[i] || order[i] == i)
+            {
+                continue;
+            }
+            Game tmp = games[i];
+            int j = i;
+            while (order[j] != i)
+            {
+                games[j] = games[order[j]];
+                placed[j] = true;
+                j = order[j];
+            }
+            games[j] = tmp;
+            placed[j] = true;
         }
-        gui_mode = GUI_MODE_LAUNCHER;
-        return sceKernelExitDeleteThread(0);
     }
 
-    int GameComparator(const void *v1, const void *v2)
+    void SortGames(GameCategory *category)
     {
-        const Game *p1 = (Game *)v1;
-        const Game *p2 = (Game *)v2;
-        if (p1->type == TYPE_FOLDER && p2->type != TYPE_FOLDER)
-        {
-            return -1;
-        }
-        else if (p1->type != TYPE_FOLDER && p2->type == TYPE_FOLDER)
+        for (int j=0; j < category->folders.size(); j++)
         {
-            return 1;
+            SortFolder(&category->folders[j], category->sort_order);
         }
-
-        return strcmp(p1->title, p2->title);
+        BuildGameIndex(category);
     }
 
-    void DeleteGamesImages(GameCategory *category)
+    void SortGames(Folder *folder)
     {
-        for (int i=0; i < category->current_folder->games.size(); i++)
+        GameCategory *category = &game_categories[folder->category];
+        SortFolder(folder, category->sort_order);
+        int folder_index = GetFolderIndex(category, folder);
+        if (folder_index >= 0)
         {
-            Game *game = &category->current_folder->games[i];
-            game->visible = 0;
-            game->thread_started = false;
-            if (game->tex.id != no_icon.id)
-            {
-                Tex tmp = game->tex;
-                game->tex = no_icon;
-                Textures::Free(&tmp);
-            }
+            ReindexFolder(category, folder_index, 0);
         }
     }
 
-    Game* FindGame(GameCategory *category, Game *game)
+    int InsertGame(GameCategory *category, Folder *folder, const Game &game)
     {
-        for (int j=0; j < category->folders.size(); j++)
+        Game entry = game;
+        GetSortKey(&entry);
+        std::vector<Game> &games = folder->games;
+        int low = 0;
+        int high = games.size();
+        while (low < high)
         {
-            Folder* current_folder = &category->folders[j];
-            for (int i=0; i < current_folder->games.size(); i++)
+            int middle = low + (high - low) / 2;
+            GetSortKey(&games[middle]);
+            if (GameBefore(&entry, &games[middle], category->sort_order))
             {
-                if ((game->type != TYPE_ROM && strcmp(game->id, current_folder->games[i].id) == 0) ||
-                    (game->type == TYPE_ROM && strcmp(game->rom_path, current_folder->games[i].rom_path) == 0))
-                {
-                    return &current_folder->games[i];
-                }
+                high = middle;
+            }
+            else
+            {
+                low = middle + 1;
             }
         }
-        return nullptr;
+        games.insert(games.begin()+low, entry);
+
+        int folder_index = GetFolderIndex(category, folder);
+        if (folder_index < 0)
+        {
+            category->game_index_valid = false;
+        }
+        else
+        {
+            ReindexFolder(category, folder_index, low);
+        }
+        return low;
     }
 
-    int FindGamePosition(GameCategory *category, Game *game)
+    void SetSortOrder(GameCategory *category, int sort_order)
     {
-        for (int i=0; i < category->current_folder->games.size(); i++)
+        if (category->sort_order != sort_order)
         {
-            if ((game->type != TYPE_ROM && game->type != TYPE_SCUMMVM && strcmp(game->id, category->current_folder->games[i].id) == 0) ||
-                ((game->type == TYPE_ROM || game->type == TYPE_SCUMMVM) && strcmp(game->rom_path, category->current_folder->games[i].rom_path) == 0))
-            {
-                return i;
-            }
+            category->sort_order = sort_order;
+            SortGames(category);
         }
-        return -1;
     }
 
-    int RemoveGameFromCategory(GameCategory *category, Game *game)
+    // Keeps the games of every folder that remove returns false for in one pass,
+    // each game moves at most once. Removed games give up their slot, the index
+    // is rebuilt once on the next lookup.
+    template <typename Predicate>
+    static int CompactGames(GameCategory *category, Folder *skip_folder, Predicate remove)
     {
+        int removed = 0;
         for (int j=0; j < category->folders.size(); j++)
         {
-            Folder* current_folder = &category->folders[j];
-            for (int i=0; i < current_folder->games.size(); i++)
+            if (&category->folders[j] == skip_folder)
+            {
+                continue;
+            }
+
+            std::vector<Game> &games = category->folders[j].games;
+            int kept = 0;
+            for (int i=0; i < games.size(); i++)
             {
-                if ((game->type == TYPE_FOLDER && current_folder->games[i].folder_id == game->folder_id) ||
-                    (game->type != TYPE_ROM && game->type != TYPE_SCUMMVM && strcmp(game->id, current_folder->games[i].id) == 0) ||
-                    ((game->type == TYPE_ROM || game->type == TYPE_SCUMMVM) && strcmp(game->rom_path, current_folder->games[i].rom_path) == 0))
+                if (remove(games[i]))
+                {
+                    removed++;
+                    continue;
+                }
+                if (kept != i)
                 {
-                    current_folder->games.erase(current_folder->games.begin()+i);
-                    return i;
+                    games[kept] = games[i];
                 }
+                kept++;
             }
+            games.erase(games.begin()+kept, games.end());
         }
-        return -1;
+        if (removed > 0)
+        {
+            InvalidateGameIndex(category);
+        }
+        return removed;
     }
 
-    int RemoveFolderFromCategory(GameCategory *category, int folder_id)
+    static void GetGameKeys(std::vector<Game> &games, std::unordered_set<std::string> &keys)
     {
-        for (int i=0; i < category->folders.size(); i++)
+        keys.reserve(games.size());
+        for (int i=0; i < games.size(); i++)
         {
-            if (category->folders[i].id == folder_id)
-            {
-                category->folders.erase(category->folders.begin()+i);
-                return i;
-            }
+            keys.insert(GetGameKey(&games[i]));
         }
-        return -1;
     }
 
-    int RemoveGameFromFolder(Folder *folder, Game *game)
+    void RemoveGamesFromCategoryByType(sqlite3 *db, GameCategory *category, int rom_type)
     {
-        for (int i=0; i < folder->games.size(); i++)
-        {
-            if ((game->type == TYPE_FOLDER && folder->games[i].folder_id == game->folder_id) ||
-                (game->type != TYPE_ROM && game->type != TYPE_SCUMMVM && strcmp(game->id, folder->games[i].id) == 0) ||
-                ((game->type == TYPE_ROM || game->type == TYPE_SCUMMVM) && strcmp(game->rom_path, folder->games[i].rom_path) == 0))
+        DB::DeleteGamesByCategoryAndType(db, category->id, rom_type);
+        CompactGames(category, nullptr, [category, rom_type](Game &game) {
+            if (game.type != rom_type)
             {
-                folder->games.erase(folder->games.begin()+i);
-                return i;
+                return false;
             }
-        }
-        return -1;
+            std::string key = GetGameKey(&game);
+            if (OwnsSlot(game.slot, category, key))
+            {
+                ReleaseSlot(game.slot);
+            }
+            return true;
+        });
     }
 
-    void SortGames(GameCategory *category)
+    int RemoveGamesFromCategory(GameCategory *category, std::vector<Game> &games)
     {
-        for (int j=0; j < category->folders.size(); j++)
-        {
-            Folder* current_folder = &category->folders[j];
-            qsort(&current_folder->games[0], current_folder->games.size(), sizeof(Game), GameComparator);
-        }
+        std::unordered_set<std::string> keys;
+        GetGameKeys(games, keys);
+        return CompactGames(category, nullptr, [category, &keys](Game &game) {
+            std::string key = GetGameKey(&game);
+            if (keys.find(key) == keys.end())
+            {
+                return false;
+            }
+            if (OwnsSlot(game.slot, category, key))
+            {
+                ReleaseSlot(game.slot);
+            }
+            return true;
+        });
     }
 
-    void SortGames(Folder *folder)
+    int MoveGamesToFolder(GameCategory *category, std::vector<Game> &games, Folder *folder)
     {
-        qsort(&folder->games[0], folder->games.size(), sizeof(Game), GameComparator);
+        std::unordered_set<std::string> keys;
+        GetGameKeys(games, keys);
+        std::vector<Game> moved;
+        moved.reserve(games.size());
+        CompactGames(category, folder, [folder, &keys, &moved](Game &game) {
+            if (game.type == TYPE_FOLDER || keys.find(GetGameKey(&game)) == keys.end())
+            {
+                return false;
+            }
+            Game tmp = game;
+            tmp.tex = no_icon;
+            tmp.visible = false;
+            tmp.thread_started = false;
+            tmp.folder_id = folder->id;
+            tmp.selected = false;
+            moved.push_back(tmp);
+            return true;
+        });
+
+        // the moved games keep their slots, their handles find them in the new folder
+        folder->games.insert(folder->games.end(), moved.begin(), moved.end());
+        SortFolder(folder, category->sort_order);
+        InvalidateGameIndex(category);
+        return moved.size();
     }
 
     void RefreshGames(bool all_categories)
     {
         games_to_scan = 1;
         games_scanned = 0;
-        sprintf(game_scan_inprogress.title, "%s", "");
+        game_scan_inprogress.title = "";
         if (all_categories)
         {
-            FS::Rm(CACHE_DB_FILE);
-            StartScanGamesThread();
+            StartScanGamesThread(true);
         }
         else
         {
@@ -1026,6 +2136,16 @@ namespace GAME {
         
     }
 
+    // Deletes cache.db and scans every folder from scratch, for a cache that went
+    // wrong. The folders, favorites and hidden games kept in it are lost.
+    void RebuildGames()
+    {
+        games_to_scan = 1;
+        games_scanned = 0;
+        game_scan_inprogress.title = "";
+        StartScanGamesThread(true, true);
+    }
+
     bool IsMatchPrefixes(const char* id, std::vector<std::string> &prefixes)
     {
         for (int i=0; i < prefixes.size(); i++)
@@ -1036,17 +2156,17 @@ namespace GAME {
         return false;
     }
 
-    const char* GetGameCategory(const char *title_id)
+    int GetGameCategory(const char *title_id)
     {
         for (int i=TOTAL_CATEGORY-1; i>0; i--)
         {
             if (IsMatchPrefixes(title_id, game_categories[i].valid_title_ids))
             {
-                return game_categories[i].category;
+                return i;
             }
         }
 
-        return game_categories[HOMEBREWS].category;
+        return HOMEBREWS;
     }
 
     GameCategory* GetRomCategoryByName(const char* category_name)
@@ -1087,6 +2207,8 @@ namespace GAME {
         sprintf(scan_message, "Scanning for SCUMMVM games in the %s file", SCUMMVM_INI_FILE);
         games_to_scan = count;
         games_scanned = 0;
+        BulkInsert bulk;
+        DB::BeginBulkInsert(db, &bulk, insert_batch_size);
 
         for (int i=0; i<count; i++)
         {
@@ -1095,20 +2217,24 @@ namespace GAME {
             memset(section, 0, 64);
             int len = strlen(sections[i]);
             strncpy(section, sections[i]+1, len-2);
-            sprintf(game.rom_path, ReadString(section, SCUMMVM_GAME_PATH, ""));
-            if (game.rom_path[0] != 0)
+            const char *rom_path = ReadString(section, SCUMMVM_GAME_PATH, "");
+            if (rom_path[0] != 0 && strlen(rom_path) < ROM_PATH_MAX)
             {
+                game.rom_path = ARENA::Copy(rom_path);
                 game.type = TYPE_SCUMMVM;
-                sprintf(game.category, game_categories[SCUMMVM_GAMES].category);
-                sprintf(game.id, ReadString(section, SCUMMVM_GAME_ID, ""));
-                sprintf(game.title, ReadString(section, SCUMMVM_GAME_TITLE, ""));
+                game.category = SCUMMVM_GAMES;
+                game.id = ARENA::Copy(ReadString(section, SCUMMVM_GAME_ID, ""));
+                game.title = ARENA::Copy(ReadString(section, SCUMMVM_GAME_TITLE, ""));
                 game.tex = no_icon;
                 game_categories[SCUMMVM_GAMES].current_folder->games.push_back(game);
-                DB::InsertGame(db, &game);
+                IndexGame(&game_categories[SCUMMVM_GAMES], game_categories[SCUMMVM_GAMES].current_folder,
+                    game_categories[SCUMMVM_GAMES].current_folder->games.size()-1);
+                DB::BulkInsertGame(&bulk, &game);
                 game_scan_inprogress = game;
             }
             games_scanned++;
         }
+        DB::EndBulkInsert(&bulk);
 
         for (int i=0; i<count; i++)
         {
@@ -1118,90 +2244,193 @@ namespace GAME {
         CloseIniFile();
     }
 
-    void DownloadThumbnail(sqlite3 *database, Game *game)
+    static void GetThumbnailTokens(const char *title, std::vector<std::string> &tokens)
     {
-        std::string title = std::string(game->title);
-        std::replace_if(title.begin(), title.end(),
+        std::string text = std::string(title);
+        std::replace_if(text.begin(), text.end(),
             [](char c) { return !std::isspace(c) && !std::isalnum(c); }, ' ');
-        CONFIG::ReplaceAll(title, "'", "''");
-        std::vector<std::string> tokens;
-        char *token = std::strtok(title.c_str(), " ");
+        char *token = std::strtok(&text[0], " ");
         while (token != NULL) {
             tokens.push_back(token);
             token = std::strtok(NULL, " ");
         }
+    }
+
+    static bool GetThumbnailPath(GameCategory *cat, Game *game, char *path)
+    {
+        if (game->type == TYPE_ROM)
+        {
+            std::string rom_path = std::string(game->rom_path);
+            int dot_index = rom_path.find_last_of(".");
+            if (new_icon_method)
+            {
+                sprintf(path, "%s.png", rom_path.substr(0, dot_index).c_str());
+            }
+            else
+            {
+                int slash_index = rom_path.find_last_of("/");
+                std::string rom_name = rom_path.substr(slash_index+1, dot_index-slash_index-1);
+                sprintf(path, "%s/%s.png", cat->icon_path, rom_name.c_str());
+            }
+            return true;
+        }
+        else if (game->type == TYPE_SCUMMVM)
+        {
+            sprintf(path, "%s/icon0.png", game->rom_path);
+            return true;
+        }
+        return false;
+    }
+
+    static void GetThumbnailUrls(GameCategory *cat, const char *thumbnail, std::string &url, std::string &alternate_url)
+    {
+        char base_url[132];
+        char alternate_base_url[132];
+        if (cat->icon_type == 1)
+        {
+            sprintf(base_url, cat->download_url, ICON_TYPE_BOXARTS);
+            sprintf(alternate_base_url, cat->download_url, ICON_TYPE_TITLES);
+        }
+        else
+        {
+            sprintf(base_url, cat->download_url, ICON_TYPE_TITLES);
+            sprintf(alternate_base_url, cat->download_url, ICON_TYPE_BOXARTS);
+        }
+
+        url = std::string(base_url) + "/" + thumbnail;
+        CONFIG::ReplaceAll(url, " ", "%20");
+        alternate_url = std::string(alternate_base_url) + "/" + thumbnail;
+        CONFIG::ReplaceAll(alternate_url, " ", "%20");
+    }
+
+    void DownloadThumbnail(sqlite3 *database, Game *game)
+    {
+        std::vector<std::string> tokens;
+        GetThumbnailTokens(game->title, tokens);
         sqlite3 *db = database;
         if (database == NULL)
         {
             char db_name[64];
-            sprintf(db_name, "ux0:app/SMLA00001/thumbnails/%s.db", game->category);
-            int rc = sqlite3_open(db_name, &db);
+            sprintf(db_name, "ux0:app/SMLA00001/thumbnails/%s.db", game_categories[game->category].category);
+            db = DB::Acquire(db_name);
         }
 
         char thumbnail[128];
         bool found = DB::FindMatchingThumbnail(db, tokens, thumbnail);
-        if (found)
+        char path[384];
+        GameCategory *cat = &game_categories[game->category];
+        if (found && GetThumbnailPath(cat, game, path))
         {
-            char url[384];
-            char alternate_url[384];
-            char path[384];
-            char base_url[132];
-            char alternate_base_url[132];
             game->icon_missing = false;
-            GameCategory *cat = categoryMap[game->category];
-            if (cat->icon_type == 1)
-            {
-                sprintf(base_url, cat->download_url, ICON_TYPE_BOXARTS);
-                sprintf(alternate_base_url, cat->download_url, ICON_TYPE_TITLES);
-            }
-            else
-            {
-                sprintf(base_url, cat->download_url, ICON_TYPE_TITLES);
-                sprintf(alternate_base_url, cat->download_url, ICON_TYPE_BOXARTS);
-            }
-            
-            sprintf(url, "%s/%s", base_url, thumbnail);
-            sprintf(alternate_url, "%s/%s", alternate_base_url, thumbnail);
-            std::string url_str = std::string(url);
-            CONFIG::ReplaceAll(url_str, " ", "%20");
-            std::string alternate_url_str = std::string(alternate_url);
-            CONFIG::ReplaceAll(alternate_url_str, " ", "%20");
+            std::string url;
+            std::string alternate_url;
+            GetThumbnailUrls(cat, thumbnail, url, alternate_url);
 
-            if (game->type == TYPE_ROM)
+            if (!FS::FileExists(path))
             {
-                std::string rom_path = std::string(game->rom_path);
-                int dot_index = rom_path.find_last_of(".");
-                if (new_icon_method)
-                {
-                    sprintf(path, "%s.png", rom_path.substr(0, dot_index).c_str());
-                }
-                else
+                int res = Net::DownloadFile(url.c_str(), path);
+                if (res < 0)
                 {
-                    int slash_index = rom_path.find_last_of("/");
-                    std::string rom_name = rom_path.substr(slash_index+1, dot_index-slash_index-1);
-                    sprintf(path, "%s/%s.png", cat->icon_path, rom_name.c_str());
+                    Net::DownloadFile(alternate_url.c_str(), path);
                 }
-                
             }
-            else if (game->type == TYPE_SCUMMVM)
+        }
+
+        if (database == NULL)
+        {
+            DB::Release(db);
+        }
+    }
+
+    void GetThumbnailTitles(GameCategory *category, Folder *folder, std::vector<ThumbnailTitle> &titles)
+    {
+        char path[384];
+        for (int i=0; i<folder->games.size(); i++)
+        {
+            Game *game = &folder->games[i];
+            if (GetThumbnailPath(category, game, path))
             {
-                sprintf(path, "%s/icon0.png", game->rom_path);
+                ThumbnailTitle title;
+                title.game = GetGameHandle(category, game);
+                title.title = game->title;
+                title.path = path;
+                titles.push_back(title);
             }
+        }
+    }
 
-            if (!FS::FileExists(path))
+    // Works out which games of a folder still need a thumbnail. Every target folder is
+    // listed once instead of a FileExists per game, games sharing a target png are
+    // downloaded once and the remaining titles are matched in one pass over the db.
+    // found gets the games that have or will get their png, the caller clears their
+    // icon_missing under the lock.
+    void ResolveThumbnails(sqlite3 *database, GameCategory *category, std::vector<ThumbnailTitle> &titles,
+        std::vector<ThumbnailDownload> &downloads, std::vector<GameHandle> &found, ThumbnailReport *report)
+    {
+        uint64_t start = sceKernelGetProcessTimeWide();
+        std::map<std::string, std::vector<std::string>> dir_files;
+        std::unordered_set<std::string> targets;
+        std::vector<ThumbnailTitle*> missing;
+        std::vector<std::vector<std::string>> tokens;
+
+        for (int i=0; i<titles.size(); i++)
+        {
+            ThumbnailTitle *title = &titles[i];
+            report->titles++;
+
+            std::string target = title->path;
+            std::transform(target.begin(), target.end(), target.begin(), ::tolower);
+            if (!targets.insert(target).second)
             {
-                int res = Net::DownloadFile(url_str.c_str(), path);
-                if (res < 0)
+                report->duplicates++;
+                continue;
+            }
+
+            int slash_index = target.find_last_of("/");
+            std::string dir = target.substr(0, slash_index);
+            std::map<std::string, std::vector<std::string>>::iterator listing = dir_files.find(dir);
+            if (listing == dir_files.end())
+            {
+                std::vector<std::string> files = FS::ListDir(title->path.substr(0, slash_index));
+                for (int j=0; j<files.size(); j++)
                 {
-                    Net::DownloadFile(alternate_url_str.c_str(), path);
+                    std::transform(files[j].begin(), files[j].end(), files[j].begin(), ::tolower);
                 }
+                std::sort(files.begin(), files.end());
+                listing = dir_files.insert(std::make_pair(dir, files)).first;
+            }
+
+            if (std::binary_search(listing->second.begin(), listing->second.end(), target.substr(slash_index+1)))
+            {
+                found.push_back(title->game);
+                report->present++;
+                continue;
             }
+
+            missing.push_back(title);
+            tokens.push_back(std::vector<std::string>());
+            GetThumbnailTokens(title->title.c_str(), tokens.back());
         }
 
-        if (database == NULL)
+        std::vector<std::string> thumbnails;
+        DB::FindMatchingThumbnails(database, tokens, thumbnails);
+        for (int i=0; i<missing.size(); i++)
         {
-            sqlite3_close(db);
+            if (thumbnails[i].empty())
+            {
+                report->unmatched++;
+                continue;
+            }
+            report->matched++;
+            found.push_back(missing[i]->game);
+
+            ThumbnailDownload download;
+            download.game = missing[i]->game;
+            download.path = missing[i]->path;
+            GetThumbnailUrls(category, thumbnails[i].c_str(), download.url, download.alternate_url);
+            downloads.push_back(download);
         }
+        report->resolve_time = sceKernelGetProcessTimeWide() - start;
     }
 
     void DownloadThumbnails(GameCategory *category)
@@ -1209,28 +2438,62 @@ namespace GAME {
         gui_mode = GUI_MODE_SCAN;
         games_to_scan = category->current_folder->games.size();
         games_scanned = 0;
-        sprintf(game_scan_inprogress.title, "%s", "");
+        game_scan_inprogress.title = "";
         sprintf(scan_message, "Downloading thumbnails for %s games", current_category->title);
         StartDownloadThumbnailsThread(category);
     }
 
     int DownloadThumbnailsThread(SceSize args, ScanGamesParams *params)
     {
-        GameCategory *cat = categoryMap[params->category];
+        GameCategory *cat = &game_categories[params->category];
         char db_path[64];
         sprintf(db_path, "%s/%s.db", THUMBNAIL_BASE_PATH, cat->category);
-        sqlite3 *db;
-        sqlite3_open(db_path, &db);
-        for (int i=0; i<cat->current_folder->games.size(); i++)
+        sqlite3 *db = DB::Acquire(db_path);
+        std::vector<ThumbnailTitle> titles;
+        std::vector<ThumbnailDownload> downloads;
+        std::vector<GameHandle> found;
+        ThumbnailReport report;
+        LockCategories();
+        GetThumbnailTitles(cat, cat->current_folder, titles);
+        UnlockCategories();
+        ResolveThumbnails(db, cat, titles, downloads, found, &report);
+        DB::Release(db);
+
+        LockCategories();
+        for (int i=0; i<found.size(); i++)
+        {
+            Game *game = GetGame(found[i]);
+            if (game != nullptr)
+            {
+                game->icon_missing = false;
+            }
+        }
+        UnlockCategories();
+
+        char line[160];
+        snprintf(line, 160, "thumbnails %s: titles=%d matched=%d unmatched=%d present=%d duplicates=%d resolve_ms=%llu\n",
+            cat->category, report.titles, report.matched, report.unmatched, report.present, report.duplicates,
+            (unsigned long long)(report.resolve_time / 1000));
+        FS::AppendText(SCAN_STATS_LOG_FILE, line);
+
+        games_to_scan = downloads.size();
+        games_scanned = 0;
+        for (int i=0; i<downloads.size(); i++)
         {
-            if (cat->current_folder->games[i].type == TYPE_ROM || cat->current_folder->games[i].type == TYPE_SCUMMVM)
+            LockCategories();
+            Game *game = GetGame(downloads[i].game);
+            if (game != nullptr)
+            {
+                game_scan_inprogress = *game;
+            }
+            UnlockCategories();
+            int res = Net::DownloadFile(downloads[i].url.c_str(), downloads[i].path.c_str());
+            if (res < 0)
             {
-                DownloadThumbnail(db, &cat->current_folder->games[i]);
-                game_scan_inprogress = cat->current_folder->games[i];
+                Net::DownloadFile(downloads[i].alternate_url.c_str(), downloads[i].path.c_str());
             }
             games_scanned++;
         }
-        sqlite3_close(db);
         gui_mode = GUI_MODE_LAUNCHER;
         return sceKernelExitDeleteThread(0);
     }
@@ -1239,7 +2502,7 @@ namespace GAME {
     {
         ScanGamesParams params;
         params.type = category->rom_type;
-        params.category = category->category;
+        params.category = category->id;
         download_images_thid = sceKernelCreateThread("download_thumbnails_thread", (SceKernelThreadEntry)GAME::DownloadThumbnailsThread, 0x10000100, 0x4000, 0, 0, NULL);
 		if (download_images_thid >= 0)
 			sceKernelStartThread(download_images_thid, sizeof(ScanGamesParams), &params);
@@ -1248,8 +2511,9 @@ namespace GAME {
     int DeleteGamesImagesThread(SceSize args, DeleteImagesParams *params)
     {
         sceKernelDelayThread(5000);
-        Folder *folder = params->folder;
-        for (int i=0; i < folder->games.size(); i++)
+        LockCategories();
+        Folder *folder = GetFolder(params->folder);
+        for (int i=0; folder != nullptr && i < folder->games.size(); i++)
         {
             Game *game = &folder->games[i];
             game->visible = 0;
@@ -1261,18 +2525,36 @@ namespace GAME {
                 Textures::Free(&tmp);
             }
         }
+        UnlockCategories();
         return sceKernelExitDeleteThread(0);
     }
 
     void StartDeleteGameImagesThread(GameCategory *category)
     {
         DeleteImagesParams params;
-        params.folder = category->current_folder;
+        params.folder = GetFolderHandle(category, category->current_folder);
         delete_images_thid = sceKernelCreateThread("delete_images_thread", (SceKernelThreadEntry)GAME::DeleteGamesImagesThread, 0x10000100, 0x4000, 0, 0, NULL);
 		if (delete_images_thid >= 0)
 			sceKernelStartThread(delete_images_thid, sizeof(DeleteImagesParams), &params);
     }
 
+    static bool ContainsNoCase(const char *text, const char *part)
+    {
+        for (; *text != 0; text++)
+        {
+            int i = 0;
+            while (part[i] != 0 && tolower((unsigned char)text[i]) == tolower((unsigned char)part[i]))
+            {
+                i++;
+            }
+            if (part[i] == 0)
+            {
+                return true;
+            }
+        }
+        return part[0] == 0;
+    }
+
     void FindGamesByPartialName(std::vector<GameCategory*> &categories, char* search_text, std::vector<Game> &games)
     {
         for (int i=0; i<categories.size(); i++)
@@ -1283,13 +2565,7 @@ namespace GAME {
                 Folder* current_folder = &category->folders[j];
                 for (int k=0; k<current_folder->games.size(); k++)
                 {
-                    std::string title = std::string(current_folder->games[k].title);
-                    std::string text = std::string(search_text);
-                    std::transform(title.begin(), title.end(), title.begin(),
-                            [](unsigned char c){ return std::tolower(c); });
-                    std::transform(text.begin(), text.end(), text.begin(),
-                            [](unsigned char c){ return std::tolower(c); });
-                    if (title.find(text) != std::string::npos && current_folder->games[k].type != TYPE_FOLDER)
+                    if (current_folder->games[k].type != TYPE_FOLDER && ContainsNoCase(current_folder->games[k].title, search_text))
                     {
                         Game game = current_folder->games[k];
                         game.tex = no_icon;
@@ -1368,11 +2644,14 @@ exit:
 
 		if (ret >= 0)
 		{
-			GameCategory *cat = categoryMap[game->category];
+			// runs on its own thread while the ui draws the categories
+			LockCategories();
+			GameCategory *cat = &game_categories[game->category];
 			GAME::RemoveGameFromCategory(cat, game);
 			GAME::RemoveGameFromCategory(&game_categories[FAVORITES], game);
 			GAME::SetMaxPage(cat);
 			GAME::SetMaxPage(&game_categories[FAVORITES]);
+			UnlockCategories();
 			game_uninstalled = 2;
 		}
 		else
@@ -1418,6 +2697,7 @@ exit:
 
         dest_folder->games.insert(dest_folder->games.end(), src_folder->games.begin(), src_folder->games.end());
         src_folder->games.clear();
+        InvalidateGameIndex(category);
     }
 
     void ClearSelection(GameCategory *category)
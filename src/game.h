@@ -7,36 +7,71 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include "textures.h"
 #include "sqlite3.h"
+#include "fs.h"
+#include "arena.h"
 
+// longest rom_path with its terminator. The launch uris and the Adrenaline boot
+// data are sized for it, the scans and the add game dialogs skip longer paths.
+#define ROM_PATH_MAX 192
+
+#define SORT_ORDER_TITLE 0
+#define SORT_ORDER_PLATFORM 1
+
+// A digit run of a sort key is prefixed by SORT_KEY_DIGITS plus its length, so
+// numbers compare by value. Longer runs share the prefix of SORT_KEY_MAX_DIGITS.
+#define SORT_KEY_DIGITS 0x01
+#define SORT_KEY_MAX_DIGITS 30
+
+// What the views walk every frame. The strings are in the ARENA and set through
+// ARENA::Copy or ARENA::Format, copying a Game copies the pointers.
 typedef struct {
-    char id[20];
-    char title[128];
-    char category[10];
-    char rom_path[192];
-    bool favorite = false;
-    char type;
-    bool icon_missing = false;
+    const char *title = "";
+    const char *id = "";
+    const char *rom_path = "";
+    const char *sort_key = nullptr; // computed from title when first sorted, reset it when the title changes
+    Tex tex;
+    uint64_t visible_time = 0;
     int visible = 0;
     int folder_id = 0;
-    uint64_t visible_time = 0;
+    uint32_t slot = 0; // of the last GameHandle given out for it, 0 for none
+    char category; // index in game_categories
+    char type;
+    bool favorite = false;
+    bool icon_missing = false;
     bool thread_started = false;
     bool selected = false;
-    Tex tex;
 } Game;
 
 typedef struct {
     int id = -1;
     char title[128];
-    char category[10];
+    char category;
     char icon_path[192];
     char type;
     int max_page;
     int page_num;
+    uint32_t slot = 0;
     std::vector<Game> games;
 } Folder;
 
+// Refers to a game or folder that can move in or disappear from its vector while
+// it is held, by the ui between frames or by a background thread. GAME::GetGame
+// and GAME::GetFolder find it again and return nullptr once it is gone or the
+// slot was given to another game, a default handle refers to nothing.
+typedef struct {
+    uint32_t slot = 0;
+    uint32_t generation = 0;
+} GameHandle;
+
+// where a game is in its category, folder is the index in GameCategory.folders
+typedef struct {
+    int folder;
+    int position;
+} GameLocation;
+
 typedef struct {
     char id;
     char title[16];
@@ -45,6 +80,7 @@ typedef struct {
     Folder *current_folder;
     std::vector<std::string> valid_title_ids;
     std::vector<std::string> file_filters;
+    ExtensionMatcher rom_extensions;
     char category[10];
     char roms_path[96];
     char icon_path[96];
@@ -57,6 +93,7 @@ typedef struct {
     bool opened;
     int rom_type;
     int order;
+    int sort_order = SORT_ORDER_TITLE;
     char download_url[256];
     int rows;
     int columns;
@@ -64,8 +101,21 @@ typedef struct {
     ImVec2 button_size;
     ImVec2 thumbnail_size;
     int icon_type;
+    bool scan_pending;
+    // id, or rom_path for roms and scummvm games, to where that game is. Kept up to
+    // date by the GAME functions that add, sort, move and remove games, code that
+    // changes folders in bulk calls GAME::InvalidateGameIndex.
+    std::unordered_map<std::string, GameLocation> game_index;
+    bool game_index_valid = false;
 } GameCategory;
 
+typedef struct {
+    int64_t size;
+    uint64_t mtime;
+    bool is_dir;
+    bool seen;
+} FileManifestEntry;
+
 enum DRIVERS {INFERNO=0, MARCH33=1, NP9660=2};
 enum EXECUTE {EBOOT_BIN=0, BOOT_BIN=1, EBOOT_OLD=2};
 enum PSBUTTON_MODE {MENU=0, LIVEAREA=1, STANDARD=2};
@@ -142,6 +192,57 @@ typedef struct {
 #define TYPE_SCUMMVM 4
 #define TYPE_FOLDER 127
 
+// Time in microseconds spent in each stage of PopulateIsoGameInfo
+typedef struct {
+    uint64_t enumerate = 0;
+    uint64_t sniff = 0;
+    uint64_t extract = 0;
+    uint64_t parse = 0;
+    uint64_t persist = 0;
+    int images = 0;
+} IsoStageTimes;
+
+// What ResolveThumbnails needs of a game, copied so it can run without the categories lock
+typedef struct {
+    GameHandle game;
+    std::string title;
+    std::string path;
+} ThumbnailTitle;
+
+// A thumbnail DownloadThumbnails still has to fetch, url is tried before alternate_url
+typedef struct {
+    GameHandle game;
+    std::string path;
+    std::string url;
+    std::string alternate_url;
+} ThumbnailDownload;
+
+// Titles of a folder by outcome. present ones already have their png and are not
+// matched, duplicates share the target of a game earlier in the folder.
+typedef struct {
+    int titles = 0;
+    int matched = 0;
+    int unmatched = 0;
+    int present = 0;
+    int duplicates = 0;
+    uint64_t resolve_time = 0;
+} ThumbnailReport;
+
+// ICON0.PNG and PARAM.SFO bytes the scan workers may hold in memory at once, at least
+// ISO_MAX_SFO_SIZE and ISO_MAX_ICON_SIZE together so any one image fits in it
+#define ISO_EXTRACT_BUDGET_KB 1024
+
+// size:mtime:hash of the first IMAGE_FINGERPRINT_BYTES of the image header
+#define IMAGE_FINGERPRINT_BYTES 2048
+#define IMAGE_FINGERPRINT_LENGTH 64
+
+#define FILE_UNCHANGED 0
+#define FILE_ADDED 1
+#define FILE_CHANGED 2
+
+// the emulator folders are scanned below the ui and image loading threads
+#define SCAN_BACKGROUND_THREAD_PRIORITY 0xB0
+
 #define FOLDER_TYPE_ROOT 1
 #define FOLDER_TYPE_SUBFOLDER 2
 #define FOLDER_ROOT_ID 0
@@ -159,12 +260,17 @@ extern char adernaline_launcher_title_id[];
 extern BootSettings defaul_boot_settings;
 extern std::vector<std::string> psp_iso_extensions;
 extern std::vector<std::string> eboot_extensions;
+extern ExtensionMatcher psp_iso_extension_matcher;
+extern ExtensionMatcher eboot_extension_matcher;
+extern ExtensionMatcher rom_category_matcher;
 extern std::vector<std::string> hidden_title_ids;
+extern uint64_t vita_games_signature;
 extern char pspemu_path[];
 extern char pspemu_iso_path[];
 extern char pspemu_eboot_path[];
 extern char game_uninstalled;
-extern std::vector<Game*> selected_games;
+extern std::vector<GameHandle> selected_games;
+extern volatile bool scan_cancelled;
 
 static SceUID load_images_thid = -1;
 static SceUID scan_games_thid = -1;
@@ -182,24 +288,41 @@ typedef struct LoadImagesParams {
 } LoadImagesParams;
 
 typedef struct ScanGamesParams {
-  const char* category;
+  int category;
   int type;
 } ScanGamesParams;
 
+// rescan reads the cache again and scans what changed, rebuild deletes it first
+typedef struct ScanAllGamesParams {
+  bool rescan;
+  bool rebuild;
+} ScanAllGamesParams;
+
 typedef struct DeleteImagesParams {
-    Folder *folder;
+    GameHandle folder;
 };
 
 namespace GAME {
-    int GameComparator(const void *v1, const void *v2);
     void Init();
-    void Scan();
-    void ScanRetroCategory(sqlite3 *db, GameCategory *category);
-    void ScanRetroGames(sqlite3 *db);
-    void PopulateIsoGameInfo(Game *game, std::string rom, int game_index);
-    void ScanAdrenalineIsoGames(sqlite3 *db);
+    bool Scan(bool rescan = false);
+    void ScanInBackground(bool incremental);
+    void MarkFavorites(GameCategory *category = nullptr);
+    void PublishCategory(GameCategory *category);
+    void LockCategories();
+    bool LockCategories(SceUInt timeout);
+    void UnlockCategories();
+    // file name of rom without its folder and extension, at most 127 characters
+    void GetRomTitle(const std::string &rom, char *title);
+    bool PopulateRomGameInfo(GameCategory *category, Game *game, const std::string &rom, sqlite3 *mame_mappings_db);
+    void ScanRetroCategory(sqlite3 *db, GameCategory *category, bool incremental = false);
+    void GetRetroCategories(std::vector<GameCategory*> &categories);
+    void ScanRetroGames(sqlite3 *db, bool incremental = false);
+    void PopulateIsoGameInfo(Game *game, std::string rom, int game_index, IsoStageTimes *times = nullptr, SceUID memory_budget = -1);
+    bool GetImageFingerprint(const char *path, int64_t size, uint64_t mtime, char *fingerprint);
+    void ScanAdrenalineIsoGames(sqlite3 *db, bool incremental = false);
     void PopulateEbootGameInfo(Game *game, std::string rom, int game_index);
-    void ScanAdrenalineEbootGames(sqlite3 *db);
+    void ScanAdrenalineEbootGames(sqlite3 *db, bool incremental = false);
+    void ScanAllGames(sqlite3 *db, bool incremental = false);
     void ScanScummVMGames(sqlite3 *db);
     bool Launch(Game *game, BootSettings *settings = nullptr, char* retro_core = nullptr);
     void LoadGamesCache(sqlite3 *db);
@@ -212,8 +335,9 @@ namespace GAME {
     int IncrementPage(int page, int num_of_pages);
     int DecrementPage(int page, int num_of_pages);
     void StartLoadImagesThread(int category, int prev_page_num, int page, int games_per_page);
-    int ScanGamesThread(SceSize args, void *argp);
-    void StartScanGamesThread();
+    int ScanGamesThread(SceSize args, ScanAllGamesParams *params);
+    void StartScanGamesThread(bool rescan = false, bool rebuild = false);
+    void CancelScan();
     void DeleteGamesImages(GameCategory *category);
     int DeleteGamesImagesThread(SceSize args, DeleteImagesParams *params);
     void StartDeleteGameImagesThread(GameCategory *category);
@@ -222,20 +346,40 @@ namespace GAME {
     int FindGamePosition(GameCategory *category, Game *game);
     int RemoveGameFromCategory(GameCategory *category, Game *game);
     int RemoveGameFromFolder(Folder *folder, Game *game);
+    // the batch versions find the games by key and compact each folder once
+    int RemoveGamesFromCategory(GameCategory *category, std::vector<Game> &games);
+    int MoveGamesToFolder(GameCategory *category, std::vector<Game> &games, Folder *folder);
+    void IndexGame(GameCategory *category, Folder *folder, int position);
+    void InvalidateGameIndex(GameCategory *category);
+    // the categories lock is held while handles are made and resolved
+    GameHandle GetGameHandle(GameCategory *category, Game *game);
+    GameHandle GetFolderHandle(GameCategory *category, Folder *folder);
+    Game* GetGame(GameHandle handle);
+    Folder* GetFolder(GameHandle handle);
+    void ResetGameHandles();
     void SortGames(GameCategory *category);
     void SortGames(Folder *folder);
+    // adds a copy of game where it sorts in folder and returns its position
+    int InsertGame(GameCategory *category, Folder *folder, const Game &game);
+    void SetSortOrder(GameCategory *category, int sort_order);
     void RefreshGames(bool all_categories);
-    const char* GetGameCategory(const char *id);
+    void RebuildGames();
+    int GetGameCategory(const char *id);
     GameCategory* GetRomCategoryByName(const char* category_name);
     bool IsRomCategory(int categoryId);
-    bool IsRomExtension(std::string str, std::vector<std::string> &file_filters);
-    std::string str_tolower(std::string s);
+    bool IsRomExtension(const std::string &rom, const ExtensionMatcher *matcher);
+    void CompileExtensionMatchers();
+    void GetCategoriesByExtension(const std::string &rom, std::vector<GameCategory*> &categories);
     void StartScanGamesCategoryThread(GameCategory *category);
+    void RemoveGamesFromCategoryByType(sqlite3 *db, GameCategory *category, int rom_type);
     int ScanGamesCategoryThread(SceSize args, ScanGamesParams *params);
     bool IsMatchPrefixes(const char* id, std::vector<std::string> &prefixes);
     int IncrementCategory(int id, int num_of_ids);
     int DecrementCategory(int id, int num_of_ids);
     void DownloadThumbnail(sqlite3 *database, Game *game);
+    void GetThumbnailTitles(GameCategory *category, Folder *folder, std::vector<ThumbnailTitle> &titles);
+    void ResolveThumbnails(sqlite3 *database, GameCategory *category, std::vector<ThumbnailTitle> &titles,
+        std::vector<ThumbnailDownload> &downloads, std::vector<GameHandle> &found, ThumbnailReport *report);
     void DownloadThumbnails(GameCategory *category);
     void StartDownloadThumbnailsThread(GameCategory *category);
     void FindGamesByPartialName(std::vector<GameCategory*> &categories, char* search_text, std::vector<Game> &games);
@@ -248,6 +392,12 @@ namespace GAME {
     int RemoveFolderFromCategory(GameCategory *category, int folder_id);
     void ClearSelection(GameCategory *category);
     std::vector<Game> GetSelectedGames(GameCategory *category);
+    Game* FindGameByRomPath(const char* rom_path, int type, GameCategory *category = nullptr, const char *id = nullptr);
+    int CheckFileManifest(std::map<std::string, FileManifestEntry> &manifest, const FileInfo &file, FileManifestEntry *entry);
+    void RemoveMissingGame(sqlite3 *db, const char* rom_path, int type, const char *id = nullptr);
+    int GetNextTitleIdIndex(sqlite3 *db, int type);
+    int GetNextImageIndex(sqlite3 *db, int type);
+    void SaveImageMetadata(Game *game);
     static int LoadScePaf();
     static int UnloadScePaf();
 }
@@ -32,15 +32,25 @@ namespace GUI {
 			
 			if (gui_mode == GUI_MODE_SCAN)
 			{
+				GAME::LockCategories();
 				Windows::GameScanWindow();
+				GAME::UnlockCategories();
 			}
 			else if (gui_mode == GUI_MODE_LAUNCHER)
 			{
+				GAME::LockCategories();
+				Windows::ResolveHandles();
 				Windows::HandleLauncherWindowInput();
 				Windows::LauncherWindow();
+				Windows::UpdateHandles();
+				GAME::UnlockCategories();
 			} else if (gui_mode == GUI_MODE_IME)
 			{
+				GAME::LockCategories();
+				Windows::ResolveHandles();
 				Windows::HandleImeInput();
+				Windows::UpdateHandles();
+				GAME::UnlockCategories();
 			}
 			
 			if (gui_mode < GUI_MODE_IME)
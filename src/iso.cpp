@@ -9,6 +9,7 @@ const uint32_t ISO::SECTOR_SIZE = 0x800;
 
 ISO::ISO( std::string isoPath )
 {
+	mSfoLba = mSfoSize = mIconLba = mIconSize = 0;
 	this->open( isoPath );
 }
 
@@ -57,6 +58,53 @@ bool ISO::isISO ( std::string filePath )
 	return result;
 }
 
+int ISO::sniff ( std::string filePath )
+{
+	int result = IMAGE_TYPE_UNKNOWN;
+	
+	SceUID fd = sceIoOpen(filePath.c_str(), SCE_O_RDONLY, 0777);
+	
+	if(fd >= 0)
+	{
+		unsigned char header[8];
+		
+		// CSO magic is at the start of the file
+		if(4 <= sceIoRead(fd, header, sizeof(header)))
+		{
+			unsigned char csoFlags[4] = {
+				0x43, 0x49, 0x53, 0x4F
+			};
+			
+			if( !memcmp(header, csoFlags, sizeof(csoFlags)) )
+			{
+				result = IMAGE_TYPE_CSO;
+			}
+		}
+		
+		// ISO magic is in the primary volume descriptor
+		if( result == IMAGE_TYPE_UNKNOWN )
+		{
+			sceIoLseek32(fd, 0x8000, SCE_SEEK_SET);
+			
+			if(sizeof(header) == sceIoRead(fd, header, sizeof(header)))
+			{
+				unsigned char isoFlags[8] = {
+					0x01, 0x43, 0x44, 0x30, 0x30, 0x31, 0x01, 0x00
+				};
+				
+				if( !memcmp(header, isoFlags, sizeof(header)) )
+				{
+					result = IMAGE_TYPE_ISO;
+				}
+			}
+		}
+		
+		sceIoClose(fd);
+	}
+	
+	return result;
+}
+
 bool ISO::open( std::string path )
 {
 	mFin.open(path.c_str(),std::ios::binary);
@@ -99,16 +147,16 @@ void* ISO::read( uint32_t sector, uint32_t len )
 	return data;
 }
 
-void ISO::write( uint32_t sector, uint32_t len, std::string file_path)
+void ISO::readInto( uint32_t sector, uint32_t len, std::vector<char> &out )
 {
 	uint32_t bufSize = ((len / ISO::SECTOR_SIZE) + 1)*ISO::SECTOR_SIZE;
-	void* data = malloc(bufSize);
+	out.resize(bufSize);
 	uint32_t sizeRead = 0;
 	uint32_t curSector = sector;
 	
 	while ( sizeRead < len )
 	{
-		int ret = this->readSector((char*)((uint32_t)data+sizeRead), curSector );
+		int ret = this->readSector(out.data()+sizeRead, curSector );
 		
 		if ( ret < 0 )	break;
 		else
@@ -118,11 +166,7 @@ void ISO::write( uint32_t sector, uint32_t len, std::string file_path)
 		}
 	}
 	
-	SceUID fd = sceIoOpen(file_path.c_str(), SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
-	int write = sceIoWrite(fd, data, bufSize);
-	sceIoClose(fd);
-
-	free(data);
+	out.resize(len);
 }
 
 void ISO::processPathTable( PathTableRecord* pathTable, uint32_t pathTableSize )
@@ -204,8 +248,11 @@ void* ISO::getFile( DirectoryRecord* fileRecord )
 	return this->read( fileRecord->lba.LE, fileRecord->fileSize.LE );
 }
 
-void ISO::Extract(std::string sfo_path ,std::string icon_path)
+bool ISO::FindGameFiles( uint32_t *sfoSize, uint32_t *iconSize )
 {
+	bool found = false;
+	mSfoSize = mIconSize = 0;
+
 	if ( mFin.is_open() )
 	{
 		char *sectorBuf = (char*)malloc( ISO::SECTOR_SIZE );
@@ -230,8 +277,17 @@ void ISO::Extract(std::string sfo_path ,std::string icon_path)
 				DirectoryRecord* icon0 = findFile( "ICON0.PNG", dir );
 				DirectoryRecord* sfo = findFile( "PARAM.SFO", dir );
 
-				this->write(icon0->lba.LE, icon0->fileSize.LE, icon_path);
-				this->write(sfo->lba.LE, sfo->fileSize.LE, sfo_path);
+				if ( icon0 != NULL )
+				{
+					mIconLba = icon0->lba.LE;
+					mIconSize = icon0->fileSize.LE;
+				}
+				if ( sfo != NULL )
+				{
+					mSfoLba = sfo->lba.LE;
+					mSfoSize = sfo->fileSize.LE;
+				}
+				found = true;
 			}
 			
 			free(pathTableBuf);
@@ -239,6 +295,21 @@ void ISO::Extract(std::string sfo_path ,std::string icon_path)
 		}
 		
 		free(sectorBuf);
+	}
+
+	if ( mSfoSize > ISO_MAX_SFO_SIZE )	mSfoSize = 0;
+	if ( mIconSize > ISO_MAX_ICON_SIZE )	mIconSize = 0;
+	*sfoSize = mSfoSize;
+	*iconSize = mIconSize;
+	return found;
+}
+
+void ISO::ReadGameFiles( std::vector<char> &sfo, std::vector<char> &icon )
+{
+	if ( mFin.is_open() )
+	{
+		if ( mSfoSize > 0 )	this->readInto(mSfoLba, mSfoSize, sfo);
+		if ( mIconSize > 0 )	this->readInto(mIconLba, mIconSize, icon);
 		
 		this->close();
 	}
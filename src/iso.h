@@ -8,6 +8,14 @@
 #include <fstream>
 #include "iso9660.h"
 
+#define IMAGE_TYPE_UNKNOWN 0
+#define IMAGE_TYPE_ISO 1
+#define IMAGE_TYPE_CSO 2
+
+// larger PARAM.SFO or ICON0.PNG records are treated as missing, a corrupt image can't make the scan allocate more
+#define ISO_MAX_SFO_SIZE 0x10000
+#define ISO_MAX_ICON_SIZE 0x80000
+
 class ISO
 {
 
@@ -17,11 +25,15 @@ private:
 protected:
 	std::ifstream mFin;
 	std::vector<PathTableRecord*> mPathTable;
+	uint32_t mSfoLba;
+	uint32_t mSfoSize;
+	uint32_t mIconLba;
+	uint32_t mIconSize;
 	
 	virtual bool open( std::string path );
 	virtual int readSector( char *destBuf, unsigned sector );
 	void* read( uint32_t sector, uint32_t len );
-	void write( uint32_t sector, uint32_t len, std::string file_path);
+	void readInto( uint32_t sector, uint32_t len, std::vector<char> &out );
 	virtual void close();
 	
 	void processPathTable( PathTableRecord* pathTable, uint32_t pathTableSize );
@@ -40,9 +52,14 @@ public:
 	ISO( std::string isoPath );
 	virtual ~ISO();
 	
-	void Extract(std::string sfo_path ,std::string icon_path);
+	// Locates PARAM.SFO and ICON0.PNG in PSP_GAME, a missing or oversized file gets a size of 0
+	bool FindGameFiles( uint32_t *sfoSize, uint32_t *iconSize );
+	// Reads the files located by FindGameFiles and closes the image
+	void ReadGameFiles( std::vector<char> &sfo, std::vector<char> &icon );
 
 	static bool isISO ( std::string filePath );
+	// Checks the ISO and CSO magic with a single open
+	static int sniff ( std::string filePath );
 };
 
 
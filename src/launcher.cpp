@@ -10,6 +10,7 @@
 #include "config.h"
 #include "ime_dialog.h"
 #include "gui.h"
+#include "scanner.h"
 //#include "debugnet.h"
 extern "C" {
 	#include "inifile.h"
@@ -17,13 +18,18 @@ extern "C" {
 
 typedef struct
 {
-    char category[10];
+    int category;
     char name[32];
     bool selected = false;
 } CategorySelection;
 
 Game *selected_game;
 Game *game_to_boot;
+// selected_game and game_to_boot between frames, the games can move while the ui waits for the lock
+static GameHandle selected_game_handle;
+static GameHandle game_to_boot_handle;
+static Game *resolved_selected_game = nullptr;
+static Game *resolved_game_to_boot = nullptr;
 static SceCtrlData pad_prev;
 bool paused = false;
 int view_mode;
@@ -43,8 +49,11 @@ static ime_callback_t ime_before_update = nullptr;
 static std::vector<std::string> retro_cores;
 static char txt_search_text[32];
 static std::vector<Game> games_selection;
+// points into games_selection, both are cleared when the search opens as a rescan frees their strings
+static Game *search_selected_game = nullptr;
 static BootSettings settings;
 static char retro_core[128];
+static char game_title[128];
 static int move_location = 0;
 static Folder temp_folder;
 static std::vector<CategorySelection> categories_selection;
@@ -111,8 +120,7 @@ namespace Windows {
                         game.tex = no_icon;
                         game.visible = false;
                         game.thread_started = false;
-                        game_categories[FAVORITES].current_folder->games.push_back(game);
-                        GAME::SortGames(&game_categories[FAVORITES]);
+                        GAME::InsertGame(&game_categories[FAVORITES], game_categories[FAVORITES].current_folder, game);
                         GAME::SetMaxPage(&game_categories[FAVORITES]);
                         selected_game->favorite = true;
                         DB::InsertFavorite(nullptr, selected_game);
@@ -126,15 +134,7 @@ namespace Windows {
                 }
                 else
                 {
-                    Game* game = nullptr;
-                    for (int i=1; i<TOTAL_CATEGORY; i++)
-                    {
-                        game = GAME::FindGame(&game_categories[i], selected_game);
-                        if (game != nullptr)
-                        {
-                            break;
-                        }
-                    }
+                    Game* game = GAME::FindGame(&game_categories[selected_game->category], selected_game);
                     if (game != nullptr)
                     {
                         game->favorite = false;
@@ -152,12 +152,10 @@ namespace Windows {
         {
             GameCategory *next_category = current_category;
             next_category = &game_categories[GAME::DecrementCategory(next_category->id, 1)];
-            if (!show_all_categories)
+            while (next_category->scan_pending ||
+                   (!show_all_categories && next_category->current_folder->games.size() == 0))
             {
-                while (next_category->current_folder->games.size() == 0)
-                {
-                    next_category = &game_categories[GAME::DecrementCategory(next_category->id, 1)];
-                }
+                next_category = &game_categories[GAME::DecrementCategory(next_category->id, 1)];
             }
             category_selected = next_category->id;
         } else if ((pad_prev.buttons & SCE_CTRL_R1) &&
@@ -165,12 +163,10 @@ namespace Windows {
         {
             GameCategory *next_category = current_category;
             next_category = &game_categories[GAME::IncrementCategory(next_category->id, 1)];
-            if (!show_all_categories)
+            while (next_category->scan_pending ||
+                   (!show_all_categories && next_category->current_folder->games.size() == 0))
             {
-                while (next_category->current_folder->games.size() == 0)
-                {
-                    next_category = &game_categories[GAME::IncrementCategory(next_category->id, 1)];
-                }
+                next_category = &game_categories[GAME::IncrementCategory(next_category->id, 1)];
             }
             category_selected = next_category->id;
         }
@@ -226,6 +222,8 @@ namespace Windows {
         if ((pad_prev.buttons & SCE_CTRL_START) && !(pad.buttons & SCE_CTRL_START) && !paused)
         {
             handle_search_game = true;
+            games_selection.clear();
+            search_selected_game = nullptr;
             search_count++;
         }
 
@@ -255,10 +253,57 @@ namespace Windows {
             DB::DeleteGame(cache_db, game);
             DB::DeleteFavorite(cache_db, game);
         }
-        GAME::RemoveGameFromCategory(categoryMap[game->category], game);
+        GAME::RemoveGameFromCategory(&game_categories[game->category], game);
         GAME::RemoveGameFromCategory(&game_categories[FAVORITES], game);
     }
 
+    // one transaction on each database and one pass over every category the games are in
+    void DeleteGamesFromCache(std::vector<Game> &games)
+    {
+        uint64_t start_time = sceKernelGetProcessTimeWide();
+        sqlite3 *cache_db = DB::Acquire(CACHE_DB_FILE);
+        sqlite3 *vita_db = DB::Acquire(VITA_APP_DB_FILE);
+        sqlite3_exec(cache_db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+        sqlite3_exec(vita_db, "BEGIN", NULL, NULL, NULL);
+        std::vector<bool> categories(TOTAL_CATEGORY, false);
+        categories[FAVORITES] = true;
+        for (int i=0; i<games.size(); i++)
+        {
+            Game *game = &games[i];
+            if (game->type == TYPE_BUBBLE)
+            {
+                hidden_title_ids.push_back(game->id);
+                DB::DeleteVitaAppFolderById(vita_db, game->id);
+            }
+            else
+            {
+                DB::DeleteGame(cache_db, game);
+                DB::DeleteFavorite(cache_db, game);
+            }
+            categories[game->category] = true;
+        }
+        sqlite3_exec(cache_db, "COMMIT", NULL, NULL, NULL);
+        sqlite3_exec(vita_db, "COMMIT", NULL, NULL, NULL);
+        DB::Release(cache_db);
+        DB::Release(vita_db);
+        uint64_t db_time = sceKernelGetProcessTimeWide() - start_time;
+
+        start_time = sceKernelGetProcessTimeWide();
+        int removed = 0;
+        for (int i=0; i<TOTAL_CATEGORY; i++)
+        {
+            if (categories[i])
+            {
+                removed += GAME::RemoveGamesFromCategory(&game_categories[i], games);
+            }
+        }
+
+        char line[128];
+        snprintf(line, 128, "delete_games games=%d removed=%d db_us=%llu memory_us=%llu\n", games.size(), removed,
+            db_time, sceKernelGetProcessTimeWide() - start_time);
+        FS::AppendText(SCAN_STATS_LOG_FILE, line);
+    }
+
     void LauncherWindow() {
         Windows::SetupWindow();
         ImGuiIO& io = ImGui::GetIO(); (void)io;
@@ -308,7 +353,7 @@ namespace Windows {
         else
         {
             char id[32];
-            sprintf(id, "../#%d%s", 0, current_category->category);
+            sprintf(id, "../#%d%d", 0, current_category->id);
             if (ImGui::Selectable(id, false, ImGuiSelectableFlags_DontClosePopups, ImVec2(14, 0)))
             {
                 if (selection_mode)
@@ -345,11 +390,11 @@ namespace Windows {
         {
             if (selected_game->type == TYPE_BUBBLE)
             {
-                sprintf(title_text, "%s - %s", selected_game->id, selected_game->title);
+                snprintf(title_text, sizeof(title_text), "%s - %s", selected_game->id, selected_game->title);
             }
             else
             {
-                sprintf(title_text, "%s", selected_game->title);
+                snprintf(title_text, sizeof(title_text), "%s", selected_game->title);
             }
         }
         else
@@ -405,7 +450,7 @@ namespace Windows {
                         {
                             if (!selection_mode)
                             {
-                                GameCategory *cat = categoryMap[game->category];
+                                GameCategory *cat = &game_categories[game->category];
                                 GAME::StartDeleteGameImagesThread(cat);
                                 Folder *folder = GAME::FindFolder(cat, game->folder_id);
                                 cat->current_folder = folder;
@@ -423,7 +468,7 @@ namespace Windows {
                         }
                         else if (game->type == TYPE_ROM)
                         {
-                            GameCategory *cat = categoryMap[game->category];
+                            GameCategory *cat = &game_categories[game->category];
                             if (cat->alt_cores.size() == 0 || !cat->boot_with_alt_core)
                             {
                                 GAME::Launch(game);
@@ -537,7 +582,7 @@ namespace Windows {
                 {
                     if (!selection_mode)
                     {
-                        GameCategory *cat = categoryMap[game->category];
+                        GameCategory *cat = &game_categories[game->category];
                         GAME::StartDeleteGameImagesThread(cat);
                         Folder *folder = GAME::FindFolder(cat, game->folder_id);
                         cat->current_folder = folder;
@@ -554,7 +599,7 @@ namespace Windows {
                 }
                 else if (game->type == TYPE_ROM)
                 {
-                    GameCategory *cat = categoryMap[game->category];
+                    GameCategory *cat = &game_categories[game->category];
                     if (cat->alt_cores.size() == 0 || !cat->boot_with_alt_core)
                     {
                         GAME::Launch(game);
@@ -728,7 +773,7 @@ namespace Windows {
                 {
                     if (!selection_mode)
                     {
-                        GameCategory *cat = categoryMap[game->category];
+                        GameCategory *cat = &game_categories[game->category];
                         Folder *folder = GAME::FindFolder(cat, game->folder_id);
                         cat->current_folder = folder;
                         selected_game = nullptr;
@@ -744,7 +789,7 @@ namespace Windows {
                 }
                 else if (game->type == TYPE_ROM)
                 {
-                    GameCategory *cat = categoryMap[game->category];
+                    GameCategory *cat = &game_categories[game->category];
                     if (cat->alt_cores.size() == 0 || !cat->boot_with_alt_core)
                     {
                         GAME::Launch(game);
@@ -890,7 +935,7 @@ namespace Windows {
         {
             for (int i=0; i<TOTAL_CATEGORY; i++)
             {
-                if (game_categories[i].folders[0].games.size() > 0 || show_all_categories)
+                if (!game_categories[i].scan_pending && (game_categories[i].folders[0].games.size() > 0 || show_all_categories))
                 {
                     // Add some padding for title so tabs are consistent width
                     std::string title = std::string(game_categories[i].alt_title);
@@ -959,6 +1004,8 @@ namespace Windows {
         if (ImGui::BeginPopupModal("Settings and Actions", NULL, ImGuiWindowFlags_AlwaysAutoResize))
         {
             static bool refresh_current_category = false;
+            static bool refresh_all_categories = false;
+            static bool rebuild_cache = false;
             static bool remove_from_cache = false;
             static bool add_rom_game = false;
             static bool move_game = false;
@@ -969,6 +1016,12 @@ namespace Windows {
             static bool uninstall_game = false;
             static bool add_folder = false;
             static bool edit_folder = false;
+            static int sort_order = SORT_ORDER_TITLE;
+            if (ImGui::IsWindowAppearing())
+            {
+                sort_order = current_category->sort_order;
+            }
+            bool refreshing = refresh_current_category || refresh_all_categories || rebuild_cache;
 
             float posX = ImGui::GetCursorPosX();
 
@@ -980,7 +1033,7 @@ namespace Windows {
                     {
                         if (current_category->id != FAVORITES)
                         {
-                            if (!add_rom_game && !refresh_current_category && !remove_from_cache && current_category->current_folder->id == FOLDER_ROOT_ID && !selection_mode
+                            if (!add_rom_game && !refreshing && !remove_from_cache && current_category->current_folder->id == FOLDER_ROOT_ID && !selection_mode
                                 && !move_game && !add_eboot_game && !add_psp_iso_game && !download_thumbnails && !uninstall_game && !rename_game && !edit_folder)
                             {
                                 ImGui::Checkbox("Add new folder", &add_folder);
@@ -990,14 +1043,14 @@ namespace Windows {
                         
                         if (selected_game != nullptr && current_category->id != FAVORITES)
                         {
-                            if (!add_rom_game && !refresh_current_category && !remove_from_cache && selected_game->type == TYPE_FOLDER && !selection_mode
+                            if (!add_rom_game && !refreshing && !remove_from_cache && selected_game->type == TYPE_FOLDER && !selection_mode
                                 && !move_game && !add_eboot_game && !add_psp_iso_game && !download_thumbnails && !uninstall_game && !rename_game && !add_folder)
                             {
                                 ImGui::Checkbox("Edit/Delete folder", &edit_folder);
                                 ImGui::Separator();
                             }
 
-                            if (!add_rom_game && !refresh_current_category && !remove_from_cache && !selection_mode &&
+                            if (!add_rom_game && !refreshing && !remove_from_cache && !selection_mode &&
                                 !move_game && !add_eboot_game && !add_psp_iso_game && selected_game->type != TYPE_BUBBLE && selected_game->type != TYPE_FOLDER
                                 && !download_thumbnails && !uninstall_game && !add_folder && !edit_folder)
                             {
@@ -1005,21 +1058,21 @@ namespace Windows {
                                 ImGui::Separator();
                             }
 
-                            if (!add_rom_game && !refresh_current_category && !remove_from_cache && !edit_folder && selected_game->type != TYPE_FOLDER &&
+                            if (!add_rom_game && !refreshing && !remove_from_cache && !edit_folder && selected_game->type != TYPE_FOLDER &&
                                 !rename_game && !add_eboot_game && !add_psp_iso_game && !download_thumbnails && !uninstall_game && !add_folder)
                             {
                                 ImGui::Checkbox("Move selected game", &move_game);
                                 ImGui::Separator();
                             }
 
-                            if (!add_rom_game && !refresh_current_category && !move_game && !rename_game && !edit_folder && selected_game->type != TYPE_FOLDER &&
+                            if (!add_rom_game && !refreshing && !move_game && !rename_game && !edit_folder && selected_game->type != TYPE_FOLDER &&
                                 !add_eboot_game && !add_psp_iso_game && !download_thumbnails && !uninstall_game && !add_folder)
                             {
                                 ImGui::Checkbox("Hide selected game", &remove_from_cache);
                                 ImGui::Separator();
                             }
 
-                            if (!add_rom_game && !refresh_current_category && !move_game && !rename_game && !selection_mode &&
+                            if (!add_rom_game && !refreshing && !move_game && !rename_game && !selection_mode &&
                                 !add_eboot_game && !add_psp_iso_game && !download_thumbnails && !remove_from_cache && !edit_folder &&
                                 selected_game->type == TYPE_BUBBLE && !add_folder)
                             {
@@ -1030,7 +1083,7 @@ namespace Windows {
 
                         if (current_category->rom_type == TYPE_PSP_ISO)
                         {
-                            if (!remove_from_cache && !refresh_current_category && !move_game && !add_folder && !selection_mode &&
+                            if (!remove_from_cache && !refreshing && !move_game && !add_folder && !selection_mode &&
                                 !add_eboot_game && !add_rom_game && !rename_game && !download_thumbnails && !uninstall_game && !edit_folder)
                             {
                                 ImGui::Checkbox("Add new PSP ISO game", &add_psp_iso_game);
@@ -1040,7 +1093,7 @@ namespace Windows {
 
                         if (current_category->rom_type == TYPE_EBOOT)
                         {
-                            if (!remove_from_cache && !refresh_current_category && !move_game && !add_folder && !selection_mode &&
+                            if (!remove_from_cache && !refreshing && !move_game && !add_folder && !selection_mode &&
                                 !add_psp_iso_game && !add_rom_game && !rename_game && !download_thumbnails && !uninstall_game && !edit_folder)
                             {
                                 ImGui::Checkbox("Add new EBOOT game", &add_eboot_game);
@@ -1050,7 +1103,7 @@ namespace Windows {
 
                         if (current_category->rom_type == TYPE_ROM || current_category->id == PS1_GAMES)
                         {
-                            if (!remove_from_cache && !refresh_current_category && !move_game && !add_folder && !selection_mode &&
+                            if (!remove_from_cache && !refreshing && !move_game && !add_folder && !selection_mode &&
                                 !add_eboot_game && !add_psp_iso_game && !rename_game && !download_thumbnails && !uninstall_game && !edit_folder)
                             {
                                 if (current_category->id == PS1_GAMES)
@@ -1068,7 +1121,8 @@ namespace Windows {
                         if (current_category->rom_type != TYPE_BUBBLE)
                         {
                             if (!remove_from_cache && !add_rom_game && !move_game && !rename_game && !edit_folder && !selection_mode &&
-                                !add_eboot_game && !add_psp_iso_game && !download_thumbnails && !uninstall_game && !add_folder)
+                                !add_eboot_game && !add_psp_iso_game && !download_thumbnails && !uninstall_game && !add_folder &&
+                                !refresh_all_categories && !rebuild_cache)
                             {
                                 char cb_text[64];
                                 sprintf(cb_text, "Rescan games in %s category only", current_category->title);
@@ -1076,11 +1130,27 @@ namespace Windows {
                                 ImGui::Separator();
                             }
                         }
+
+                        if (!remove_from_cache && !add_rom_game && !move_game && !rename_game && !edit_folder && !selection_mode &&
+                            !add_eboot_game && !add_psp_iso_game && !download_thumbnails && !uninstall_game && !add_folder &&
+                            !refresh_current_category)
+                        {
+                            if (!rebuild_cache)
+                            {
+                                ImGui::Checkbox("Rescan games in all categories", &refresh_all_categories);
+                                ImGui::Separator();
+                            }
+                            if (!refresh_all_categories)
+                            {
+                                ImGui::Checkbox("Rebuild game cache, clears folders and favorites", &rebuild_cache);
+                                ImGui::Separator();
+                            }
+                        }
                         
                         if (current_category->rom_type == TYPE_ROM || current_category->id == PS1_GAMES
                             || current_category->rom_type == TYPE_SCUMMVM)
                         {
-                            if (!remove_from_cache && !refresh_current_category && !move_game && !add_folder && !selection_mode &&
+                            if (!remove_from_cache && !refreshing && !move_game && !add_folder && !selection_mode &&
                                 !add_eboot_game && !add_psp_iso_game && !rename_game && !add_rom_game && !uninstall_game && !edit_folder)
                             {
                                 char cb_text[64];
@@ -1127,6 +1197,15 @@ namespace Windows {
                     ImGui::RadioButton("3", &grid_rows, 3);
                     ImGui::Separator();
 
+                    if (current_category->id == FAVORITES)
+                    {
+                        ImGui::Text("Sort By:"); ImGui::SameLine();
+                        ImGui::SetCursorPosX(posX + 100);
+                        ImGui::RadioButton("Title", &sort_order, SORT_ORDER_TITLE); ImGui::SameLine();
+                        ImGui::RadioButton("Platform", &sort_order, SORT_ORDER_PLATFORM);
+                        ImGui::Separator();
+                    }
+
                     if (current_category->id != FAVORITES && current_category->id != HOMEBREWS)
                     {
                         ImGui::Text("Bubble Titles:  "); ImGui::SameLine();
@@ -1472,17 +1551,8 @@ namespace Windows {
                     }
                     else
                     {
-                        sqlite3 *cache_db, *vita_db;
-                        sqlite3_open(CACHE_DB_FILE, &cache_db);
-                        sqlite3_open(VITA_APP_DB_FILE, &cache_db);
-
                         std::vector<Game> list = GAME::GetSelectedGames(current_category);
-                        for (int i=0; i<list.size(); i++)
-                        {
-                            DeleteGameFromCache(cache_db, vita_db, &list[i]);
-                        }
-                        sqlite3_close(cache_db);
-                        sqlite3_close(vita_db);
+                        DeleteGamesFromCache(list);
                     }
                     GAME::SetMaxPage(current_category);
                     selection_mode = false;
@@ -1520,6 +1590,14 @@ namespace Windows {
                     current_category->thumbnail_size = ImVec2(138,127);
                     current_category->games_per_page = current_category->rows * current_category->columns;
                 }
+                if (sort_order != current_category->sort_order)
+                {
+                    GAME::SetSortOrder(current_category, sort_order);
+                    if (current_category->view_mode == VIEW_MODE_GRID)
+                    {
+                        GAME::StartLoadImagesThread(current_category->id, current_category->current_folder->page_num, current_category->current_folder->page_num, current_category->games_per_page);
+                    }
+                }
                 GAME::SetMaxPage(current_category);
                 CONFIG::SaveCategoryConfig(current_category);
 
@@ -1535,6 +1613,16 @@ namespace Windows {
                     GAME::RefreshGames(false);
                 }
 
+                if (refresh_all_categories)
+                {
+                    GAME::RefreshGames(true);
+                }
+
+                if (rebuild_cache)
+                {
+                    GAME::RebuildGames();
+                }
+
                 if (download_thumbnails)
                 {
                     GAME::DownloadThumbnails(current_category);
@@ -1548,7 +1636,8 @@ namespace Windows {
 
                 if (rename_game && selected_game != nullptr)
                 {
-                    ime_single_field = selected_game->title;
+                    strlcpy(game_title, selected_game->title, sizeof(game_title));
+                    ime_single_field = game_title;
                     ime_before_update = nullptr;
                     ime_after_update = AfterGameTitleChangeCallback;
                     ime_callback = SingleValueImeCallback;
@@ -1576,7 +1665,7 @@ namespace Windows {
                     for (int i=1; i<TOTAL_CATEGORY; i++)
                     {
                         CategorySelection cat;
-                        sprintf(cat.category, "%s", game_categories[i].category);
+                        cat.category = i;
                         sprintf(cat.name, "%s", game_categories[i].alt_title);
                         if (current_category->id == game_categories[i].id)
                         {
@@ -1595,7 +1684,7 @@ namespace Windows {
                 if (edit_folder)
                 {
                     Folder *folder = GAME::FindFolder(current_category, selected_game->folder_id);
-                    sprintf(temp_folder.category, folder->category);
+                    temp_folder.category = folder->category;
                     sprintf(temp_folder.title, folder->title);
                     sprintf(temp_folder.icon_path, folder->icon_path);
                     temp_folder.id = folder->id;
@@ -1606,6 +1695,8 @@ namespace Windows {
                 move_game = false;
                 remove_from_cache = false;
                 refresh_current_category = false;
+                refresh_all_categories = false;
+                rebuild_cache = false;
                 add_psp_iso_game = false;
                 add_eboot_game = false;
                 add_rom_game = false;
@@ -1624,7 +1715,7 @@ namespace Windows {
     void HandleAdrenalineGame()
     {
         paused = true;
-        GameCategory *category = categoryMap[game_to_boot->category];
+        GameCategory *category = &game_categories[game_to_boot->category];
         char popup_title[64];
         sprintf(popup_title, "Boot %s Game", category->alt_title);
         ImGui::OpenPopup(popup_title);
@@ -1774,7 +1865,7 @@ namespace Windows {
     void HandleBootRomGame()
     {
         paused = true;
-        GameCategory *cat = categoryMap[game_to_boot->category];
+        GameCategory *cat = &game_categories[game_to_boot->category];
 
         if (retro_cores.size() == 0)
         {
@@ -1843,20 +1934,10 @@ namespace Windows {
             {
                 if (games_on_filesystem.size() == 0)
                 {
-                    games_on_filesystem = FS::ListFiles(current_category->roms_path);
-                    for (std::vector<std::string>::iterator it=games_on_filesystem.begin(); 
-                        it!=games_on_filesystem.end(); )
-                    {
-                        int index = it->find_last_of(".");
-                        if (index == std::string::npos || !GAME::IsRomExtension(it->substr(index), current_category->file_filters))
-                        {
-                            it = games_on_filesystem.erase(it);
-                        }
-                        else
-                        {
-                            ++it;
-                        }
-                    }
+                    FS::Walk(current_category->roms_path, FS::FilesWithExtensions(&current_category->rom_extensions), [](const FileInfo &file) {
+                        games_on_filesystem.push_back(file.path);
+                        return true;
+                    });
                     std::sort(games_on_filesystem.begin(), games_on_filesystem.end());
                 }
                 ImGui::SetNextWindowSizeConstraints(ImVec2(0, 0), ImVec2(620,260));
@@ -1870,35 +1951,28 @@ namespace Windows {
                 {
                     if (ImGui::Selectable(games_on_filesystem[i].c_str()))
                     {
-                        if (strlen(current_category->roms_path) + games_on_filesystem[i].length() + 1 < 192)
+                        if (strlen(current_category->roms_path) + games_on_filesystem[i].length() + 1 < ROM_PATH_MAX)
                         {
-                            sprintf(game.id, "%s", current_category->title);
+                            game = Game();
+                            game.id = current_category->title;
                             game.type = TYPE_ROM;
-                            sprintf(game.category, "%s", current_category->category);
-                            sprintf(game.rom_path, "%s/%s", current_category->roms_path, games_on_filesystem[i].c_str());
-                            int dot_index = games_on_filesystem[i].find_last_of(".");
-                            int slash_index = games_on_filesystem[i].find_last_of("/");
-                            if (slash_index != std::string::npos)
-                            {
-                                strlcpy(game.title, games_on_filesystem[i].substr(slash_index+1, dot_index-slash_index-1).c_str(), 128);
-                            }
-                            else
-                            {
-                                strlcpy(game.title, games_on_filesystem[i].substr(0, dot_index).c_str(), 128);
-                            }
+                            game.category = current_category->id;
+                            game.rom_path = ARENA::Format("%s/%s", current_category->roms_path, games_on_filesystem[i].c_str());
+                            char title[128];
+                            GAME::GetRomTitle(games_on_filesystem[i], title);
                             if (current_category->id == MAME_2000_GAMES || current_category->id == MAME_2003_GAMES || current_category->id == NEOGEO_GAMES)
                             {
-                                DB::GetMameRomName(nullptr, game.title, game.title);
+                                DB::GetMameRomName(nullptr, title, title);
                             }
+                            game.title = ARENA::Copy(title);
                             game.tex = no_icon;
 
                             sprintf(game_action_message, "The game already exists in the cache.");
                             if (!DB::GameExists(nullptr, &game))
                             {
-                                current_category->current_folder->games.push_back(game);
+                                GAME::InsertGame(current_category, current_category->current_folder, game);
                                 DB::InsertGame(nullptr, &game);
                                 GAME::DownloadThumbnail(nullptr, &game);
-                                GAME::SortGames(current_category);
                                 GAME::SetMaxPage(current_category);
                                 sprintf(game_action_message, "The game has being added to the cache.");
                             }
@@ -1965,20 +2039,10 @@ namespace Windows {
             {
                 if (games_on_filesystem.size() == 0)
                 {
-                    games_on_filesystem = FS::ListFiles(pspemu_iso_path);
-                    for (std::vector<std::string>::iterator it=games_on_filesystem.begin(); 
-                        it!=games_on_filesystem.end(); )
-                    {
-                        int index = it->find_last_of(".");
-                        if (index == std::string::npos || !GAME::IsRomExtension(it->substr(index), psp_iso_extensions))
-                        {
-                            it = games_on_filesystem.erase(it);
-                        }
-                        else
-                        {
-                            ++it;
-                        }
-                    }
+                    FS::Walk(pspemu_iso_path, FS::FilesWithExtensions(&psp_iso_extension_matcher), [](const FileInfo &file) {
+                        games_on_filesystem.push_back(file.path);
+                        return true;
+                    });
                     std::sort(games_on_filesystem.begin(), games_on_filesystem.end());
                 }
                 ImGui::SetNextWindowSizeConstraints(ImVec2(0, 0), ImVec2(610,260));
@@ -1992,9 +2056,10 @@ namespace Windows {
                 {
                     if (ImGui::Selectable(games_on_filesystem[i].c_str()))
                     {
-                        if (strlen(pspemu_iso_path) + games_on_filesystem[i].length() + 1 < 192)
+                        if (strlen(pspemu_iso_path) + games_on_filesystem[i].length() + 1 < ROM_PATH_MAX)
                         {
-                            sprintf(game.rom_path, "%s/%s", pspemu_iso_path, games_on_filesystem[i].c_str());
+                            game = Game();
+                            game.rom_path = ARENA::Format("%s/%s", pspemu_iso_path, games_on_filesystem[i].c_str());
                             game.type = TYPE_PSP_ISO;
                             if (DB::GameExists(nullptr, &game))
                             {
@@ -2002,26 +2067,22 @@ namespace Windows {
                             }
                             else
                             {
-                                sqlite3 *db;
-                                sqlite3_open(CACHE_DB_FILE, &db);
+                                sqlite3 *db = DB::Acquire(CACHE_DB_FILE);
                                 try
                                 {
-                                    char title_id[12];
-                                    DB::GetMaxTitleIdByType(db, TYPE_PSP_ISO,title_id);
-                                    std::string str = std::string(title_id);
-                                    int game_id = std::stoi(str.substr(5))+1;
+                                    int game_id = GAME::GetNextImageIndex(db, TYPE_PSP_ISO);
                                     GAME::PopulateIsoGameInfo(&game, games_on_filesystem[i], game_id);
-                                    categoryMap[game.category]->current_folder->games.push_back(game);
+                                    GAME::InsertGame(&game_categories[game.category], game_categories[game.category].current_folder, game);
                                     DB::InsertGame(db, &game);
-                                    GAME::SortGames(categoryMap[game.category]);
-                                    GAME::SetMaxPage(categoryMap[game.category]);
+                                    GAME::SaveImageMetadata(&game);
+                                    GAME::SetMaxPage(&game_categories[game.category]);
                                     sprintf(game_action_message, "The game has being added to the cache.");
                                 }
                                 catch(const std::exception& e)
                                 {
                                     sprintf(game_action_message, "Could not add game because it could be corrupted.");
                                 }
-                                sqlite3_close(db);
+                                DB::Release(db);
                             }
                         }
                         else
@@ -2086,20 +2147,10 @@ namespace Windows {
             {
                 if (games_on_filesystem.size() == 0)
                 {
-                    games_on_filesystem = FS::ListFiles(pspemu_eboot_path);
-                    for (std::vector<std::string>::iterator it=games_on_filesystem.begin(); 
-                        it!=games_on_filesystem.end(); )
-                    {
-                        int index = it->find_last_of(".");
-                        if (index == std::string::npos || !GAME::IsRomExtension(it->substr(index), eboot_extensions))
-                        {
-                            it = games_on_filesystem.erase(it);
-                        }
-                        else
-                        {
-                            ++it;
-                        }
-                    }
+                    FS::Walk(pspemu_eboot_path, FS::FilesWithExtensions(&eboot_extension_matcher), [](const FileInfo &file) {
+                        games_on_filesystem.push_back(file.path);
+                        return true;
+                    });
                     std::sort(games_on_filesystem.begin(), games_on_filesystem.end());
                 }
                 ImGui::SetNextWindowSizeConstraints(ImVec2(0, 0), ImVec2(620,260));
@@ -2113,9 +2164,10 @@ namespace Windows {
                 {
                     if (ImGui::Selectable(games_on_filesystem[i].c_str()))
                     {
-                        if (strlen(pspemu_eboot_path) + games_on_filesystem[i].length() + 1 < 192)
+                        if (strlen(pspemu_eboot_path) + games_on_filesystem[i].length() + 1 < ROM_PATH_MAX)
                         {
-                            sprintf(game.rom_path, "%s/%s", pspemu_eboot_path, games_on_filesystem[i].c_str());
+                            game = Game();
+                            game.rom_path = ARENA::Format("%s/%s", pspemu_eboot_path, games_on_filesystem[i].c_str());
                             game.type = TYPE_EBOOT;
                             if (DB::GameExists(nullptr, &game))
                             {
@@ -2123,25 +2175,22 @@ namespace Windows {
                             }
                             else
                             {
-                                sqlite3 *db;
-                                sqlite3_open(CACHE_DB_FILE, &db);
+                                sqlite3 *db = DB::Acquire(CACHE_DB_FILE);
                                 try
                                 {
-                                    char title_id[12];
-                                    DB::GetMaxTitleIdByType(db, TYPE_EBOOT, title_id);
-                                    std::string str = std::string(title_id);
-                                    int game_id = std::stoi(str.substr(5))+1;
+                                    int game_id = GAME::GetNextImageIndex(db, TYPE_EBOOT);
                                     GAME::PopulateEbootGameInfo(&game, games_on_filesystem[i], game_id);
+                                    GAME::InsertGame(&game_categories[game.category], game_categories[game.category].current_folder, game);
                                     DB::InsertGame(db, &game);
-                                    GAME::SortGames(categoryMap[game.category]);
-                                    GAME::SetMaxPage(categoryMap[game.category]);
+                                    GAME::SaveImageMetadata(&game);
+                                    GAME::SetMaxPage(&game_categories[game.category]);
                                     sprintf(game_action_message, "The game has being added to the cache.");
                                 }
                                 catch(const std::exception& e)
                                 {
                                     sprintf(game_action_message, "Could not add game because it could be corrupted.");
                                 }
-                                sqlite3_close(db);
+                                DB::Release(db);
                             }
                         }
                         else
@@ -2194,20 +2243,19 @@ namespace Windows {
 
     void MoveGameToCategory(sqlite3 *cache_db, sqlite3 *vita_db, Game *game, GameCategory *category)
     {
-        GameCategory *current_category = categoryMap[game->category];
+        GameCategory *current_category = &game_categories[game->category];
         if (game->type > TYPE_ROM && game->type < TYPE_SCUMMVM)
         {
             Game tmp = *game;
-            sprintf(tmp.category, "%s", category->category);
+            tmp.category = category->id;
             tmp.tex = no_icon;
             tmp.visible = false;
             tmp.thread_started = false;
             tmp.folder_id = 0;
             tmp.selected = false;
-            category->folders[0].games.push_back(tmp);
+            GAME::InsertGame(category, &category->folders[0], tmp);
             DB::UpdateGame(cache_db, &tmp);
             DB::UpdateFavoritesGameCategoryByRomPath(cache_db, &tmp);
-            GAME::SortGames(category);
             GAME::SetMaxPage(category);
             GAME::RemoveGameFromCategory(current_category, game);
             GAME::SetMaxPage(current_category);
@@ -2220,7 +2268,7 @@ namespace Windows {
             WriteString(current_category->title, CONFIG_TITLE_ID_PREFIXES, CONFIG::GetMultiValueString(current_category->valid_title_ids).c_str());
             WriteIniFile(CONFIG_INI_FILE);
             CloseIniFile();
-            sprintf(game->category, "%s", category->category);
+            game->category = category->id;
             DB::UpdateFavoritesGameCategoryById(cache_db, game);
             DB::DeleteVitaAppFolderById(vita_db, game->id);
             Game tmp = *game;
@@ -2229,8 +2277,7 @@ namespace Windows {
             tmp.thread_started = false;
             tmp.folder_id = 0;
             tmp.selected = false;
-            category->folders[0].games.push_back(tmp);
-            GAME::SortGames(category);
+            GAME::InsertGame(category, &category->folders[0], tmp);
             GAME::SetMaxPage(category);
             GAME::RemoveGameFromCategory(current_category, game);
             GAME::SetMaxPage(current_category);
@@ -2239,14 +2286,13 @@ namespace Windows {
 
     void MoveGameToFolder(sqlite3 *cache_db, sqlite3 *vita_db, Game *game, Folder *folder)
     {
-        GameCategory *current_category = categoryMap[game->category];
+        GameCategory *current_category = &game_categories[game->category];
         Game tmp = *game;
         tmp.tex = no_icon;
         tmp.visible = false;
         tmp.thread_started = false;
         tmp.folder_id = folder->id;
         tmp.selected = false;
-        folder->games.push_back(tmp);
 
         if (game->type != TYPE_BUBBLE)
         {
@@ -2262,6 +2308,51 @@ namespace Windows {
         }
         
         GAME::RemoveGameFromFolder(current_category->current_folder, game);
+        GAME::InsertGame(current_category, folder, tmp);
+    }
+
+    // one transaction on each database, the games are taken out of their folders in one pass
+    void MoveGamesToFolder(std::vector<Game> &games, Folder *folder)
+    {
+        uint64_t start_time = sceKernelGetProcessTimeWide();
+        sqlite3 *cache_db = DB::Acquire(CACHE_DB_FILE);
+        sqlite3 *vita_db = DB::Acquire(VITA_APP_DB_FILE);
+        sqlite3_exec(cache_db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+        sqlite3_exec(vita_db, "BEGIN", NULL, NULL, NULL);
+        for (int i=0; i<games.size(); i++)
+        {
+            Game tmp = games[i];
+            if (tmp.type == TYPE_FOLDER)
+            {
+                continue;
+            }
+            tmp.folder_id = folder->id;
+            if (tmp.type != TYPE_BUBBLE)
+            {
+                DB::UpdateGame(cache_db, &tmp);
+            }
+            else
+            {
+                int count = DB::UpdateVitaAppFolder(vita_db, tmp.id, folder->id);
+                if (count < 1)
+                {
+                    DB::InsertVitaAppFolder(vita_db, tmp.id, folder->id);
+                }
+            }
+        }
+        sqlite3_exec(cache_db, "COMMIT", NULL, NULL, NULL);
+        sqlite3_exec(vita_db, "COMMIT", NULL, NULL, NULL);
+        DB::Release(cache_db);
+        DB::Release(vita_db);
+        uint64_t db_time = sceKernelGetProcessTimeWide() - start_time;
+
+        start_time = sceKernelGetProcessTimeWide();
+        int moved = GAME::MoveGamesToFolder(&game_categories[folder->category], games, folder);
+
+        char line[128];
+        snprintf(line, 128, "move_games games=%d moved=%d db_us=%llu memory_us=%llu\n", games.size(), moved,
+            db_time, sceKernelGetProcessTimeWide() - start_time);
+        FS::AppendText(SCAN_STATS_LOG_FILE, line);
     }
 
     void HandleMoveGame()
@@ -2306,11 +2397,12 @@ namespace Windows {
                                 }
                                 else
                                 {
-                                    sqlite3 *cache_db, *vita_db;
-                                    sqlite3_open(CACHE_DB_FILE, &cache_db);
-                                    sqlite3_open(VITA_APP_DB_FILE, &vita_db);
+                                    sqlite3 *cache_db = DB::Acquire(CACHE_DB_FILE);
+                                    sqlite3 *vita_db = DB::Acquire(VITA_APP_DB_FILE);
                                     std::vector<Game> list = GAME::GetSelectedGames(current_category);
                                     int games_not_moved = 0;
+                                    sqlite3_exec(cache_db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+                                    sqlite3_exec(vita_db, "BEGIN", NULL, NULL, NULL);
                                     for (int j=0; j<list.size(); j++)
                                     {
                                         Game *game = &list[j];
@@ -2324,8 +2416,10 @@ namespace Windows {
                                         }
                                         
                                     }
-                                    sqlite3_close(cache_db);
-                                    sqlite3_close(vita_db);
+                                    sqlite3_exec(cache_db, "COMMIT", NULL, NULL, NULL);
+                                    sqlite3_exec(vita_db, "COMMIT", NULL, NULL, NULL);
+                                    DB::Release(cache_db);
+                                    DB::Release(vita_db);
                                     if (games_not_moved == 0)
                                     {
                                         sprintf(game_action_message, "All selected games moved to %s category", game_categories[i].alt_title);
@@ -2360,26 +2454,14 @@ namespace Windows {
                                 if (!selection_mode)
                                 {
                                     MoveGameToFolder(nullptr, nullptr, selected_game, &current_category->folders[i]);
-                                    GAME::SortGames(&current_category->folders[i]);
                                     GAME::SetMaxPage(current_category);
                                     sprintf(game_action_message, "Game moved to %s folder", current_category->folders[i].title);
                                 }
                                 else
                                 {
-                                    sqlite3 *cache_db, *vita_db;
-                                    sqlite3_open(CACHE_DB_FILE, &cache_db);
-                                    sqlite3_open(VITA_APP_DB_FILE, &vita_db);
-
                                     std::vector<Game> list = GAME::GetSelectedGames(current_category);
-                                    for (int j=0; j<list.size(); j++)
-                                    {
-                                        Game *game = &list[j];
-                                        MoveGameToFolder(cache_db, vita_db, game, &current_category->folders[i]);
-                                    }
-                                    sqlite3_close(cache_db);
-                                    sqlite3_close(vita_db);
+                                    MoveGamesToFolder(list, &current_category->folders[i]);
 
-                                    GAME::SortGames(&current_category->folders[i]);
                                     GAME::SetMaxPage(current_category);
                                     sprintf(game_action_message, "Games moved to %s folder", current_category->folders[i].title);
                                     GAME::ClearSelection(current_category);
@@ -2472,15 +2554,14 @@ namespace Windows {
 
             if (ImGui::Button("OK"))
             {
-                sqlite3 *db;
-                sqlite3_open(CACHE_DB_FILE, &db);
+                sqlite3 *db = DB::Acquire(CACHE_DB_FILE);
                 for (int i=0; i<categories_selection.size(); i++)
                 {
                     if (categories_selection[i].selected)
                     {
-                        GameCategory *category = categoryMap[categories_selection[i].category];
+                        GameCategory *category = &game_categories[categories_selection[i].category];
                         Folder folder;
-                        sprintf(folder.category, "%s", categories_selection[i].category);
+                        folder.category = categories_selection[i].category;
                         sprintf(folder.title, "%s", temp_folder.title);
                         sprintf(folder.icon_path, "%s", temp_folder.icon_path);
                         DB::InsertFolder(db, &folder);
@@ -2489,19 +2570,18 @@ namespace Windows {
                         category->current_folder = GAME::FindFolder(category, current_folder_id);
 
                         Game game;
-                        sprintf(game.id, "%d", folder.id);
-                        sprintf(game.title, "%s", folder.title);
-                        sprintf(game.category, "%s", folder.category);
+                        game.id = ARENA::Format("%d", folder.id);
+                        game.title = ARENA::Copy(folder.title);
+                        game.category = folder.category;
                         game.type = TYPE_FOLDER;
                         game.folder_id = folder.id;
                         game.favorite = false;
                         game.tex = no_icon;
                         Folder *cat_folder = GAME::FindFolder(category, folder.id);
-                        category->folders[0].games.insert(category->folders[0].games.begin(), game);
-                        GAME::SortGames(&category->folders[0]);
+                        GAME::InsertGame(category, &category->folders[0], game);
                     }
                 }
-                sqlite3_close(db);
+                DB::Release(db);
                 paused = false;
                 handle_new_folder = false;
                 ImGui::CloseCurrentPopup();
@@ -2562,7 +2642,8 @@ namespace Windows {
                 {
                     if (current_category->folders[0].games[i].folder_id == folder->id)
                     {
-                        sprintf(current_category->folders[0].games[i].title, "%s", folder->title);
+                        current_category->folders[0].games[i].title = ARENA::Copy(folder->title);
+                        current_category->folders[0].games[i].sort_key = nullptr;
                         break;
                     }
                 }
@@ -2604,7 +2685,6 @@ namespace Windows {
     void HandleSearchGame()
     {
         paused = true;
-        static Game *search_selected_game = nullptr;
         SceCtrlData pad;
         sceCtrlPeekBufferNegative(0, &pad, 1);
 
@@ -2618,11 +2698,10 @@ namespace Windows {
                     game.tex = no_icon;
                     game.visible = false;
                     game.thread_started = false;
-                    game_categories[FAVORITES].current_folder->games.push_back(game);
-                    GAME::SortGames(&game_categories[FAVORITES]);
+                    GAME::InsertGame(&game_categories[FAVORITES], game_categories[FAVORITES].current_folder, game);
                     GAME::SetMaxPage(&game_categories[FAVORITES]);
                     search_selected_game->favorite = true;
-                    Game *cat_game = GAME::FindGame(categoryMap[search_selected_game->category], search_selected_game);
+                    Game *cat_game = GAME::FindGame(&game_categories[search_selected_game->category], search_selected_game);
                     cat_game->favorite = true;
                     DB::InsertFavorite(nullptr, search_selected_game);
                 }
@@ -2703,6 +2782,7 @@ namespace Windows {
                     }
                     
                     games_selection.clear();
+                    search_selected_game = nullptr;
                     GAME::FindGamesByPartialName(cats, txt_search_text, games_selection);
                 }
                 
@@ -2720,7 +2800,7 @@ namespace Windows {
                     ImGui::SameLine();
                 }
                 char title[192];
-                sprintf(title, "%s##%s%d%d", games_selection[i].title, games_selection[i].category, search_count, i);
+                snprintf(title, sizeof(title), "%s##%d %d%d", games_selection[i].title, games_selection[i].category, search_count, i);
                 if (ImGui::Selectable(title, false, ImGuiSelectableFlags_DontClosePopups | ImGuiSelectableFlags_SpanAllColumns))
                 {
                     Game *game = &games_selection[i];
@@ -2730,7 +2810,7 @@ namespace Windows {
                     }
                     else if (game->type == TYPE_ROM)
                     {
-                        GameCategory *cat = categoryMap[game->category];
+                        GameCategory *cat = &game_categories[game->category];
                         if (cat->alt_cores.size() == 0 || !cat->boot_with_alt_core)
                         {
                             GAME::Launch(game);
@@ -2756,7 +2836,7 @@ namespace Windows {
                     search_selected_game = &games_selection[i];
                 }
                 ImGui::NextColumn();
-                ImGui::Text(categoryMap[games_selection[i].category]->alt_title);
+                ImGui::Text(game_categories[games_selection[i].category].alt_title);
                 ImGui::NextColumn();
                 ImGui::Separator();
             }
@@ -2820,6 +2900,35 @@ namespace Windows {
 		}
     }
 	
+    void ResolveHandles()
+    {
+        selected_game = GAME::GetGame(selected_game_handle);
+        game_to_boot = GAME::GetGame(game_to_boot_handle);
+        if (game_to_boot == nullptr)
+        {
+            // the game went away while its boot dialog was open
+            handle_boot_game = false;
+            handle_boot_rom_game = false;
+        }
+        resolved_selected_game = selected_game;
+        resolved_game_to_boot = game_to_boot;
+    }
+
+    void UpdateHandles()
+    {
+        // a game picked during the frame is in the current category, one that was
+        // not keeps its handle as the storage may have moved under the pointer
+        if (selected_game != resolved_selected_game)
+        {
+            selected_game_handle = GAME::GetGameHandle(current_category, selected_game);
+        }
+        if (game_to_boot != resolved_game_to_boot)
+        {
+            game_to_boot_handle = game_to_boot == nullptr ? GameHandle() :
+                GAME::GetGameHandle(&game_categories[game_to_boot->category], game_to_boot);
+        }
+    }
+
     void GameScanWindow()
     {
         Windows::SetupWindow();
@@ -2828,9 +2937,15 @@ namespace Windows {
 
         if (ImGui::Begin("Game Launcher", nullptr, ImGuiWindowFlags_NoDecoration)) {
             static float progress = 0.0f;
-            if (current_category->current_folder->games.size() > 0 && games_to_scan > 0)
+            int scanned = games_scanned;
+            int to_scan = games_to_scan;
+            if (scan_workers > 0)
+            {
+                SCANNER::GetProgress(&scanned, &to_scan);
+            }
+            if (current_category->current_folder->games.size() > 0 && to_scan > 0)
             {
-                progress = (float)games_scanned / (float)games_to_scan;
+                progress = (float)scanned / (float)to_scan;
             }
             ImGui::SetCursorPos(ImVec2(210, 230));
             ImGui::Text("%s", scan_message);
@@ -2838,6 +2953,11 @@ namespace Windows {
             ImGui::ProgressBar(progress, ImVec2(530, 0));
             ImGui::SetCursorPos(ImVec2(210, 290));
             ImGui::Text("Adding %s", game_scan_inprogress.title);
+            for (int i=1; i <= scan_workers; i++)
+            {
+                ImGui::SetCursorPos(ImVec2(210, 300 + i*25));
+                ImGui::Text("%s", scan_progress[i].scan_message);
+            }
         }
         ImGui::End();
         ImGui::PopStyleVar();
@@ -2929,11 +3049,18 @@ namespace Windows {
 
     void AfterGameTitleChangeCallback(int ime_result)
     {
+        if (selected_game == nullptr)
+        {
+            return;
+        }
+        selected_game->title = ARENA::Copy(game_title);
+        selected_game->sort_key = nullptr;
         DB::UpdateGameTitle(nullptr, selected_game);
         Game* game = GAME::FindGame(&game_categories[FAVORITES], selected_game);
         if (game != nullptr)
         {
-            sprintf(game->title, "%s", selected_game->title);
+            game->title = selected_game->title;
+            game->sort_key = nullptr;
         }
     }
 
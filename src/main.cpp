@@ -17,6 +17,7 @@
 #include "style.h"
 #include "fs.h"
 #include "net.h"
+#include "vita_sqlite.h"
 //#include "debugnet.h"
 
 namespace Services
@@ -115,6 +116,7 @@ int main(int, char **)
 	Services::Init();
 	Services::InitImGui();
 
+	vita_sqlite_init();
 	GAME::Init();
 	GAME::StartScanGamesThread();
 
@@ -0,0 +1,941 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <vitasdk.h>
+#include <cstring>
+
+#include "scanner.h"
+#include "game.h"
+#include "db.h"
+#include "fs.h"
+#include "textures.h"
+#include "config.h"
+
+ScanProgress scan_progress[MAX_SCAN_WORKERS+1];
+int scan_workers = 0;
+
+static std::deque<ScanJob> scan_jobs;
+static std::deque<ScanResult> scan_results;
+static SceUID scan_jobs_mutex = -1;
+static SceUID scan_jobs_sema = -1;
+static SceUID scan_results_mutex = -1;
+static SceUID scan_results_sema = -1;
+static SceUID iso_extract_budget = -1;
+
+// state only the scanning thread touches, it owns every sqlite connection
+typedef struct {
+    sqlite3 *db;
+    MameNameTable mame_names;
+    bool mame_names_loaded;
+    int mame_lookups;
+    uint64_t mame_lookup_time;
+    uint64_t mame_load_time;
+    sqlite3 *metadata_db;
+    BulkInsert bulk;
+    bool incremental;
+    int next_iso_index;
+    int next_eboot_index;
+    std::map<std::string, Game> image_metadata;
+    std::set<std::string> used_ids;
+    std::map<std::string, std::string> image_ids; // title id of the cached images by rom_path
+    std::vector<ScanResult> dir_signatures;
+    int category_jobs[TOTAL_CATEGORY];
+} ScanWriter;
+
+namespace SCANNER {
+    void PushJob(ScanJob &job)
+    {
+        sceKernelLockMutex(scan_jobs_mutex, 1, NULL);
+        scan_jobs.push_back(job);
+        sceKernelUnlockMutex(scan_jobs_mutex, 1);
+        sceKernelSignalSema(scan_jobs_sema, 1);
+    }
+
+    ScanJob PopJob()
+    {
+        sceKernelWaitSema(scan_jobs_sema, 1, NULL);
+        sceKernelLockMutex(scan_jobs_mutex, 1, NULL);
+        ScanJob job = scan_jobs.front();
+        scan_jobs.pop_front();
+        sceKernelUnlockMutex(scan_jobs_mutex, 1);
+        return job;
+    }
+
+    void PushResult(ScanResult &result)
+    {
+        sceKernelLockMutex(scan_results_mutex, 1, NULL);
+        scan_results.push_back(result);
+        sceKernelUnlockMutex(scan_results_mutex, 1);
+        sceKernelSignalSema(scan_results_sema, 1);
+    }
+
+    ScanResult PopResult()
+    {
+        sceKernelWaitSema(scan_results_sema, 1, NULL);
+        sceKernelLockMutex(scan_results_mutex, 1, NULL);
+        ScanResult result = scan_results.front();
+        scan_results.pop_front();
+        sceKernelUnlockMutex(scan_results_mutex, 1);
+        return result;
+    }
+
+    // false when no result came within timeout microseconds
+    bool PopResult(ScanResult &result, SceUInt timeout)
+    {
+        if (sceKernelWaitSema(scan_results_sema, 1, &timeout) < 0)
+        {
+            return false;
+        }
+        sceKernelLockMutex(scan_results_mutex, 1, NULL);
+        result = scan_results.front();
+        scan_results.pop_front();
+        sceKernelUnlockMutex(scan_results_mutex, 1);
+        return true;
+    }
+
+    void PushManifestResult(const char *root, const FileInfo &file, int status, FileManifestEntry &entry, int game_type)
+    {
+        ScanResult result;
+        result.type = SCAN_RESULT_MANIFEST;
+        result.game_type = game_type;
+        result.root = root;
+        result.path = file.path;
+        result.status = status;
+        result.entry = entry;
+        PushResult(result);
+    }
+
+    void PushRemovedResults(const char *root, std::map<std::string, FileManifestEntry> *manifest, int game_type)
+    {
+        for (std::map<std::string, FileManifestEntry>::iterator it=manifest->begin(); it!=manifest->end(); ++it)
+        {
+            if (!it->second.seen)
+            {
+                ScanResult result;
+                result.type = SCAN_RESULT_REMOVED;
+                result.game_type = game_type;
+                result.root = root;
+                result.path = it->first;
+                result.entry = it->second;
+                PushResult(result);
+            }
+        }
+    }
+
+    // A file replaced in place under the same name leaves the directory mtime as it
+    // was, so the files known in a directory skipped through its signature are
+    // stat'ed and visited like listed ones. The ones that are gone stay unseen.
+    bool VisitSkippedFiles(ScanJob &job, const WalkVisitor &visitor)
+    {
+        std::map<std::string, FileManifestEntry> *manifest = job.manifest;
+        for (std::map<std::string, FileManifestEntry>::iterator it=manifest->begin(); it!=manifest->end(); ++it)
+        {
+            if (it->second.seen || it->second.is_dir)
+            {
+                continue;
+            }
+
+            std::size_t slash = it->first.find_last_of('/');
+            DirSignatures::iterator dir = job.signatures->find(slash == std::string::npos ? "" : it->first.substr(0, slash));
+            if (dir == job.signatures->end() || !dir->second.seen || dir->second.listed)
+            {
+                continue;
+            }
+
+            FileInfo file;
+            if (FS::GetFileInfo(std::string(job.root) + "/" + it->first, &file) && !file.is_dir)
+            {
+                file.path = it->first;
+                if (!visitor(file))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void PushDirSignatureResults(const char *root, DirSignatures *signatures, ScanProgress *progress)
+    {
+        for (DirSignatures::iterator it=signatures->begin(); it!=signatures->end(); ++it)
+        {
+            if (it->second.seen && !it->second.listed)
+            {
+                progress->dirs_skipped++;
+                continue;
+            }
+
+            ScanResult result;
+            result.type = it->second.seen ? SCAN_RESULT_DIR_SIGNATURE : SCAN_RESULT_DIR_REMOVED;
+            result.root = root;
+            result.path = it->first;
+            result.signature = it->second;
+            PushResult(result);
+            if (it->second.seen)
+            {
+                progress->dirs_listed++;
+            }
+        }
+    }
+
+    // files whose path doesn't fit ROM_PATH_MAX are left out of the library
+    bool FitsRomPath(const char *root, const std::string &path)
+    {
+        return strlen(root) + path.length() + 1 < ROM_PATH_MAX;
+    }
+
+    // the manifest and the signatures are only complete when the walk was not cancelled
+    void FinishFolderJob(ScanJob &job, ScanProgress *progress, int game_type, const WalkVisitor &visitor)
+    {
+        if (!scan_cancelled && VisitSkippedFiles(job, visitor))
+        {
+            PushRemovedResults(job.root, job.manifest, game_type);
+            PushDirSignatureResults(job.root, job.signatures, progress);
+        }
+    }
+
+    void ScanRetroCategoryJob(ScanJob &job, ScanProgress *progress)
+    {
+        GameCategory *category = job.category;
+        sprintf(progress->scan_message, "Scanning for %s games in the %s folder", category->title, category->roms_path);
+        WalkOptions options = FS::FilesWithExtensions(&category->rom_extensions);
+        options.include_dirs = true;
+        options.signatures = job.signatures;
+
+        WalkVisitor visitor = [&](const FileInfo &file) {
+            if (scan_cancelled)
+            {
+                return false;
+            }
+            if (!file.is_dir && !FitsRomPath(job.root, file.path))
+            {
+                return true;
+            }
+            FileManifestEntry entry;
+            int status = GAME::CheckFileManifest(*job.manifest, file, &entry);
+            progress->games_to_scan++;
+            progress->games_scanned++;
+            if (status == FILE_UNCHANGED)
+            {
+                return true;
+            }
+            PushManifestResult(job.root, file, status, entry, TYPE_ROM);
+
+            // A changed rom keeps its cached title, folder and favorite state
+            ScanResult result;
+            if (status == FILE_ADDED && !file.is_dir && GAME::PopulateRomGameInfo(category, &result.game, file.path, nullptr))
+            {
+                result.type = SCAN_RESULT_GAME;
+                result.game_type = TYPE_ROM;
+                result.root = job.root;
+                result.path = file.path;
+                PushResult(result);
+            }
+            return true;
+        };
+
+        FS::Walk(category->roms_path, options, visitor);
+        FinishFolderJob(job, progress, TYPE_ROM, visitor);
+    }
+
+    void ScanImageFolderJob(ScanJob &job, ScanProgress *progress, int game_type, const ExtensionMatcher *extensions)
+    {
+        sprintf(progress->scan_message, "Scanning for %s games in the %s folder", game_type == TYPE_PSP_ISO ? "ISO" : "EBOOT", job.root);
+        uint64_t start_time = sceKernelGetProcessTimeWide();
+        WalkOptions options = FS::FilesWithExtensions(extensions);
+        options.include_dirs = true;
+        options.signatures = job.signatures;
+
+        WalkVisitor visitor = [&](const FileInfo &file) {
+            if (scan_cancelled)
+            {
+                return false;
+            }
+            if (!file.is_dir && !FitsRomPath(job.root, file.path))
+            {
+                return true;
+            }
+            FileManifestEntry entry;
+            int status = GAME::CheckFileManifest(*job.manifest, file, &entry);
+            if (status == FILE_UNCHANGED)
+            {
+                return true;
+            }
+            PushManifestResult(job.root, file, status, entry, game_type);
+
+            if (!file.is_dir)
+            {
+                // the writer decides the id and queues the extraction
+                progress->games_to_scan++;
+                ScanResult result;
+                result.type = SCAN_RESULT_IMAGE;
+                result.game_type = game_type;
+                result.root = job.root;
+                result.path = file.path;
+                result.status = status;
+                char rom_path[ROM_PATH_MAX];
+                snprintf(rom_path, sizeof(rom_path), "%s/%s", job.root, file.path.c_str());
+                char fingerprint[IMAGE_FINGERPRINT_LENGTH];
+                if (GAME::GetImageFingerprint(rom_path, file.size, file.mtime, fingerprint))
+                {
+                    result.fingerprint = fingerprint;
+                }
+                PushResult(result);
+            }
+            return true;
+        };
+
+        FS::Walk(job.root, options, visitor);
+        FinishFolderJob(job, progress, game_type, visitor);
+        if (game_type == TYPE_PSP_ISO)
+        {
+            progress->iso_times.enumerate += sceKernelGetProcessTimeWide() - start_time;
+        }
+    }
+
+    void ScanImageJob(ScanJob &job, ScanProgress *progress)
+    {
+        ScanResult result;
+        result.type = SCAN_RESULT_GAME;
+        result.root = job.root;
+        result.path = job.path;
+        result.fingerprint = job.fingerprint;
+        if (scan_cancelled)
+        {
+            // the next scan has to see the image as added again
+            result.type = SCAN_RESULT_CANCELLED;
+            progress->games_to_scan--;
+            PushResult(result);
+            return;
+        }
+
+        try
+        {
+            if (job.type == SCAN_JOB_ISO_IMAGE)
+            {
+                result.game_type = TYPE_PSP_ISO;
+                GAME::PopulateIsoGameInfo(&result.game, job.path, job.game_index, &progress->iso_times, iso_extract_budget);
+            }
+            else
+            {
+                result.game_type = TYPE_EBOOT;
+                GAME::PopulateEbootGameInfo(&result.game, job.path, job.game_index);
+            }
+            snprintf(progress->scan_message, 256, "Extracting %s", result.game.title);
+            PushResult(result);
+            progress->games_scanned++;
+        }
+        catch(const std::exception& e)
+        {
+            progress->games_to_scan--;
+        }
+    }
+
+    int ScanWorkerThread(SceSize args, int *worker_id)
+    {
+        ScanProgress *progress = &scan_progress[*worker_id];
+        while (true)
+        {
+            ScanJob job = PopJob();
+            if (job.type == SCAN_JOB_EXIT)
+            {
+                break;
+            }
+
+            if (job.type == SCAN_JOB_RETRO_CATEGORY)
+            {
+                ScanRetroCategoryJob(job, progress);
+            }
+            else if (job.type == SCAN_JOB_ISO_FOLDER)
+            {
+                ScanImageFolderJob(job, progress, TYPE_PSP_ISO, &psp_iso_extension_matcher);
+            }
+            else if (job.type == SCAN_JOB_EBOOT_FOLDER)
+            {
+                ScanImageFolderJob(job, progress, TYPE_EBOOT, &eboot_extension_matcher);
+            }
+            else
+            {
+                ScanImageJob(job, progress);
+            }
+
+            if (job.manifest != nullptr)
+            {
+                delete job.manifest;
+            }
+            if (job.signatures != nullptr)
+            {
+                delete job.signatures;
+            }
+
+            ScanResult done;
+            done.type = SCAN_RESULT_JOB_DONE;
+            done.job_type = job.type;
+            done.category = job.category;
+            PushResult(done);
+        }
+
+        ScanResult exit;
+        exit.type = SCAN_RESULT_WORKER_EXIT;
+        PushResult(exit);
+        return sceKernelExitDeleteThread(0);
+    }
+
+    void QueueFolderJob(sqlite3 *db, int type, GameCategory *category, const char *root, bool incremental)
+    {
+        ScanJob job;
+        job.type = type;
+        job.category = category;
+        job.root = root;
+        job.game_index = 0;
+        job.manifest = new std::map<std::string, FileManifestEntry>();
+        job.signatures = new DirSignatures();
+        if (incremental)
+        {
+            DB::GetFileManifest(db, root, *job.manifest);
+            DB::GetDirSignatures(db, root, *job.signatures);
+        }
+        PushJob(job);
+    }
+
+    // an image can land in any of the image categories, so their jobs count for all of them
+    void CountJob(ScanWriter *writer, int type, GameCategory *category, int count)
+    {
+        if (type == SCAN_JOB_RETRO_CATEGORY)
+        {
+            writer->category_jobs[category->id] += count;
+        }
+        else
+        {
+            writer->category_jobs[PSP_GAMES] += count;
+            writer->category_jobs[PS1_GAMES] += count;
+            writer->category_jobs[PS_MIMI_GAMES] += count;
+        }
+    }
+
+    void LoadMameNameTable(ScanWriter *writer)
+    {
+        uint64_t start_time = sceKernelGetProcessTimeWide();
+        DB::LoadMameNameTable(nullptr, &writer->mame_names);
+        writer->mame_load_time = sceKernelGetProcessTimeWide() - start_time;
+        writer->mame_names_loaded = true;
+    }
+
+    void LookupMameRomName(ScanWriter *writer, Game *game)
+    {
+        if (!writer->mame_names_loaded)
+        {
+            LoadMameNameTable(writer);
+        }
+
+#ifdef BENCHMARK_MAME_SQL_LOOKUPS
+        static sqlite3 *mame_mappings_db = nullptr;
+        static uint64_t sql_lookup_time = 0;
+        if (mame_mappings_db == nullptr)
+        {
+            DB::Open(MAME_ROM_NAME_MAPPINGS_FILE, &mame_mappings_db);
+        }
+        char sql_name[128];
+        uint64_t sql_start_time = sceKernelGetProcessTimeWide();
+        DB::GetMameRomName(mame_mappings_db, game->title, sql_name);
+        sql_lookup_time += sceKernelGetProcessTimeWide() - sql_start_time;
+        if (writer->mame_lookups % 1000 == 999)
+        {
+            char line[128];
+            snprintf(line, 128, "mame_sql_lookups=%d time_us=%llu\n", writer->mame_lookups + 1, sql_lookup_time);
+            FS::AppendText(SCAN_STATS_LOG_FILE, line);
+        }
+#endif
+
+        uint64_t start_time = sceKernelGetProcessTimeWide();
+        char name[128];
+        if (DB::FindMameRomName(&writer->mame_names, game->title, name))
+        {
+            game->title = ARENA::Copy(name);
+            game->sort_key = nullptr;
+        }
+        writer->mame_lookup_time += sceKernelGetProcessTimeWide() - start_time;
+        writer->mame_lookups++;
+    }
+
+    void LogMameLookups(ScanWriter *writer)
+    {
+        if (writer->mame_lookups > 0)
+        {
+            char line[192];
+            uint64_t lookups_per_sec = writer->mame_lookup_time > 0 ? (uint64_t)writer->mame_lookups * 1000000 / writer->mame_lookup_time : 0;
+            snprintf(line, 192, "mame_names=%d load_us=%llu mame_lookups=%d time_us=%llu lookups_per_sec=%llu\n",
+                (int)writer->mame_names.index.size(), writer->mame_load_time, writer->mame_lookups, writer->mame_lookup_time, lookups_per_sec);
+            FS::AppendText(SCAN_STATS_LOG_FILE, line);
+        }
+    }
+
+    void WriteGame(ScanWriter *writer, ScanResult &result)
+    {
+        Game *game = &result.game;
+        GameCategory *category = &game_categories[game->category];
+        if (game->type == TYPE_ROM)
+        {
+            if (writer->incremental && GAME::FindGameByRomPath(game->rom_path, TYPE_ROM, category) != nullptr)
+            {
+                return;
+            }
+
+            if (category->id == MAME_2000_GAMES || category->id == MAME_2003_GAMES || category->id == NEOGEO_GAMES)
+            {
+                LookupMameRomName(writer, game);
+            }
+        }
+        else if (result.fingerprint.length() > 0)
+        {
+            DB::SaveImageMetadata(writer->metadata_db, result.fingerprint.c_str(), game);
+        }
+        if (game->type == TYPE_PSP_ISO || game->type == TYPE_EBOOT)
+        {
+            writer->image_ids[game->rom_path] = game->id;
+        }
+
+        category->current_folder->games.push_back(*game);
+        GAME::IndexGame(category, category->current_folder, category->current_folder->games.size()-1);
+        DB::BulkInsertGame(&writer->bulk, game);
+        game_scan_inprogress = *game;
+    }
+
+    // an unchanged image keeps the id and the extracted files of its previous scan
+    bool WriteCachedImage(ScanWriter *writer, ScanResult &result, const char *rom_path)
+    {
+        std::map<std::string, Game>::iterator cached = writer->image_metadata.find(result.fingerprint);
+        if (cached == writer->image_metadata.end() || cached->second.type != result.game_type ||
+            writer->used_ids.find(cached->second.id) != writer->used_ids.end())
+        {
+            return false;
+        }
+
+        char data_path[64];
+        snprintf(data_path, 64, "ux0:data/SMLA00001/data/%s", cached->second.id);
+        if (!FS::FolderExists(data_path))
+        {
+            return false;
+        }
+
+        ScanResult cached_result;
+        cached_result.type = SCAN_RESULT_GAME;
+        cached_result.game_type = result.game_type;
+        cached_result.game = cached->second;
+        cached_result.game.rom_path = ARENA::Copy(rom_path);
+        cached_result.game.tex = no_icon;
+        writer->used_ids.insert(cached->second.id);
+        WriteGame(writer, cached_result);
+        scan_progress[0].games_scanned++;
+        return true;
+    }
+
+    // the images of the cache are looked up by id, an image that is not in it gets the empty id
+    void IndexImages(ScanWriter *writer)
+    {
+        int image_categories[] = {PSP_GAMES, PS1_GAMES, PS_MIMI_GAMES};
+        for (int i=0; i < 3; i++)
+        {
+            GameCategory *category = &game_categories[image_categories[i]];
+            for (int j=0; j < category->folders.size(); j++)
+            {
+                std::vector<Game> &games = category->folders[j].games;
+                for (int k=0; k < games.size(); k++)
+                {
+                    if (games[k].type == TYPE_PSP_ISO || games[k].type == TYPE_EBOOT)
+                    {
+                        writer->image_ids[games[k].rom_path] = games[k].id;
+                    }
+                }
+            }
+        }
+    }
+
+    const char* GetImageId(ScanWriter *writer, const char *rom_path)
+    {
+        std::map<std::string, std::string>::iterator it = writer->image_ids.find(rom_path);
+        return it == writer->image_ids.end() ? "" : it->second.c_str();
+    }
+
+    // returns false when no extraction job was queued for the image
+    bool QueueImageJob(ScanWriter *writer, ScanResult &result)
+    {
+        char rom_path[ROM_PATH_MAX];
+        snprintf(rom_path, sizeof(rom_path), "%s/%s", result.root, result.path.c_str());
+        int *next_index = result.game_type == TYPE_PSP_ISO ? &writer->next_iso_index : &writer->next_eboot_index;
+        int game_index = *next_index;
+        bool new_index = true;
+        const char *id = GetImageId(writer, rom_path);
+        Game *existing = writer->incremental ? GAME::FindGameByRomPath(rom_path, result.game_type, nullptr, id) : nullptr;
+        if (existing != nullptr)
+        {
+            if (result.status == FILE_ADDED)
+            {
+                // already in the cache from before the manifest was recorded
+                scan_progress[0].games_scanned++;
+                return false;
+            }
+            game_index = atoi(existing->id+5);
+            new_index = false;
+            GAME::RemoveMissingGame(writer->db, rom_path, result.game_type, id);
+        }
+
+        if (WriteCachedImage(writer, result, rom_path))
+        {
+            return false;
+        }
+
+        if (new_index)
+        {
+            (*next_index)++;
+        }
+
+        ScanJob job;
+        job.type = result.game_type == TYPE_PSP_ISO ? SCAN_JOB_ISO_IMAGE : SCAN_JOB_EBOOT_IMAGE;
+        job.category = nullptr;
+        job.root = result.root;
+        job.path = result.path;
+        job.fingerprint = result.fingerprint;
+        job.game_index = game_index;
+        job.manifest = nullptr;
+        job.signatures = nullptr;
+
+        char title_id[20];
+        snprintf(title_id, 20, "%s%04d", result.game_type == TYPE_PSP_ISO ? "SMLAP" : "SMLAE", game_index);
+        writer->used_ids.insert(title_id);
+        CountJob(writer, job.type, nullptr, 1);
+        PushJob(job);
+        return true;
+    }
+
+    // The ui may be waiting for cache.db with the categories lock held, so the
+    // batch is committed before waiting for the lock any longer.
+    void LockCategories(ScanWriter *writer)
+    {
+        if (!GAME::LockCategories(SCAN_WRITER_LOCK_WAIT))
+        {
+            DB::FlushBulkInsert(&writer->bulk);
+            GAME::LockCategories();
+        }
+    }
+
+    void PublishCategory(ScanWriter *writer, int category)
+    {
+        if (writer->category_jobs[category] == 0)
+        {
+            LockCategories(writer);
+            GAME::PublishCategory(&game_categories[category]);
+            GAME::UnlockCategories();
+        }
+    }
+
+    // publishes the categories of the job that have no job left
+    void FinishJob(ScanWriter *writer, ScanResult &result)
+    {
+        CountJob(writer, result.job_type, result.category, -1);
+        if (result.job_type == SCAN_JOB_RETRO_CATEGORY)
+        {
+            PublishCategory(writer, result.category->id);
+        }
+        else
+        {
+            PublishCategory(writer, PSP_GAMES);
+            PublishCategory(writer, PS1_GAMES);
+            PublishCategory(writer, PS_MIMI_GAMES);
+        }
+    }
+
+    // a changed image loses its stale cache entry so the next scan extracts it again
+    void CancelImage(ScanWriter *writer, ScanResult &result)
+    {
+        if (result.status == FILE_CHANGED)
+        {
+            char rom_path[ROM_PATH_MAX];
+            snprintf(rom_path, sizeof(rom_path), "%s/%s", result.root, result.path.c_str());
+            LockCategories(writer);
+            GAME::RemoveMissingGame(writer->db, rom_path, result.game_type, GetImageId(writer, rom_path));
+            GAME::UnlockCategories();
+        }
+        DB::DeleteFileManifestEntry(writer->db, result.root, result.path.c_str());
+    }
+
+    void OpenImageMetadata(ScanWriter *writer)
+    {
+        DB::Open(IMAGE_METADATA_DB_FILE, &writer->metadata_db);
+        DB::SetupImageMetadata(writer->metadata_db);
+        DB::GetImageMetadata(writer->metadata_db, writer->image_metadata);
+        sqlite3_exec(writer->metadata_db, "BEGIN", NULL, NULL, NULL);
+
+        // fresh ids must not land on an id a cached image will come back with
+        for (std::map<std::string, Game>::iterator it=writer->image_metadata.begin(); it!=writer->image_metadata.end(); ++it)
+        {
+            int index = atoi(it->second.id+5) + 1;
+            if (it->second.type == TYPE_PSP_ISO && index > writer->next_iso_index)
+            {
+                writer->next_iso_index = index;
+            }
+            else if (it->second.type == TYPE_EBOOT && index > writer->next_eboot_index)
+            {
+                writer->next_eboot_index = index;
+            }
+        }
+    }
+
+    // a cancelled scan leaves the old signatures, their directories get listed again next time
+    void SaveDirSignatures(ScanWriter *writer)
+    {
+        if (scan_cancelled)
+        {
+            return;
+        }
+
+        sqlite3_exec(writer->db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+        for (int i=0; i < writer->dir_signatures.size(); i++)
+        {
+            ScanResult &result = writer->dir_signatures[i];
+            if (result.type == SCAN_RESULT_DIR_SIGNATURE)
+            {
+                DB::SaveDirSignature(writer->db, result.root, result.path.c_str(), &result.signature);
+            }
+            else
+            {
+                DB::DeleteDirSignature(writer->db, result.root, result.path.c_str());
+            }
+        }
+        sqlite3_exec(writer->db, "COMMIT", NULL, NULL, NULL);
+    }
+
+    void LogDirSignatures()
+    {
+        int listed = 0;
+        int skipped = 0;
+        for (int i=1; i <= scan_workers; i++)
+        {
+            listed += scan_progress[i].dirs_listed;
+            skipped += scan_progress[i].dirs_skipped;
+        }
+
+        if (listed + skipped > 0)
+        {
+            char line[64];
+            snprintf(line, 64, "dirs_listed=%d dirs_skipped=%d\n", listed, skipped);
+            FS::AppendText(SCAN_STATS_LOG_FILE, line);
+        }
+    }
+
+    void LogIsoStageTimes()
+    {
+        IsoStageTimes total;
+        for (int i=1; i <= scan_workers; i++)
+        {
+            IsoStageTimes *times = &scan_progress[i].iso_times;
+            total.enumerate += times->enumerate;
+            total.sniff += times->sniff;
+            total.extract += times->extract;
+            total.parse += times->parse;
+            total.persist += times->persist;
+            total.images += times->images;
+        }
+
+        if (total.images > 0)
+        {
+            // stage times are summed over the workers, so they can add up to more than the wall time
+            char line[192];
+            snprintf(line, 192, "iso_images=%d enumerate_us=%llu sniff_us=%llu extract_us=%llu parse_us=%llu persist_us=%llu\n",
+                total.images, total.enumerate, total.sniff, total.extract, total.parse, total.persist);
+            FS::AppendText(SCAN_STATS_LOG_FILE, line);
+        }
+    }
+
+    void ScanGames(sqlite3 *db, std::vector<GameCategory*> &categories, bool scan_iso, bool scan_eboot, bool incremental, int priority)
+    {
+        scan_jobs_mutex = sceKernelCreateMutex("scan_jobs_mutex", 0, 0, NULL);
+        scan_jobs_sema = sceKernelCreateSema("scan_jobs_sema", 0, 0, 0x7FFFFFFF, NULL);
+        scan_results_mutex = sceKernelCreateMutex("scan_results_mutex", 0, 0, NULL);
+        scan_results_sema = sceKernelCreateSema("scan_results_sema", 0, 0, 0x7FFFFFFF, NULL);
+        iso_extract_budget = sceKernelCreateSema("iso_extract_budget", 0, ISO_EXTRACT_BUDGET_KB, ISO_EXTRACT_BUDGET_KB, NULL);
+
+        memset(scan_progress, 0, sizeof(scan_progress));
+        sprintf(scan_message, "%s", "Scanning for games");
+        scan_workers = 0;
+        for (int i=1; i <= MAX_SCAN_WORKERS; i++)
+        {
+            // workers inherit the priority of the scan, lowered when it runs in the background
+            SceUID thid = sceKernelCreateThread("scan_worker_thread", (SceKernelThreadEntry)SCANNER::ScanWorkerThread, sceKernelGetThreadCurrentPriority(), 0x4000, 0, 0, NULL);
+            if (thid >= 0)
+            {
+                scan_workers++;
+                sceKernelStartThread(thid, sizeof(int), &i);
+            }
+        }
+
+        ScanWriter writer;
+        memset(writer.category_jobs, 0, sizeof(writer.category_jobs));
+
+        // the image folders go first so their extraction overlaps with the rom listings,
+        // only the priority categories are queued ahead of them
+        int pending_jobs = 0;
+        for (int i=0; i < priority && i < categories.size(); i++)
+        {
+            QueueFolderJob(db, SCAN_JOB_RETRO_CATEGORY, categories[i], categories[i]->roms_path, incremental);
+            CountJob(&writer, SCAN_JOB_RETRO_CATEGORY, categories[i], 1);
+            pending_jobs++;
+        }
+        if (scan_iso)
+        {
+            if (!FS::FolderExists("ux0:data/SMLA00001/data"))
+            {
+                FS::MkDirs("ux0:data/SMLA00001/data");
+            }
+            QueueFolderJob(db, SCAN_JOB_ISO_FOLDER, nullptr, pspemu_iso_path, incremental);
+            CountJob(&writer, SCAN_JOB_ISO_FOLDER, nullptr, 1);
+            pending_jobs++;
+        }
+        if (scan_eboot)
+        {
+            QueueFolderJob(db, SCAN_JOB_EBOOT_FOLDER, nullptr, pspemu_eboot_path, incremental);
+            CountJob(&writer, SCAN_JOB_EBOOT_FOLDER, nullptr, 1);
+            pending_jobs++;
+        }
+        for (int i=priority; i < categories.size(); i++)
+        {
+            QueueFolderJob(db, SCAN_JOB_RETRO_CATEGORY, categories[i], categories[i]->roms_path, incremental);
+            CountJob(&writer, SCAN_JOB_RETRO_CATEGORY, categories[i], 1);
+            pending_jobs++;
+        }
+
+        writer.db = db;
+        writer.mame_names_loaded = false;
+        writer.mame_lookups = 0;
+        writer.mame_lookup_time = 0;
+        writer.mame_load_time = 0;
+        writer.metadata_db = nullptr;
+        writer.incremental = incremental;
+        writer.next_iso_index = incremental ? GAME::GetNextTitleIdIndex(db, TYPE_PSP_ISO) : 0;
+        writer.next_eboot_index = incremental ? GAME::GetNextTitleIdIndex(db, TYPE_EBOOT) : 0;
+        if (scan_iso || scan_eboot)
+        {
+            OpenImageMetadata(&writer);
+            if (incremental)
+            {
+                GAME::LockCategories();
+                IndexImages(&writer);
+                GAME::UnlockCategories();
+            }
+        }
+        DB::BeginBulkInsert(db, &writer.bulk, insert_batch_size);
+
+        while (pending_jobs > 0)
+        {
+            ScanResult result;
+            if (!PopResult(result, SCAN_WRITER_IDLE_WAIT))
+            {
+                DB::FlushBulkInsert(&writer.bulk);
+                result = PopResult();
+            }
+            if (result.type == SCAN_RESULT_JOB_DONE)
+            {
+                pending_jobs--;
+                FinishJob(&writer, result);
+            }
+            else if (result.type == SCAN_RESULT_MANIFEST)
+            {
+                DB::SaveFileManifestEntry(db, result.root, result.path.c_str(), &result.entry);
+            }
+            else if (result.type == SCAN_RESULT_REMOVED)
+            {
+                if (!result.entry.is_dir)
+                {
+                    char rom_path[ROM_PATH_MAX];
+                    snprintf(rom_path, sizeof(rom_path), "%s/%s", result.root, result.path.c_str());
+                    LockCategories(&writer);
+                    GAME::RemoveMissingGame(db, rom_path, result.game_type,
+                        result.game_type == TYPE_ROM ? nullptr : GetImageId(&writer, rom_path));
+                    GAME::UnlockCategories();
+                }
+                DB::DeleteFileManifestEntry(db, result.root, result.path.c_str());
+            }
+            else if (result.type == SCAN_RESULT_IMAGE)
+            {
+                if (scan_cancelled)
+                {
+                    CancelImage(&writer, result);
+                }
+                else
+                {
+                    LockCategories(&writer);
+                    if (QueueImageJob(&writer, result))
+                    {
+                        pending_jobs++;
+                    }
+                    GAME::UnlockCategories();
+                }
+            }
+            else if (result.type == SCAN_RESULT_CANCELLED)
+            {
+                DB::DeleteFileManifestEntry(db, result.root, result.path.c_str());
+            }
+            else if (result.type == SCAN_RESULT_DIR_SIGNATURE || result.type == SCAN_RESULT_DIR_REMOVED)
+            {
+                writer.dir_signatures.push_back(result);
+            }
+            else if (result.type == SCAN_RESULT_GAME)
+            {
+                LockCategories(&writer);
+                WriteGame(&writer, result);
+                GAME::UnlockCategories();
+            }
+        }
+
+        DB::EndBulkInsert(&writer.bulk);
+        SaveDirSignatures(&writer);
+        LogMameLookups(&writer);
+        if (writer.metadata_db != nullptr)
+        {
+            sqlite3_exec(writer.metadata_db, "COMMIT", NULL, NULL, NULL);
+            sqlite3_close(writer.metadata_db);
+        }
+
+        for (int i=0; i < scan_workers; i++)
+        {
+            ScanJob job;
+            job.type = SCAN_JOB_EXIT;
+            job.manifest = nullptr;
+            job.signatures = nullptr;
+            PushJob(job);
+        }
+        int exited = 0;
+        while (exited < scan_workers)
+        {
+            ScanResult result = PopResult();
+            if (result.type == SCAN_RESULT_WORKER_EXIT)
+            {
+                exited++;
+            }
+        }
+
+        GetProgress(&games_scanned, &games_to_scan);
+        LogIsoStageTimes();
+        LogDirSignatures();
+        scan_workers = 0;
+
+        sceKernelDeleteSema(scan_jobs_sema);
+        sceKernelDeleteMutex(scan_jobs_mutex);
+        sceKernelDeleteSema(scan_results_sema);
+        sceKernelDeleteMutex(scan_results_mutex);
+        sceKernelDeleteSema(iso_extract_budget);
+    }
+
+    void GetProgress(int *scanned, int *to_scan)
+    {
+        *scanned = 0;
+        *to_scan = 0;
+        for (int i=0; i <= scan_workers; i++)
+        {
+            *scanned += scan_progress[i].games_scanned;
+            *to_scan += scan_progress[i].games_to_scan;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef LAUNCHER_SCANNER_H
+#define LAUNCHER_SCANNER_H
+
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include "game.h"
+
+#define MAX_SCAN_WORKERS 3
+
+// The writer keeps a batch of cache.db rows uncommitted, the other connections
+// wait for it. It commits early when no result came for SCAN_WRITER_IDLE_WAIT
+// microseconds or when the categories lock, which the ui holds while it writes
+// cache.db, was not free within SCAN_WRITER_LOCK_WAIT.
+#define SCAN_WRITER_IDLE_WAIT 50000
+#define SCAN_WRITER_LOCK_WAIT 50000
+
+#define SCAN_JOB_EXIT 0
+#define SCAN_JOB_RETRO_CATEGORY 1
+#define SCAN_JOB_ISO_FOLDER 2
+#define SCAN_JOB_EBOOT_FOLDER 3
+#define SCAN_JOB_ISO_IMAGE 4
+#define SCAN_JOB_EBOOT_IMAGE 5
+
+#define SCAN_RESULT_JOB_DONE 0
+#define SCAN_RESULT_GAME 1
+#define SCAN_RESULT_IMAGE 2
+#define SCAN_RESULT_MANIFEST 3
+#define SCAN_RESULT_REMOVED 4
+#define SCAN_RESULT_WORKER_EXIT 5
+#define SCAN_RESULT_CANCELLED 6
+#define SCAN_RESULT_DIR_SIGNATURE 7
+#define SCAN_RESULT_DIR_REMOVED 8
+
+typedef struct {
+    int type;
+    GameCategory *category;
+    const char *root;
+    std::string path;
+    std::string fingerprint;
+    int game_index;
+    std::map<std::string, FileManifestEntry> *manifest;
+    DirSignatures *signatures;
+} ScanJob;
+
+typedef struct {
+    int type;
+    int game_type;
+    const char *root;
+    std::string path;
+    int status;
+    std::string fingerprint;
+    FileManifestEntry entry;
+    DirSignature signature;
+    Game game;
+    // the finished job, for SCAN_RESULT_JOB_DONE
+    int job_type;
+    GameCategory *category;
+} ScanResult;
+
+typedef struct {
+    int games_to_scan;
+    int games_scanned;
+    char scan_message[256];
+    IsoStageTimes iso_times;
+    int dirs_listed;
+    int dirs_skipped;
+} ScanProgress;
+
+// slot 0 is the db writer, slots 1..scan_workers are the worker threads
+extern ScanProgress scan_progress[];
+extern int scan_workers;
+
+namespace SCANNER {
+    // the first priority categories are queued ahead of the image folders, each category
+    // is published by GAME::PublishCategory as soon as its last job is done
+    void ScanGames(sqlite3 *db, std::vector<GameCategory*> &categories, bool scan_iso, bool scan_eboot, bool incremental, int priority = 0);
+    int ScanWorkerThread(SceSize args, int *worker_id);
+    void GetProgress(int *scanned, int *to_scan);
+}
+
+#endif
@@ -0,0 +1,324 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <vitasdk.h>
+
+#include "snapshot.h"
+#include "game.h"
+#include "db.h"
+#include "fs.h"
+#include "config.h"
+#include "textures.h"
+
+// stamps and config hash of the snapshot on disk, SaveIfChanged compares against them
+static SnapshotHeader current;
+static bool current_valid = false;
+
+namespace SNAPSHOT {
+    static uint64_t Hash(uint64_t hash, const void *data, size_t size)
+    {
+        const unsigned char *bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    static void GetStamp(const char *path, SnapshotStamp *stamp)
+    {
+        FileInfo info;
+        stamp->size = -1;
+        stamp->mtime = 0;
+        if (FS::GetFileInfo(path, &info))
+        {
+            stamp->size = info.size;
+            stamp->mtime = info.mtime;
+        }
+    }
+
+    static bool SameStamp(const SnapshotStamp &a, const SnapshotStamp &b)
+    {
+        return a.size == b.size && a.mtime == b.mtime;
+    }
+
+    // what DB::GetVitaDbGames sorts the bubbles by besides app.db
+    static uint64_t GetConfigHash()
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (int i = 0; i < TOTAL_CATEGORY; i++)
+        {
+            hash = Hash(hash, game_categories[i].category, strlen(game_categories[i].category) + 1);
+            for (int j = 0; j < game_categories[i].valid_title_ids.size(); j++)
+            {
+                const std::string &prefix = game_categories[i].valid_title_ids[j];
+                hash = Hash(hash, prefix.c_str(), prefix.length() + 1);
+            }
+        }
+        for (int i = 0; i < hidden_title_ids.size(); i++)
+        {
+            hash = Hash(hash, hidden_title_ids[i].c_str(), hidden_title_ids[i].length() + 1);
+        }
+        return hash;
+    }
+
+    static void GetCurrentState(SnapshotHeader *header)
+    {
+        GetStamp(CACHE_DB_FILE, &header->cache_db);
+        GetStamp(VITA_APP_DB_FILE, &header->app_db);
+        header->config_hash = GetConfigHash();
+    }
+
+    static uint32_t AddString(std::vector<char> &pool, const char *text, uint16_t *length, bool *valid)
+    {
+        uint32_t offset = pool.size();
+        size_t size = strlen(text);
+        if (size > SNAPSHOT_MAX_STRING)
+        {
+            *valid = false;
+            size = 0;
+        }
+        *length = size;
+        pool.insert(pool.end(), text, text + size);
+        pool.push_back(0);
+        return offset;
+    }
+
+    static bool CopyString(const std::vector<char> &data, size_t pool_start, uint32_t offset, uint16_t length, char *dest, size_t dest_size)
+    {
+        if (length >= dest_size || pool_start + offset + length >= data.size())
+        {
+            return false;
+        }
+        memcpy(dest, &data[pool_start + offset], length);
+        dest[length] = 0;
+        return true;
+    }
+
+    static bool CopyString(const std::vector<char> &data, size_t pool_start, uint32_t offset, uint16_t length, const char **dest)
+    {
+        if (pool_start + offset + length >= data.size())
+        {
+            return false;
+        }
+        *dest = ARENA::Copy(&data[pool_start + offset], length);
+        return true;
+    }
+
+    bool Load(bool *vita_games, uint64_t *app_signature)
+    {
+        std::vector<char> data = FS::Load(SNAPSHOT_FILE);
+        if (data.size() < sizeof(SnapshotHeader))
+        {
+            return false;
+        }
+
+        SnapshotHeader header;
+        memcpy(&header, data.data(), sizeof(SnapshotHeader));
+        size_t categories_start = sizeof(SnapshotHeader);
+        size_t folders_start = categories_start + (size_t)header.categories * sizeof(SnapshotCategory);
+        size_t games_start = folders_start + (size_t)header.folders * sizeof(SnapshotFolder);
+        size_t pool_start = games_start + (size_t)header.games * sizeof(SnapshotGame);
+        if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+            header.header_size != sizeof(SnapshotHeader) || header.categories != TOTAL_CATEGORY ||
+            pool_start + header.pool_size != data.size())
+        {
+            return false;
+        }
+
+        if (Hash(0xcbf29ce484222325ULL, &data[categories_start], data.size() - categories_start) != header.checksum)
+        {
+            return false;
+        }
+
+        SnapshotHeader state;
+        GetCurrentState(&state);
+        if (!SameStamp(state.cache_db, header.cache_db))
+        {
+            return false;
+        }
+        *vita_games = SameStamp(state.app_db, header.app_db) && state.config_hash == header.config_hash;
+
+        const SnapshotCategory *categories = (const SnapshotCategory*)&data[categories_start];
+        const SnapshotFolder *folders = (const SnapshotFolder*)&data[folders_start];
+        const SnapshotGame *games = (const SnapshotGame*)&data[games_start];
+        bool valid = true;
+        for (int i = 0; i < TOTAL_CATEGORY && valid; i++)
+        {
+            GameCategory *category = &game_categories[i];
+            category->folders.erase(category->folders.begin()+1, category->folders.end());
+            category->folders[0].games.clear();
+            if (categories[i].folder_count == 0 || categories[i].first_folder + categories[i].folder_count > header.folders)
+            {
+                valid = false;
+                break;
+            }
+            category->folders.reserve(categories[i].folder_count);
+
+            for (int j = 0; j < categories[i].folder_count && valid; j++)
+            {
+                const SnapshotFolder *record = &folders[categories[i].first_folder + j];
+                if (record->first_game + record->game_count > header.games)
+                {
+                    valid = false;
+                    break;
+                }
+
+                if (j > 0)
+                {
+                    Folder folder;
+                    folder.id = record->id;
+                    folder.type = record->type;
+                    folder.max_page = 1;
+                    folder.page_num = 1;
+                    folder.category = category->id;
+                    valid = CopyString(data, pool_start, record->title, record->title_length, folder.title, sizeof(folder.title)) &&
+                        CopyString(data, pool_start, record->icon_path, record->icon_path_length, folder.icon_path, sizeof(folder.icon_path));
+                    category->folders.push_back(folder);
+                }
+
+                Folder *folder = &category->folders[j];
+                folder->games.reserve(record->game_count);
+                for (int k = 0; k < record->game_count && valid; k++)
+                {
+                    const SnapshotGame *entry = &games[record->first_game + k];
+                    if (entry->category >= TOTAL_CATEGORY)
+                    {
+                        valid = false;
+                        break;
+                    }
+                    Game game;
+                    game.type = entry->type;
+                    game.favorite = entry->favorite;
+                    game.folder_id = entry->folder_id;
+                    game.tex = no_icon;
+                    game.category = entry->category;
+                    valid = CopyString(data, pool_start, entry->id, entry->id_length, &game.id) &&
+                        CopyString(data, pool_start, entry->title, entry->title_length, &game.title) &&
+                        CopyString(data, pool_start, entry->rom_path, entry->rom_path_length, &game.rom_path);
+                    folder->games.push_back(game);
+                }
+            }
+            category->current_folder = &category->folders[0];
+            GAME::InvalidateGameIndex(category);
+        }
+
+        if (!valid)
+        {
+            for (int i = 0; i < TOTAL_CATEGORY; i++)
+            {
+                game_categories[i].folders.erase(game_categories[i].folders.begin()+1, game_categories[i].folders.end());
+                game_categories[i].folders[0].games.clear();
+                game_categories[i].current_folder = &game_categories[i].folders[0];
+                GAME::InvalidateGameIndex(&game_categories[i]);
+            }
+            return false;
+        }
+
+        current = header;
+        current_valid = *vita_games;
+        *app_signature = header.app_signature;
+        return true;
+    }
+
+    void Save()
+    {
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(SnapshotHeader));
+        std::vector<SnapshotCategory> categories(TOTAL_CATEGORY);
+        std::vector<SnapshotFolder> folders;
+        std::vector<SnapshotGame> games;
+        std::vector<char> pool;
+        bool valid = true;
+
+        GAME::LockCategories();
+        // stamps first, a change landing while the categories are copied makes the next save rewrite it
+        GetCurrentState(&header);
+        for (int i = 0; i < TOTAL_CATEGORY; i++)
+        {
+            GameCategory *category = &game_categories[i];
+            categories[i].first_folder = folders.size();
+            categories[i].folder_count = category->folders.size();
+            for (int j = 0; j < category->folders.size(); j++)
+            {
+                Folder *folder = &category->folders[j];
+                SnapshotFolder record;
+                memset(&record, 0, sizeof(SnapshotFolder));
+                record.id = folder->id;
+                record.type = folder->type;
+                record.title = AddString(pool, folder->title, &record.title_length, &valid);
+                record.icon_path = AddString(pool, folder->icon_path, &record.icon_path_length, &valid);
+                record.first_game = games.size();
+                record.game_count = folder->games.size();
+                folders.push_back(record);
+
+                for (int k = 0; k < folder->games.size(); k++)
+                {
+                    Game *game = &folder->games[k];
+                    SnapshotGame entry;
+                    memset(&entry, 0, sizeof(SnapshotGame));
+                    entry.category = game->category;
+                    entry.type = game->type;
+                    entry.favorite = game->favorite;
+                    entry.folder_id = game->folder_id;
+                    entry.id = AddString(pool, game->id, &entry.id_length, &valid);
+                    entry.title = AddString(pool, game->title, &entry.title_length, &valid);
+                    entry.rom_path = AddString(pool, game->rom_path, &entry.rom_path_length, &valid);
+                    games.push_back(entry);
+                }
+            }
+        }
+        GAME::UnlockCategories();
+        if (!valid)
+        {
+            // the databases are read at the next boot, the stamps keep an older snapshot from loading
+            return;
+        }
+
+        header.magic = SNAPSHOT_MAGIC;
+        header.version = SNAPSHOT_VERSION;
+        header.header_size = sizeof(SnapshotHeader);
+        header.categories = TOTAL_CATEGORY;
+        header.folders = folders.size();
+        header.games = games.size();
+        header.pool_size = pool.size();
+        header.app_signature = vita_games_signature;
+
+        std::vector<char> data;
+        data.reserve(sizeof(SnapshotHeader) + categories.size() * sizeof(SnapshotCategory) +
+            folders.size() * sizeof(SnapshotFolder) + games.size() * sizeof(SnapshotGame) + pool.size());
+        data.resize(sizeof(SnapshotHeader));
+        data.insert(data.end(), (char*)categories.data(), (char*)(categories.data() + categories.size()));
+        data.insert(data.end(), (char*)folders.data(), (char*)(folders.data() + folders.size()));
+        data.insert(data.end(), (char*)games.data(), (char*)(games.data() + games.size()));
+        data.insert(data.end(), pool.begin(), pool.end());
+        header.checksum = Hash(0xcbf29ce484222325ULL, &data[sizeof(SnapshotHeader)], data.size() - sizeof(SnapshotHeader));
+        memcpy(data.data(), &header, sizeof(SnapshotHeader));
+
+        FS::Save(SNAPSHOT_FILE, data.data(), data.size());
+        current = header;
+        current_valid = true;
+    }
+
+    void SaveIfChanged()
+    {
+        // half scanned categories don't match what cache.db will hold once the scan is done
+        for (int i = 0; i < TOTAL_CATEGORY; i++)
+        {
+            if (game_categories[i].scan_pending)
+            {
+                return;
+            }
+        }
+
+        SnapshotHeader state;
+        GetCurrentState(&state);
+        if (current_valid && SameStamp(state.cache_db, current.cache_db) &&
+            SameStamp(state.app_db, current.app_db) && state.config_hash == current.config_hash)
+        {
+            return;
+        }
+        Save();
+    }
+}
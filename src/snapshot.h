@@ -0,0 +1,88 @@
+#ifndef LAUNCHER_SNAPSHOT_H
+#define LAUNCHER_SNAPSHOT_H
+
+#pragma once
+#include <cstdint>
+#include "game.h"
+
+#define SNAPSHOT_FILE "ux0:data/SMLA00001/library.bin"
+#define SNAPSHOT_MAGIC 0x534C4D53
+#define SNAPSHOT_VERSION 4
+// longest string a record can hold, Save writes no snapshot when a string is longer
+#define SNAPSHOT_MAX_STRING 0xFFFF
+
+// The games of every category as GAME::Scan leaves them, so a boot with an
+// unchanged cache.db reads one file instead of querying the databases.
+//
+//   SnapshotHeader
+//   SnapshotCategory[categories]  folders of each category, the root folder first
+//   SnapshotFolder[folders]       games of each folder, in sorted order
+//   SnapshotGame[games]
+//   char pool[pool_size]          the strings, records hold their offset and length
+//
+// checksum is the FNV-1a of everything after the header. The stamps are those of
+// the databases the library was read from when it was written, app_signature is
+// vita_games_signature of the bubbles it holds.
+typedef struct {
+    int64_t size;
+    uint64_t mtime;
+} SnapshotStamp;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t categories;
+    uint32_t folders;
+    uint32_t games;
+    uint32_t pool_size;
+    uint32_t reserved;
+    uint64_t checksum;
+    uint64_t config_hash;
+    uint64_t app_signature;
+    SnapshotStamp cache_db;
+    SnapshotStamp app_db;
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t first_folder;
+    uint32_t folder_count;
+} SnapshotCategory;
+
+typedef struct {
+    int32_t id;
+    uint32_t title;
+    uint32_t icon_path;
+    uint32_t first_game;
+    uint32_t game_count;
+    uint16_t title_length;
+    uint16_t icon_path_length;
+    uint8_t type;
+    uint8_t reserved[3];
+} SnapshotFolder;
+
+typedef struct {
+    uint32_t id;
+    uint32_t title;
+    uint32_t rom_path;
+    int32_t folder_id;
+    uint16_t id_length;
+    uint16_t title_length;
+    uint16_t rom_path_length;
+    uint8_t category;
+    uint8_t type;
+    uint8_t favorite;
+    uint8_t reserved[3];
+} SnapshotGame;
+
+namespace SNAPSHOT {
+    // Fills the categories and returns true when the snapshot matches cache.db.
+    // vita_games is false when app.db or the title id prefixes changed since, the
+    // bubbles have to be checked against DB::GetVitaDbGames and app_signature.
+    bool Load(bool *vita_games, uint64_t *app_signature);
+    void Save();
+    // writes the snapshot when the databases changed since it was loaded or saved
+    void SaveIfChanged();
+}
+
+#endif
@@ -0,0 +1,638 @@
+// Block cache for the sqlite vfs, see vfs_cache.h
+// Built with sqlite multi-thread like vita_sqlite.c. The file mutex protects the
+// shared blocks between connections on different threads, the sqlite locks of
+// the main db are kept next to them for the same reason.
+
+#include <stdlib.h>
+#include <string.h>
+#include "vfs_cache.h"
+
+// the stats are bumped under the mutexes of different files
+#define STAT_ADD(field, amount) __atomic_add_fetch(&vfs_cache_stats.field, (amount), __ATOMIC_RELAXED)
+
+// bytes 24..27 of the db header, bumped by every commit
+#define CHANGE_COUNTER_OFFSET 24
+#define CHANGE_COUNTER_SIZE 4
+
+typedef struct VfsCacheBlock {
+	sqlite_int64 index;  // -1 when free
+	int length;  // less than block_size past the end of the file
+	unsigned last_used;
+	char *data;
+} VfsCacheBlock;
+
+struct VfsCacheFile {
+	VfsCacheFile *next;
+	char *path;
+	int refs;
+	int fd;
+	int flags;
+	void *mutex;
+	VfsCacheConfig config;
+	sqlite_int64 size;
+
+	VfsCacheBlock *blocks;  // allocated by the first read
+	char *block_data;
+	char *staging;
+	unsigned tick;
+	sqlite_int64 next_miss;
+	int readahead;
+
+	unsigned char change_counter[CHANGE_COUNTER_SIZE];
+	int change_counter_known;
+
+	char *pending;
+	sqlite_int64 pending_offset;
+	int pending_length;
+
+	int shared_locks;  // connections holding SHARED or more
+	int write_lock;  // RESERVED, PENDING or EXCLUSIVE of the one connection writing
+};
+
+VfsCacheStats vfs_cache_stats;
+
+static const VfsBackend *backend;
+static VfsCacheConfig cache_config = {
+	VFS_CACHE_BLOCK_SIZE,
+	VFS_CACHE_BLOCKS,
+	VFS_CACHE_READAHEAD_BLOCKS,
+	VFS_CACHE_WRITE_BUFFER,
+};
+static void *files_mutex;
+static VfsCacheFile *files;
+
+void vfs_cache_init(const VfsBackend *b) {
+	backend = b;
+	files_mutex = backend->mutex_create();
+}
+
+void vfs_cache_configure(const VfsCacheConfig *config) {
+	cache_config = *config;
+	if (cache_config.blocks < 0)
+		cache_config.blocks = 0;
+	if (cache_config.block_size < 512)
+		cache_config.block_size = 512;
+	// a read ahead must never evict the blocks it just loaded
+	if (cache_config.readahead_blocks > cache_config.blocks / 2)
+		cache_config.readahead_blocks = cache_config.blocks / 2;
+	if (cache_config.readahead_blocks < 1)
+		cache_config.readahead_blocks = 1;
+	if (cache_config.write_buffer < 0)
+		cache_config.write_buffer = 0;
+}
+
+static int backend_read(VfsCacheFile *file, void *buf, int amount, sqlite_int64 offset) {
+	int read = backend->read(file->fd, buf, amount, offset);
+	STAT_ADD(backend_reads, 1);
+	if (read > 0)
+		STAT_ADD(backend_read_bytes, read);
+	return read;
+}
+
+static int backend_write(VfsCacheFile *file, const void *buf, int amount, sqlite_int64 offset) {
+	int written = backend->write(file->fd, buf, amount, offset);
+	STAT_ADD(backend_writes, 1);
+	if (written > 0)
+		STAT_ADD(backend_write_bytes, written);
+	return written;
+}
+
+static void drop_blocks(VfsCacheFile *file, sqlite_int64 from) {
+	if (file->blocks == NULL)
+		return;
+	for (int i = 0; i < file->config.blocks; i++) {
+		if (file->blocks[i].index >= from)
+			file->blocks[i].index = -1;
+	}
+	if (from == 0)
+		file->change_counter_known = 0;
+	file->next_miss = -1;
+}
+
+// blocks cut short by the end of the file, their tail changes when the file grows
+static void drop_partial_blocks(VfsCacheFile *file) {
+	if (file->blocks == NULL)
+		return;
+	for (int i = 0; i < file->config.blocks; i++) {
+		if (file->blocks[i].index >= 0 && file->blocks[i].length < file->config.block_size)
+			file->blocks[i].index = -1;
+	}
+}
+
+static int flush_pending(VfsCacheFile *file) {
+	if (file->pending_length == 0)
+		return SQLITE_OK;
+
+	int length = file->pending_length;
+	file->pending_length = 0;
+	if (backend_write(file, file->pending, length, file->pending_offset) != length) {
+		drop_blocks(file, 0);
+		file->size = backend->size(file->fd);
+		return SQLITE_IOERR_WRITE;
+	}
+	return SQLITE_OK;
+}
+
+static int flush_overlap(VfsCacheFile *file, sqlite_int64 offset, sqlite_int64 length) {
+	if (file->pending_length > 0 && offset < file->pending_offset + file->pending_length &&
+		offset + length > file->pending_offset)
+		return flush_pending(file);
+	return SQLITE_OK;
+}
+
+static int alloc_blocks(VfsCacheFile *file) {
+	int blocks = file->config.blocks;
+	int block_size = file->config.block_size;
+	file->blocks = (VfsCacheBlock*)calloc(blocks, sizeof(VfsCacheBlock));
+	file->block_data = (char*)malloc((size_t)blocks * block_size);
+	file->staging = (char*)malloc((size_t)file->config.readahead_blocks * block_size);
+	if (file->blocks == NULL || file->block_data == NULL || file->staging == NULL) {
+		free(file->blocks);
+		free(file->block_data);
+		free(file->staging);
+		file->blocks = NULL;
+		file->block_data = NULL;
+		file->staging = NULL;
+		file->config.blocks = 0;
+		return 0;
+	}
+	for (int i = 0; i < blocks; i++) {
+		file->blocks[i].index = -1;
+		file->blocks[i].data = file->block_data + (size_t)i * block_size;
+	}
+	return 1;
+}
+
+static VfsCacheBlock* find_block(VfsCacheFile *file, sqlite_int64 index) {
+	for (int i = 0; i < file->config.blocks; i++) {
+		if (file->blocks[i].index == index)
+			return &file->blocks[i];
+	}
+	return NULL;
+}
+
+static VfsCacheBlock* evict_block(VfsCacheFile *file) {
+	VfsCacheBlock *oldest = &file->blocks[0];
+	for (int i = 0; i < file->config.blocks; i++) {
+		if (file->blocks[i].index < 0)
+			return &file->blocks[i];
+		if (file->blocks[i].last_used < oldest->last_used)
+			oldest = &file->blocks[i];
+	}
+	return oldest;
+}
+
+static void remember_change_counter(VfsCacheFile *file, VfsCacheBlock *block) {
+	if (block->index == 0 && block->length >= CHANGE_COUNTER_OFFSET + CHANGE_COUNTER_SIZE) {
+		memcpy(file->change_counter, block->data + CHANGE_COUNTER_OFFSET, CHANGE_COUNTER_SIZE);
+		file->change_counter_known = 1;
+	}
+}
+
+// Loads index and, when it continues the last miss, up to readahead blocks after it
+// in one backend read. Stops at blocks already cached and at the end of the file.
+static VfsCacheBlock* load_blocks(VfsCacheFile *file, sqlite_int64 index, int *rc) {
+	sqlite_int64 block_size = file->config.block_size;
+	if (index == file->next_miss) {
+		file->readahead *= 2;
+		if (file->readahead > file->config.readahead_blocks)
+			file->readahead = file->config.readahead_blocks;
+	}
+	else {
+		file->readahead = 1;
+	}
+
+	int count = 1;
+	while (count < file->readahead && (index + count) * block_size < file->size &&
+		find_block(file, index + count) == NULL)
+		count++;
+
+	*rc = flush_overlap(file, index * block_size, count * block_size);
+	if (*rc != SQLITE_OK)
+		return NULL;
+
+	int read = backend_read(file, file->staging, count * block_size, index * block_size);
+	if (read < 0) {
+		*rc = SQLITE_IOERR_READ;
+		return NULL;
+	}
+
+	VfsCacheBlock *first = NULL;
+	for (int i = 0; i < count; i++) {
+		VfsCacheBlock *block = evict_block(file);
+		int length = read - i * block_size;
+		block->index = index + i;
+		block->length = length < 0 ? 0 : (length > block_size ? block_size : length);
+		block->last_used = ++file->tick;
+		memcpy(block->data, file->staging + i * block_size, block->length);
+		remember_change_counter(file, block);
+		if (i == 0)
+			first = block;
+	}
+	file->next_miss = index + count;
+	return first;
+}
+
+static int read_through(VfsCacheFile *file, void *buf, int amount, sqlite_int64 offset) {
+	int read = backend_read(file, buf, amount, offset);
+	if (read == amount)
+		return SQLITE_OK;
+	else if (read >= 0) {
+		memset((char*)buf + read, 0, amount - read);
+		return SQLITE_IOERR_SHORT_READ;
+	}
+	return SQLITE_IOERR_READ;
+}
+
+static int read_cached(VfsCacheFile *file, void *buf, int amount, sqlite_int64 offset) {
+	sqlite_int64 block_size = file->config.block_size;
+	sqlite_int64 first = offset / block_size;
+	sqlite_int64 last = (offset + amount - 1) / block_size;
+	char *out = (char*)buf;
+	int short_read = 0;
+	int hit = 1;
+
+	for (sqlite_int64 index = first; index <= last; index++) {
+		int start = index == first ? (int)(offset - index * block_size) : 0;
+		int end = index == last ? (int)(offset + amount - index * block_size) : (int)block_size;
+
+		if (index * block_size >= file->size) {
+			memset(out, 0, end - start);
+			out += end - start;
+			short_read = 1;
+			continue;
+		}
+
+		VfsCacheBlock *block = find_block(file, index);
+		if (block == NULL) {
+			int rc;
+			hit = 0;
+			block = load_blocks(file, index, &rc);
+			if (block == NULL)
+				return rc;
+		}
+		block->last_used = ++file->tick;
+
+		int available = block->length - start;
+		if (available > end - start)
+			available = end - start;
+		if (available < 0)
+			available = 0;
+		memcpy(out, block->data + start, available);
+		if (available < end - start) {
+			memset(out + available, 0, end - start - available);
+			short_read = 1;
+		}
+		out += end - start;
+	}
+
+	if (hit)
+		STAT_ADD(read_hits, 1);
+	return short_read ? SQLITE_IOERR_SHORT_READ : SQLITE_OK;
+}
+
+static void update_blocks(VfsCacheFile *file, const void *buf, int amount, sqlite_int64 offset) {
+	if (file->blocks == NULL)
+		return;
+
+	sqlite_int64 block_size = file->config.block_size;
+	for (int i = 0; i < file->config.blocks; i++) {
+		VfsCacheBlock *block = &file->blocks[i];
+		if (block->index < 0)
+			continue;
+		sqlite_int64 block_start = block->index * block_size;
+		sqlite_int64 start = offset > block_start ? offset : block_start;
+		sqlite_int64 end = offset + amount < block_start + block->length ? offset + amount : block_start + block->length;
+		if (start < end)
+			memcpy(block->data + (start - block_start), (const char*)buf + (start - offset), end - start);
+	}
+}
+
+VfsCacheFile* vfs_cache_open(const char *path, int flags) {
+	backend->mutex_lock(files_mutex);
+	VfsCacheFile *file = files;
+	while (file != NULL && strcmp(file->path, path) != 0)
+		file = file->next;
+
+	if (file != NULL) {
+		// opened read only first, reopen the shared fd for writing
+		if ((flags & SQLITE_OPEN_READWRITE) && !(file->flags & SQLITE_OPEN_READWRITE)) {
+			int fd = backend->open(path, flags);
+			if (fd < 0) {
+				backend->mutex_unlock(files_mutex);
+				return NULL;
+			}
+			backend->mutex_lock(file->mutex);
+			backend->close(file->fd);
+			file->fd = fd;
+			file->flags = flags;
+			backend->mutex_unlock(file->mutex);
+		}
+		file->refs++;
+		backend->mutex_unlock(files_mutex);
+		return file;
+	}
+
+	int fd = backend->open(path, flags);
+	if (fd < 0) {
+		backend->mutex_unlock(files_mutex);
+		return NULL;
+	}
+
+	file = (VfsCacheFile*)calloc(1, sizeof(VfsCacheFile));
+	file->path = strdup(path);
+	file->refs = 1;
+	file->fd = fd;
+	file->flags = flags;
+	file->mutex = backend->mutex_create();
+	file->config = cache_config;
+	file->size = backend->size(fd);
+	file->next_miss = -1;
+	file->readahead = 1;
+	if (file->config.write_buffer > 0)
+		file->pending = (char*)malloc(file->config.write_buffer);
+	if (file->pending == NULL)
+		file->config.write_buffer = 0;
+
+	file->next = files;
+	files = file;
+	backend->mutex_unlock(files_mutex);
+	return file;
+}
+
+int vfs_cache_close(VfsCacheFile *file) {
+	backend->mutex_lock(files_mutex);
+	backend->mutex_lock(file->mutex);
+	int rc = flush_pending(file);
+	backend->mutex_unlock(file->mutex);
+
+	if (--file->refs == 0) {
+		VfsCacheFile **link = &files;
+		while (*link != file)
+			link = &(*link)->next;
+		*link = file->next;
+
+		backend->close(file->fd);
+		backend->mutex_delete(file->mutex);
+		free(file->path);
+		free(file->blocks);
+		free(file->block_data);
+		free(file->staging);
+		free(file->pending);
+		free(file);
+	}
+	backend->mutex_unlock(files_mutex);
+	return rc;
+}
+
+int vfs_cache_read(VfsCacheFile *file, void *buf, int amount, sqlite_int64 offset) {
+	int rc;
+	backend->mutex_lock(file->mutex);
+	if (backend->trace)
+		backend->trace('r', file->path, offset, amount);
+	STAT_ADD(reads, 1);
+
+	if (file->config.blocks == 0 || (file->blocks == NULL && !alloc_blocks(file))) {
+		rc = flush_overlap(file, offset, amount);
+		if (rc == SQLITE_OK)
+			rc = read_through(file, buf, amount, offset);
+	}
+	else {
+		rc = read_cached(file, buf, amount, offset);
+	}
+	backend->mutex_unlock(file->mutex);
+	return rc;
+}
+
+int vfs_cache_write(VfsCacheFile *file, const void *buf, int amount, sqlite_int64 offset) {
+	int rc = SQLITE_OK;
+	backend->mutex_lock(file->mutex);
+	if (backend->trace)
+		backend->trace('w', file->path, offset, amount);
+	STAT_ADD(writes, 1);
+
+	sqlite_int64 end = offset + amount;
+	if (end > file->size) {
+		drop_partial_blocks(file);
+		file->size = end;
+	}
+	update_blocks(file, buf, amount, offset);
+	// block 0 may not be cached, our own commits must not look like someone else's
+	if (offset <= CHANGE_COUNTER_OFFSET && end >= CHANGE_COUNTER_OFFSET + CHANGE_COUNTER_SIZE) {
+		memcpy(file->change_counter, (const char*)buf + (CHANGE_COUNTER_OFFSET - offset), CHANGE_COUNTER_SIZE);
+		file->change_counter_known = 1;
+	}
+
+	if (amount <= file->config.write_buffer) {
+		if (file->pending_length > 0 && offset >= file->pending_offset &&
+			end <= file->pending_offset + file->pending_length) {
+			// rewrites a page still held back
+			memcpy(file->pending + (offset - file->pending_offset), buf, amount);
+		}
+		else {
+			if (file->pending_length > 0 && (offset != file->pending_offset + file->pending_length ||
+				file->pending_length + amount > file->config.write_buffer))
+				rc = flush_pending(file);
+			if (rc == SQLITE_OK) {
+				if (file->pending_length == 0)
+					file->pending_offset = offset;
+				memcpy(file->pending + file->pending_length, buf, amount);
+				file->pending_length += amount;
+			}
+		}
+	}
+	else {
+		rc = flush_pending(file);
+		if (rc == SQLITE_OK && backend_write(file, buf, amount, offset) != amount) {
+			drop_blocks(file, 0);
+			file->size = backend->size(file->fd);
+			rc = SQLITE_IOERR_WRITE;
+		}
+	}
+	backend->mutex_unlock(file->mutex);
+	return rc;
+}
+
+int vfs_cache_truncate(VfsCacheFile *file, sqlite_int64 size) {
+	backend->mutex_lock(file->mutex);
+	int rc = flush_pending(file);
+	if (rc == SQLITE_OK && backend->truncate(file->fd, size) < 0)
+		rc = SQLITE_IOERR_TRUNCATE;
+	file->size = backend->size(file->fd);
+	drop_blocks(file, file->size / file->config.block_size);
+	backend->mutex_unlock(file->mutex);
+	return rc;
+}
+
+int vfs_cache_sync(VfsCacheFile *file) {
+	backend->mutex_lock(file->mutex);
+	int rc = flush_pending(file);
+	backend->mutex_unlock(file->mutex);
+	return rc;
+}
+
+int vfs_cache_file_size(VfsCacheFile *file, sqlite_int64 *size) {
+	backend->mutex_lock(file->mutex);
+	*size = file->size;
+	backend->mutex_unlock(file->mutex);
+	return SQLITE_OK;
+}
+
+// A read transaction starts. The shell or another process may have changed the
+// db since our blocks were read, its change counter tells.
+static int check_change_counter(VfsCacheFile *file) {
+	int rc = SQLITE_OK;
+	if (file->change_counter_known) {
+		unsigned char change_counter[CHANGE_COUNTER_SIZE];
+		rc = flush_pending(file);
+		if (rc == SQLITE_OK &&
+			(backend_read(file, change_counter, CHANGE_COUNTER_SIZE, CHANGE_COUNTER_OFFSET) != CHANGE_COUNTER_SIZE ||
+			memcmp(change_counter, file->change_counter, CHANGE_COUNTER_SIZE) != 0)) {
+			drop_blocks(file, 0);
+			file->size = backend->size(file->fd);
+			STAT_ADD(invalidations, 1);
+		}
+	}
+	return rc;
+}
+
+// Locks between the connections of this process, which share the journal as well.
+// Readers hold SHARED, the one writer RESERVED until it commits, then PENDING to
+// keep new readers out and EXCLUSIVE once the others are done. held is the level
+// of the calling connection, SQLITE_BUSY leaves it for the busy handler to retry.
+int vfs_cache_lock(VfsCacheFile *file, int *held, int lock) {
+	int rc = SQLITE_OK;
+	if (*held >= lock)
+		return rc;
+	if (!(file->flags & SQLITE_OPEN_MAIN_DB)) {
+		*held = lock;
+		return rc;
+	}
+
+	backend->mutex_lock(file->mutex);
+	if (lock == SQLITE_LOCK_SHARED) {
+		if (file->write_lock >= SQLITE_LOCK_PENDING)
+			rc = SQLITE_BUSY;
+		else {
+			file->shared_locks++;
+			*held = SQLITE_LOCK_SHARED;
+			rc = check_change_counter(file);
+		}
+	}
+	else if (*held < SQLITE_LOCK_RESERVED && file->write_lock != SQLITE_LOCK_NONE)
+		rc = SQLITE_BUSY;
+	else if (lock == SQLITE_LOCK_RESERVED)
+		file->write_lock = *held = SQLITE_LOCK_RESERVED;
+	else {
+		file->write_lock = *held = SQLITE_LOCK_PENDING;
+		if (lock == SQLITE_LOCK_EXCLUSIVE) {
+			if (file->shared_locks > 1)
+				rc = SQLITE_BUSY;
+			else
+				file->write_lock = *held = SQLITE_LOCK_EXCLUSIVE;
+		}
+	}
+	backend->mutex_unlock(file->mutex);
+	return rc;
+}
+
+int vfs_cache_unlock(VfsCacheFile *file, int *held, int lock) {
+	backend->mutex_lock(file->mutex);
+	if ((file->flags & SQLITE_OPEN_MAIN_DB) && *held > lock) {
+		if (*held >= SQLITE_LOCK_RESERVED)
+			file->write_lock = SQLITE_LOCK_NONE;
+		if (lock == SQLITE_LOCK_NONE)
+			file->shared_locks--;
+	}
+	*held = lock;
+	int rc = flush_pending(file);
+	backend->mutex_unlock(file->mutex);
+	return rc;
+}
+
+int vfs_cache_check_reserved_lock(VfsCacheFile *file, int *reserved) {
+	backend->mutex_lock(file->mutex);
+	*reserved = file->write_lock >= SQLITE_LOCK_RESERVED;
+	backend->mutex_unlock(file->mutex);
+	return SQLITE_OK;
+}
+
+// sqlite io methods
+static int vfs_xClose(sqlite3_file *pFile) {
+	return vfs_cache_close(((VfsFile*)pFile)->shared);
+}
+
+static int vfs_xRead(sqlite3_file *pFile, void *zBuf, int iAmt, sqlite_int64 iOfst) {
+	return vfs_cache_read(((VfsFile*)pFile)->shared, zBuf, iAmt, iOfst);
+}
+
+static int vfs_xWrite(sqlite3_file *pFile, const void *zBuf, int iAmt, sqlite_int64 iOfst) {
+	return vfs_cache_write(((VfsFile*)pFile)->shared, zBuf, iAmt, iOfst);
+}
+
+static int vfs_xTruncate(sqlite3_file *pFile, sqlite_int64 size) {
+	return vfs_cache_truncate(((VfsFile*)pFile)->shared, size);
+}
+
+static int vfs_xSync(sqlite3_file *pFile, int flags) {
+	return vfs_cache_sync(((VfsFile*)pFile)->shared);
+}
+
+static int vfs_xFileSize(sqlite3_file *pFile, sqlite_int64 *pSize) {
+	return vfs_cache_file_size(((VfsFile*)pFile)->shared, pSize);
+}
+
+static int vfs_xLock(sqlite3_file *pFile, int eLock) {
+	return vfs_cache_lock(((VfsFile*)pFile)->shared, &((VfsFile*)pFile)->lock, eLock);
+}
+
+static int vfs_xUnlock(sqlite3_file *pFile, int eLock) {
+	return vfs_cache_unlock(((VfsFile*)pFile)->shared, &((VfsFile*)pFile)->lock, eLock);
+}
+
+static int vfs_xCheckReservedLock(sqlite3_file *pFile, int *pResOut) {
+	return vfs_cache_check_reserved_lock(((VfsFile*)pFile)->shared, pResOut);
+}
+
+static int vfs_xFileControl(sqlite3_file *pFile, int op, void *pArg) {
+	return SQLITE_OK;
+}
+
+static int vfs_xSectorSize(sqlite3_file *pFile) {
+	return 512;
+}
+
+static int vfs_xDeviceCharacteristics(sqlite3_file *pFile) {
+	return 0;
+}
+
+int vfs_cache_xOpen(sqlite3_vfs *vfs, const char *name, sqlite3_file *file, int flags, int *outFlags) {
+	static const sqlite3_io_methods cache_io = {
+		1,
+		vfs_xClose,
+		vfs_xRead,
+		vfs_xWrite,
+		vfs_xTruncate,
+		vfs_xSync,
+		vfs_xFileSize,
+		vfs_xLock,
+		vfs_xUnlock,
+		vfs_xCheckReservedLock,
+		vfs_xFileControl,
+		vfs_xSectorSize,
+		vfs_xDeviceCharacteristics,
+	};
+
+	VfsFile *p = (VfsFile*)file;
+	memset(p, 0, sizeof(*p));
+	if (name == NULL)
+		return SQLITE_CANTOPEN;
+	p->shared = vfs_cache_open(name, flags);
+	if (p->shared == NULL)
+		return SQLITE_CANTOPEN;
+	if (outFlags)
+		*outFlags = flags;
+
+	p->base.pMethods = &cache_io;
+	return SQLITE_OK;
+}
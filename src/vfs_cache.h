@@ -0,0 +1,86 @@
+#ifndef LAUNCHER_VFS_CACHE_H
+#define LAUNCHER_VFS_CACHE_H
+
+// Block cache between sqlite and the file system, shared by every connection that
+// opens the same path. Misses read ahead once they are sequential, contiguous
+// writes are held back and written in one call at unlock, sync or close.
+// The platform side is a VfsBackend, vita_sqlite.c on the vita and
+// tools/vfs_posix.c on the desktop, where tools/vfs_bench.c replays recorded I/O.
+
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VFS_CACHE_BLOCK_SIZE 4096
+#define VFS_CACHE_BLOCKS 32
+#define VFS_CACHE_READAHEAD_BLOCKS 8
+#define VFS_CACHE_WRITE_BUFFER 65536
+
+typedef struct VfsBackend {
+	int (*open)(const char *path, int flags);  // SQLITE_OPEN_* flags, returns the fd or < 0
+	void (*close)(int fd);
+	int (*read)(int fd, void *buf, int amount, sqlite_int64 offset);  // bytes read or < 0
+	int (*write)(int fd, const void *buf, int amount, sqlite_int64 offset);  // bytes written or < 0
+	sqlite_int64 (*size)(int fd);
+	int (*truncate)(int fd, sqlite_int64 size);
+	void* (*mutex_create)(void);
+	void (*mutex_lock)(void *mutex);
+	void (*mutex_unlock)(void *mutex);
+	void (*mutex_delete)(void *mutex);
+	void (*trace)(char op, const char *path, sqlite_int64 offset, int amount);  // may be NULL
+} VfsBackend;
+
+// Taken by files opened after vfs_cache_configure. blocks 0 reads straight
+// from the backend, write_buffer 0 writes straight through.
+typedef struct VfsCacheConfig {
+	int block_size;
+	int blocks;
+	int readahead_blocks;
+	int write_buffer;
+} VfsCacheConfig;
+
+typedef struct VfsCacheStats {
+	int reads;
+	int read_hits;
+	int writes;
+	int backend_reads;
+	sqlite_int64 backend_read_bytes;
+	int backend_writes;
+	sqlite_int64 backend_write_bytes;
+	int invalidations;
+} VfsCacheStats;
+
+typedef struct VfsCacheFile VfsCacheFile;
+
+typedef struct VfsFile {
+	sqlite3_file base;
+	VfsCacheFile *shared;
+	int lock;  // SQLITE_LOCK_* this connection holds
+} VfsFile;
+
+extern VfsCacheStats vfs_cache_stats;
+
+void vfs_cache_init(const VfsBackend *backend);
+void vfs_cache_configure(const VfsCacheConfig *config);
+
+VfsCacheFile* vfs_cache_open(const char *path, int flags);
+int vfs_cache_close(VfsCacheFile *file);
+int vfs_cache_read(VfsCacheFile *file, void *buf, int amount, sqlite_int64 offset);
+int vfs_cache_write(VfsCacheFile *file, const void *buf, int amount, sqlite_int64 offset);
+int vfs_cache_truncate(VfsCacheFile *file, sqlite_int64 size);
+int vfs_cache_sync(VfsCacheFile *file);
+int vfs_cache_file_size(VfsCacheFile *file, sqlite_int64 *size);
+int vfs_cache_lock(VfsCacheFile *file, int *held, int lock);
+int vfs_cache_unlock(VfsCacheFile *file, int *held, int lock);
+int vfs_cache_check_reserved_lock(VfsCacheFile *file, int *reserved);
+
+// xOpen of a sqlite3_vfs with szOsFile sizeof(VfsFile)
+int vfs_cache_xOpen(sqlite3_vfs *vfs, const char *name, sqlite3_file *file, int flags, int *outFlags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
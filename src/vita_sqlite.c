@@ -1,14 +1,19 @@
 // This was only tested with sqlite 3.6.23.1
-// Please note that this .c file does not implement thread safety for sqlite, and as such requires it to be built with -DSQLITE_THREADSAFE=0 as well
-// Build flags for sqlite: -DSQLITE_OS_OTHER=1 -DSQLITE_TEMP_STORE=3 -DSQLITE_THREADSAFE=0
+// The launcher runs connections on several threads, one thread per connection at a time, so sqlite
+// is built multi-thread and vita_sqlite_init installs the kernel mutexes below before first use
+// Build flags for sqlite: -DSQLITE_OS_OTHER=1 -DSQLITE_TEMP_STORE=3 -DSQLITE_THREADSAFE=2
 
 // It's also hacky -- no sync support, no tempdir support, access returning bs, etc... don't use in production!
 
 // based on test_demovfs.c
 
 #include "sqlite3.h"
+#include "vfs_cache.h"
+#include "vita_sqlite.h"
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <psp2/io/fcntl.h>
 #include <psp2/io/stat.h>
@@ -22,133 +27,105 @@
 #define LOG(...)
 #endif
 
-typedef struct VitaFile {
-	sqlite3_file base;
-	unsigned fd;
-} VitaFile;
+#define VFS_TRACE 0
+#define VFS_TRACE_FILE "ux0:data/SMLA00001/vfs_trace.log"
 
-// File ops
-static int vita_xClose(sqlite3_file *pFile) {
-	VitaFile *p = (VitaFile*)pFile;
-	sceIoClose(p->fd);
-	LOG("close %x\n", p->fd);
-	return SQLITE_OK;
+// pages go through the block cache in vfs_cache.c, these are its file operations
+static int vita_open(const char *name, int flags) {
+	unsigned oflags = 0;
+	if (flags & SQLITE_OPEN_EXCLUSIVE)
+		oflags |= SCE_O_EXCL;
+	if (flags & SQLITE_OPEN_CREATE)
+		oflags |= SCE_O_CREAT;
+	if (flags & SQLITE_OPEN_READONLY)
+		oflags |= SCE_O_RDONLY;
+	if (flags & SQLITE_OPEN_READWRITE)
+		oflags |= SCE_O_RDWR;
+	// TODO(xyz): sqlite tries to open inexistant journal and then tries to read from it, wtf?
+	// so force O_CREAT here
+	if (flags & SQLITE_OPEN_MAIN_JOURNAL && !(flags & SQLITE_OPEN_EXCLUSIVE))
+		oflags |= SCE_O_CREAT;
+	int fd = sceIoOpen(name, oflags, 7);
+	LOG("open %s %x orig flags %x => %x\n", name, oflags, flags, fd);
+	return fd;
 }
 
-static int vita_xRead(sqlite3_file *pFile, void *zBuf, int iAmt, sqlite_int64 iOfst) {
-	VitaFile *p = (VitaFile*)pFile;
-	memset(zBuf, 0, iAmt);
-	sceIoLseek(p->fd, iOfst, SCE_SEEK_SET);
-	int read = sceIoRead(p->fd, zBuf, iAmt);
-	LOG("read %x %x %x => %x\n", p->fd, zBuf, iAmt, read);
-	if (read == iAmt)
-		return SQLITE_OK;
-	else if (read >= 0)
-		return SQLITE_IOERR_SHORT_READ;
-	return SQLITE_IOERR_READ;
-}
-
-static int vita_xWrite(sqlite3_file *pFile, const void *zBuf, int iAmt, sqlite_int64 iOfst) {
-	VitaFile *p = (VitaFile*)pFile;
-	int ofst = sceIoLseek(p->fd, iOfst, SCE_SEEK_SET);
-	LOG("seek %x %x => %x\n", p->fd, iOfst, ofst);
-	if (ofst != iOfst)
-		return SQLITE_IOERR_WRITE;
-	int write = sceIoWrite(p->fd, zBuf, iAmt);
-	LOG("write %x %x %x => %x\n", p->fd, zBuf, iAmt);
-	if (write != iAmt)
-		return SQLITE_IOERR_WRITE;
-	return SQLITE_OK;
+static void vita_close(int fd) {
+	sceIoClose(fd);
+	LOG("close %x\n", fd);
 }
 
-static int vita_xTruncate(sqlite3_file *pFile, sqlite_int64 size) {
-	LOG("truncate\n");
-	return SQLITE_OK;
+static int vita_read(int fd, void *buf, int amount, sqlite_int64 offset) {
+	int read = sceIoPread(fd, buf, amount, offset);
+	LOG("read %x %x %llx => %x\n", fd, amount, offset, read);
+	return read;
 }
 
-static int vita_xSync(sqlite3_file *pFile, int flags) {
-	return SQLITE_OK;
+static int vita_write(int fd, const void *buf, int amount, sqlite_int64 offset) {
+	int write = sceIoPwrite(fd, buf, amount, offset);
+	LOG("write %x %x %llx => %x\n", fd, amount, offset, write);
+	return write;
 }
 
-static int vita_xFileSize(sqlite3_file *pFile, sqlite_int64 *pSize) {
-	VitaFile *p = (VitaFile*)pFile;
+static sqlite_int64 vita_size(int fd) {
 	SceIoStat stat = {0};
-	sceIoGetstatByFd(p->fd, &stat);
-	LOG("filesize %x => %x\n", p->fd, stat.st_size);
-	*pSize = stat.st_size;
-	return SQLITE_OK;
+	sceIoGetstatByFd(fd, &stat);
+	LOG("filesize %x => %x\n", fd, stat.st_size);
+	return stat.st_size;
 }
 
-static int vita_xLock(sqlite3_file *pFile, int eLock) {
-	return SQLITE_OK;
+static int vita_truncate(int fd, sqlite_int64 size) {
+	LOG("truncate\n");
+	return 0;
 }
 
-static int vita_xUnlock(sqlite3_file *pFile, int eLock) {
-	return SQLITE_OK;
+static void* vita_mutex_create(void) {
+	return (void*)(intptr_t)sceKernelCreateMutex("vfs_cache_mutex", 0, 0, NULL);
 }
 
-static int vita_xCheckReservedLock(sqlite3_file *pFile, int *pResOut) {
-	*pResOut = 0;
-	return SQLITE_OK;
+static void vita_mutex_lock(void *mutex) {
+	sceKernelLockMutex((SceUID)(intptr_t)mutex, 1, NULL);
 }
 
-static int vita_xFileControl(sqlite3_file *pFile, int op, void *pArg) {
-	return SQLITE_OK;
+static void vita_mutex_unlock(void *mutex) {
+	sceKernelUnlockMutex((SceUID)(intptr_t)mutex, 1);
 }
 
-static int vita_xSectorSize(sqlite3_file *pFile) {
-	return 0;
+static void vita_mutex_delete(void *mutex) {
+	sceKernelDeleteMutex((SceUID)(intptr_t)mutex);
 }
 
-static int vita_xDeviceCharacteristics(sqlite3_file *pFile) {
-	return 0;
+#if VFS_TRACE
+// one "r|w offset amount path" line per sqlite read and write, for tools/vfs_bench.c
+static void vita_trace(char op, const char *path, sqlite_int64 offset, int amount) {
+	static SceUID trace_fd = -1;
+	if (trace_fd < 0)
+		trace_fd = sceIoOpen(VFS_TRACE_FILE, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_APPEND, 0777);
+	if (trace_fd < 0)
+		return;
+	char line[320];
+	int length = snprintf(line, sizeof(line), "%c %lld %d %s\n", op, offset, amount, path);
+	sceIoWrite(trace_fd, line, length);
 }
+#endif
 
-// VFS ops
-static int vita_xOpen(sqlite3_vfs *vfs, const char *name, sqlite3_file *file, int flags, int *outFlags) {
-	static const sqlite3_io_methods vitaio = {
-		1,
-		vita_xClose,
-		vita_xRead,
-		vita_xWrite,
-		vita_xTruncate,
-		vita_xSync,
-		vita_xFileSize,
-		vita_xLock,
-		vita_xUnlock,
-		vita_xCheckReservedLock,
-		vita_xFileControl,
-		vita_xSectorSize,
-		vita_xDeviceCharacteristics,
-	};
-
-	VitaFile *p = (VitaFile*)file;
-	unsigned oflags = 0;
-	if (flags & SQLITE_OPEN_EXCLUSIVE)
-		oflags |= SCE_O_EXCL;
-	if (flags & SQLITE_OPEN_CREATE)
-		oflags |= SCE_O_CREAT;
-	if (flags & SQLITE_OPEN_READONLY)
-		oflags |= SCE_O_RDONLY;
-	if (flags & SQLITE_OPEN_READWRITE)
-		oflags |= SCE_O_RDWR;
-	// TODO(xyz): sqlite tries to open inexistant journal and then tries to read from it, wtf?
-	// so force O_CREAT here
-	if (flags & SQLITE_OPEN_MAIN_JOURNAL && !(flags & SQLITE_OPEN_EXCLUSIVE))
-		oflags |= SCE_O_CREAT;
-	memset(p, 0, sizeof(*p));
-	p->fd = sceIoOpen(name, oflags, 7);
-	LOG("open %s %x orig flags %x => %x\n", name, oflags, flags, p->fd);
-	if (p->fd < 0) {
-		return SQLITE_CANTOPEN;
-	}
-	if (outFlags)
-		*outFlags = flags;
-
-	p->base.pMethods = &vitaio;
-
-	return SQLITE_OK;
-}
+static const VfsBackend vita_backend = {
+	vita_open,
+	vita_close,
+	vita_read,
+	vita_write,
+	vita_size,
+	vita_truncate,
+	vita_mutex_create,
+	vita_mutex_lock,
+	vita_mutex_unlock,
+	vita_mutex_delete,
+#if VFS_TRACE
+	vita_trace,
+#else
+	NULL,
+#endif
+};
 
 int vita_xDelete(sqlite3_vfs *vfs, const char *name, int syncDir) {
 	int ret = sceIoRemove(name);
@@ -205,12 +182,12 @@ int vita_xGetLastError(sqlite3_vfs *vfs, int e, char *err) {
 
 sqlite3_vfs vita_vfs = {
 	.iVersion = 1,
-	.szOsFile = sizeof(VitaFile),
+	.szOsFile = sizeof(VfsFile),
 	.mxPathname = 0x100,
 	.pNext = NULL,
 	.zName = "psp2",
 	.pAppData = NULL,
-	.xOpen = vita_xOpen,
+	.xOpen = vfs_cache_xOpen,
 	.xDelete = vita_xDelete,
 	.xAccess = vita_xAccess,
 	.xFullPathname = vita_xFullPathname,
@@ -224,7 +201,94 @@ sqlite3_vfs vita_vfs = {
 	.xGetLastError = vita_xGetLastError,
 };
 
+// sqlite has no mutexes of its own with SQLITE_OS_OTHER, these guard its page cache,
+// allocator and the other globals shared by all connections
+struct sqlite3_mutex {
+	SceUID uid;
+	int id;
+};
+
+#define VITA_STATIC_MUTEXES (SQLITE_MUTEX_STATIC_LRU2 - SQLITE_MUTEX_STATIC_MASTER + 1)
+static sqlite3_mutex static_mutexes[VITA_STATIC_MUTEXES];
+
+static int vita_xMutexInit(void) {
+	for (int i = 0; i < VITA_STATIC_MUTEXES; i++) {
+		if (static_mutexes[i].uid <= 0) {
+			static_mutexes[i].uid = sceKernelCreateMutex("sqlite_static_mutex", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
+			static_mutexes[i].id = SQLITE_MUTEX_STATIC_MASTER + i;
+		}
+	}
+	return SQLITE_OK;
+}
+
+static int vita_xMutexEnd(void) {
+	return SQLITE_OK;
+}
+
+static sqlite3_mutex* vita_xMutexAlloc(int id) {
+	if (id >= SQLITE_MUTEX_STATIC_MASTER && id <= SQLITE_MUTEX_STATIC_LRU2)
+		return &static_mutexes[id - SQLITE_MUTEX_STATIC_MASTER];
+
+	// sqlite3_malloc would start initializing sqlite again from inside its initialization
+	sqlite3_mutex *mutex = (sqlite3_mutex*)malloc(sizeof(sqlite3_mutex));
+	if (mutex == NULL)
+		return NULL;
+	mutex->id = id;
+	mutex->uid = sceKernelCreateMutex("sqlite_mutex", id == SQLITE_MUTEX_RECURSIVE ? SCE_KERNEL_MUTEX_ATTR_RECURSIVE : 0, 0, NULL);
+	if (mutex->uid < 0) {
+		free(mutex);
+		return NULL;
+	}
+	return mutex;
+}
+
+static void vita_xMutexFree(sqlite3_mutex *mutex) {
+	sceKernelDeleteMutex(mutex->uid);
+	free(mutex);
+}
+
+static void vita_xMutexEnter(sqlite3_mutex *mutex) {
+	sceKernelLockMutex(mutex->uid, 1, NULL);
+}
+
+static int vita_xMutexTry(sqlite3_mutex *mutex) {
+	return sceKernelTryLockMutex(mutex->uid, 1) < 0 ? SQLITE_BUSY : SQLITE_OK;
+}
+
+static void vita_xMutexLeave(sqlite3_mutex *mutex) {
+	sceKernelUnlockMutex(mutex->uid, 1);
+}
+
+// only asserted on in debug builds of sqlite
+static int vita_xMutexHeld(sqlite3_mutex *mutex) {
+	return 1;
+}
+
+static int vita_xMutexNotheld(sqlite3_mutex *mutex) {
+	return 1;
+}
+
+static sqlite3_mutex_methods vita_mutex_methods = {
+	vita_xMutexInit,
+	vita_xMutexEnd,
+	vita_xMutexAlloc,
+	vita_xMutexFree,
+	vita_xMutexEnter,
+	vita_xMutexTry,
+	vita_xMutexLeave,
+	vita_xMutexHeld,
+	vita_xMutexNotheld,
+};
+
+int vita_sqlite_init(void) {
+	int rc = sqlite3_config(SQLITE_CONFIG_MUTEX, &vita_mutex_methods);
+	if (rc != SQLITE_OK)
+		return rc;
+	return sqlite3_initialize();
+}
+
 int sqlite3_os_init(void) {
+	vfs_cache_init(&vita_backend);
 	sqlite3_vfs_register(&vita_vfs, 1);
 	return 0;
 }
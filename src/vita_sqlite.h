@@ -0,0 +1,16 @@
+#ifndef LAUNCHER_VITA_SQLITE_H
+#define LAUNCHER_VITA_SQLITE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Installs the kernel mutexes sqlite needs with SQLITE_THREADSAFE=2 and initializes
+// it, before any connection is opened.
+int vita_sqlite_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,6 +30,9 @@ namespace Windows {
     }
 
     void Init();
+    // selected_game and game_to_boot from their handles, called with the categories locked
+    void ResolveHandles();
+    void UpdateHandles();
     void HandleLauncherWindowInput();
     void LauncherWindow();
     void ShowGridViewWindow();
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# Adds the token index DB::FindMatchingThumbnail reads to thumbnails databases.
+#
+#   thumbnail_ranks   one row, the rowids of the thumbnails ordered by
+#                     length(filename) then rowid, packed as uint32 LE
+#   thumbnail_tokens  every lower case alphanumeric run of the file names with
+#                     the ascending ranks of the names it occurs in, each stored
+#                     as the LEB128 varint of its difference to the previous one.
+#                     "#1".."#8" hold the names matching an arabic numeral
+#                     or its roman alias, which is looked up through the same key.
+#
+# usage: build_token_index.py thumbnails_db/*.db
+
+import re
+import sqlite3
+import struct
+import sys
+
+NUMERALS = [("1", "I"), ("2", "II"), ("3", "III"), ("4", "IV"),
+            ("5", "V"), ("6", "VI"), ("7", "VII"), ("8", "VIII")]
+
+
+def ascii_lower(text):
+    # LIKE only folds the case of ascii letters
+    return "".join(c.lower() if "A" <= c <= "Z" else c for c in text)
+
+
+def pack(values):
+    return struct.pack("<%dI" % len(values), *values)
+
+
+def pack_deltas(values):
+    out = bytearray()
+    previous = 0
+    for value in values:
+        delta = value - previous
+        previous = value
+        while delta >= 0x80:
+            out.append((delta & 0x7F) | 0x80)
+            delta >>= 7
+        out.append(delta)
+    return bytes(out)
+
+
+def build(path):
+    db = sqlite3.connect(path)
+    if db.execute("SELECT name FROM sqlite_master WHERE type='table' AND name='thumbnails'").fetchone() is None:
+        print("%s: no thumbnails table, skipped" % path)
+        return
+
+    rows = db.execute("SELECT rowid, filename FROM thumbnails").fetchall()
+    rows.sort(key=lambda row: (len(row[1]), row[0]))
+    names = [ascii_lower(name) for _, name in rows]
+
+    postings = {}
+    for rank, name in enumerate(names):
+        for token in set(re.findall(r"[a-z0-9]+", name)):
+            postings.setdefault(token, []).append(rank)
+
+    for numeral, alias in NUMERALS:
+        matches = [rank for rank, name in enumerate(names)
+                   if numeral.lower() in name or alias.lower() in name]
+        postings["#" + numeral] = matches
+
+    db.execute("DROP TABLE IF EXISTS thumbnail_tokens")
+    db.execute("DROP TABLE IF EXISTS thumbnail_ranks")
+    db.execute("CREATE TABLE thumbnail_tokens(token TEXT PRIMARY KEY, postings BLOB)")
+    db.execute("CREATE TABLE thumbnail_ranks(id INTEGER PRIMARY KEY, rowids BLOB)")
+    db.executemany("INSERT INTO thumbnail_tokens(token, postings) VALUES (?, ?)",
+                   ((token, pack_deltas(ranks)) for token, ranks in sorted(postings.items())))
+    db.execute("INSERT INTO thumbnail_ranks(id, rowids) VALUES (0, ?)", (pack([rowid for rowid, _ in rows]),))
+    db.commit()
+    db.execute("VACUUM")
+    db.close()
+    print("%s: %d names, %d tokens" % (path, len(rows), len(postings)))
+
+
+if __name__ == "__main__":
+    for path in sys.argv[1:]:
+        build(path)
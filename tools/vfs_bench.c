@@ -0,0 +1,205 @@
+// Runs the sqlite I/O of the launcher through src/vfs_cache.c on the desktop.
+//
+//   record <trace> <db> <sql>   runs sql on db through the cache and writes every
+//                               sqlite read and write to trace, like vita_sqlite.c
+//                               does with VFS_TRACE on the vita
+//   replay <trace> <dir> [block_size blocks readahead_blocks write_buffer]
+//                               replays a trace on the files of dir with the same
+//                               names, first straight to the file system and then
+//                               through the cache, and compares the calls each made.
+//                               Writes land in those files, replay copies.
+//
+// build from the repository root:
+//   cc -O2 -std=gnu11 -DSQLITE_OS_OTHER=1 -DSQLITE_TEMP_STORE=3 -DSQLITE_THREADSAFE=0
+//      -Isrc -Isqlite-3.6.23.1 tools/vfs_bench.c tools/vfs_posix.c src/vfs_cache.c
+//      sqlite-3.6.23.1/sqlite3.c -lpthread -o vfs_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "vfs_posix.h"
+
+#define MAX_TRACE_FILES 32
+
+typedef struct {
+	char op;
+	long long offset;
+	int amount;
+	int file;
+} TraceOp;
+
+typedef struct {
+	TraceOp *ops;
+	int count;
+	char *paths[MAX_TRACE_FILES];
+	int files;
+} Trace;
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int count_rows(void *rows, int columns, char **values, char **names) {
+	(*(int*)rows)++;
+	return 0;
+}
+
+static int record(const char *trace_path, const char *db_path, const char *sql) {
+	FILE *trace = fopen(trace_path, "w");
+	if (trace == NULL) {
+		perror(trace_path);
+		return 1;
+	}
+	vfs_posix_register(trace);
+
+	sqlite3 *db;
+	if (sqlite3_open(db_path, &db) != SQLITE_OK) {
+		fprintf(stderr, "%s: %s\n", db_path, sqlite3_errmsg(db));
+		return 1;
+	}
+	int rows = 0;
+	char *error = NULL;
+	double start = now_ms();
+	int rc = sqlite3_exec(db, sql, count_rows, &rows, &error);
+	double elapsed = now_ms() - start;
+	sqlite3_close(db);
+	fclose(trace);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "%s\n", error);
+		sqlite3_free(error);
+		return 1;
+	}
+
+	printf("rows=%d ms=%.2f reads=%d hits=%d writes=%d backend_reads=%d read_kb=%lld backend_writes=%d write_kb=%lld\n",
+		rows, elapsed, vfs_cache_stats.reads, vfs_cache_stats.read_hits, vfs_cache_stats.writes,
+		vfs_cache_stats.backend_reads, vfs_cache_stats.backend_read_bytes / 1024,
+		vfs_cache_stats.backend_writes, vfs_cache_stats.backend_write_bytes / 1024);
+	return 0;
+}
+
+static int load_trace(const char *path, const char *dir, Trace *trace) {
+	FILE *in = fopen(path, "r");
+	if (in == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	int capacity = 1024;
+	trace->ops = (TraceOp*)malloc(capacity * sizeof(TraceOp));
+	trace->count = 0;
+	trace->files = 0;
+	char line[512];
+	while (fgets(line, sizeof(line), in) != NULL) {
+		TraceOp op;
+		int name_start = 0;
+		if (sscanf(line, "%c %lld %d %n", &op.op, &op.offset, &op.amount, &name_start) < 3 || name_start == 0)
+			continue;
+		char *name = line + name_start;
+		name[strcspn(name, "\r\n")] = 0;
+		char *base = strrchr(name, '/');
+		base = base ? base + 1 : name;
+
+		char file_path[512];
+		snprintf(file_path, sizeof(file_path), "%s/%s", dir, base);
+		op.file = -1;
+		for (int i = 0; i < trace->files; i++) {
+			if (strcmp(trace->paths[i], file_path) == 0)
+				op.file = i;
+		}
+		if (op.file < 0) {
+			if (trace->files == MAX_TRACE_FILES)
+				continue;
+			op.file = trace->files;
+			trace->paths[trace->files++] = strdup(file_path);
+		}
+
+		if (trace->count == capacity) {
+			capacity *= 2;
+			trace->ops = (TraceOp*)realloc(trace->ops, capacity * sizeof(TraceOp));
+		}
+		trace->ops[trace->count++] = op;
+	}
+	fclose(in);
+	return 1;
+}
+
+static void replay(const char *label, Trace *trace, VfsCacheConfig *config) {
+	VfsCacheFile *files[MAX_TRACE_FILES];
+	char *buf = NULL;
+	int buf_size = 0;
+
+	vfs_cache_configure(config);
+	memset(&vfs_cache_stats, 0, sizeof(vfs_cache_stats));
+	double start = now_ms();
+	for (int i = 0; i < trace->files; i++) {
+		int main_db = strstr(trace->paths[i], "-journal") == NULL;
+		files[i] = vfs_cache_open(trace->paths[i], SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+			(main_db ? SQLITE_OPEN_MAIN_DB : SQLITE_OPEN_MAIN_JOURNAL));
+		if (files[i] == NULL)
+			fprintf(stderr, "%s: can't open\n", trace->paths[i]);
+	}
+
+	for (int i = 0; i < trace->count; i++) {
+		TraceOp *op = &trace->ops[i];
+		if (files[op->file] == NULL)
+			continue;
+		if (op->amount > buf_size) {
+			buf_size = op->amount;
+			buf = (char*)realloc(buf, buf_size);
+			memset(buf, 0, buf_size);
+		}
+		if (op->op == 'r')
+			vfs_cache_read(files[op->file], buf, op->amount, op->offset);
+		else if (op->op == 'w')
+			vfs_cache_write(files[op->file], buf, op->amount, op->offset);
+	}
+
+	for (int i = 0; i < trace->files; i++) {
+		if (files[i] != NULL)
+			vfs_cache_close(files[i]);
+	}
+	double elapsed = now_ms() - start;
+	free(buf);
+
+	printf("%-8s ops=%d ms=%.2f hits=%d backend_reads=%d read_kb=%lld backend_writes=%d write_kb=%lld\n",
+		label, trace->count, elapsed, vfs_cache_stats.read_hits,
+		vfs_cache_stats.backend_reads, vfs_cache_stats.backend_read_bytes / 1024,
+		vfs_cache_stats.backend_writes, vfs_cache_stats.backend_write_bytes / 1024);
+}
+
+int main(int argc, char **argv) {
+	if (argc == 5 && strcmp(argv[1], "record") == 0)
+		return record(argv[2], argv[3], argv[4]);
+
+	if ((argc == 4 || argc == 8) && strcmp(argv[1], "replay") == 0) {
+		Trace trace;
+		if (!load_trace(argv[2], argv[3], &trace))
+			return 1;
+
+		VfsCacheConfig cached = {
+			VFS_CACHE_BLOCK_SIZE,
+			VFS_CACHE_BLOCKS,
+			VFS_CACHE_READAHEAD_BLOCKS,
+			VFS_CACHE_WRITE_BUFFER,
+		};
+		if (argc == 8) {
+			cached.block_size = atoi(argv[4]);
+			cached.blocks = atoi(argv[5]);
+			cached.readahead_blocks = atoi(argv[6]);
+			cached.write_buffer = atoi(argv[7]);
+		}
+		VfsCacheConfig direct = { cached.block_size, 0, 1, 0 };
+
+		vfs_cache_init(&posix_backend);
+		replay("direct", &trace, &direct);
+		replay("cached", &trace, &cached);
+		return 0;
+	}
+
+	fprintf(stderr, "usage: %s record <trace> <db> <sql>\n"
+		"       %s replay <trace> <dir> [block_size blocks readahead_blocks write_buffer]\n", argv[0], argv[0]);
+	return 1;
+}
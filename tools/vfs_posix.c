@@ -0,0 +1,200 @@
+// vita_sqlite.c with posix calls, so vfs_cache.c runs on the desktop
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "vfs_posix.h"
+
+static FILE *trace_file;
+
+static int posix_open(const char *name, int flags) {
+	int oflags = 0;
+	if (flags & SQLITE_OPEN_EXCLUSIVE)
+		oflags |= O_EXCL;
+	if (flags & SQLITE_OPEN_CREATE)
+		oflags |= O_CREAT;
+	if (flags & SQLITE_OPEN_READWRITE)
+		oflags |= O_RDWR;
+	else
+		oflags |= O_RDONLY;
+	if (flags & SQLITE_OPEN_MAIN_JOURNAL && !(flags & SQLITE_OPEN_EXCLUSIVE))
+		oflags |= O_CREAT;
+	return open(name, oflags, 0644);
+}
+
+static void posix_close(int fd) {
+	close(fd);
+}
+
+static int posix_read(int fd, void *buf, int amount, sqlite_int64 offset) {
+	int done = 0;
+	while (done < amount) {
+		ssize_t read = pread(fd, (char*)buf + done, amount - done, offset + done);
+		if (read < 0 && errno == EINTR)
+			continue;
+		if (read < 0)
+			return -1;
+		if (read == 0)
+			break;
+		done += read;
+	}
+	return done;
+}
+
+static int posix_write(int fd, const void *buf, int amount, sqlite_int64 offset) {
+	int done = 0;
+	while (done < amount) {
+		ssize_t written = pwrite(fd, (const char*)buf + done, amount - done, offset + done);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -1;
+		done += written;
+	}
+	return done;
+}
+
+static sqlite_int64 posix_size(int fd) {
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return 0;
+	return st.st_size;
+}
+
+static int posix_truncate(int fd, sqlite_int64 size) {
+	return ftruncate(fd, size);
+}
+
+static void* posix_mutex_create(void) {
+	pthread_mutex_t *mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(mutex, NULL);
+	return mutex;
+}
+
+static void posix_mutex_lock(void *mutex) {
+	pthread_mutex_lock((pthread_mutex_t*)mutex);
+}
+
+static void posix_mutex_unlock(void *mutex) {
+	pthread_mutex_unlock((pthread_mutex_t*)mutex);
+}
+
+static void posix_mutex_delete(void *mutex) {
+	pthread_mutex_destroy((pthread_mutex_t*)mutex);
+	free(mutex);
+}
+
+static void posix_trace(char op, const char *path, sqlite_int64 offset, int amount) {
+	fprintf(trace_file, "%c %lld %d %s\n", op, (long long)offset, amount, path);
+}
+
+const VfsBackend posix_backend = {
+	posix_open,
+	posix_close,
+	posix_read,
+	posix_write,
+	posix_size,
+	posix_truncate,
+	posix_mutex_create,
+	posix_mutex_lock,
+	posix_mutex_unlock,
+	posix_mutex_delete,
+	NULL,
+};
+
+static VfsBackend traced_backend;
+
+static int posix_xDelete(sqlite3_vfs *vfs, const char *name, int syncDir) {
+	if (unlink(name) < 0 && errno != ENOENT)
+		return SQLITE_IOERR_DELETE;
+	return SQLITE_OK;
+}
+
+static int posix_xAccess(sqlite3_vfs *vfs, const char *name, int flags, int *pResOut) {
+	*pResOut = access(name, flags == SQLITE_ACCESS_EXISTS ? F_OK : R_OK | W_OK) == 0;
+	return SQLITE_OK;
+}
+
+static int posix_xFullPathname(sqlite3_vfs *vfs, const char *zName, int nOut, char *zOut) {
+	snprintf(zOut, nOut, "%s", zName);
+	return SQLITE_OK;
+}
+
+static void* posix_xDlOpen(sqlite3_vfs *vfs, const char *zFilename) {
+	return NULL;
+}
+
+static void posix_xDlError(sqlite3_vfs *vfs, int nByte, char *zErrMsg) {
+}
+
+static void (*posix_xDlSym(sqlite3_vfs *vfs, void *p, const char *zSymbol))(void) {
+	return NULL;
+}
+
+static void posix_xDlClose(sqlite3_vfs *vfs, void *p) {
+}
+
+static int posix_xRandomness(sqlite3_vfs *vfs, int nByte, char *zOut) {
+	for (int i = 0; i < nByte; i++)
+		zOut[i] = rand();
+	return nByte;
+}
+
+static int posix_xSleep(sqlite3_vfs *vfs, int microseconds) {
+	usleep(microseconds);
+	return microseconds;
+}
+
+static int posix_xCurrentTime(sqlite3_vfs *vfs, double *pTime) {
+	*pTime = time(NULL) / 86400.0 + 2440587.5;
+	return SQLITE_OK;
+}
+
+static int posix_xGetLastError(sqlite3_vfs *vfs, int e, char *err) {
+	return 0;
+}
+
+static sqlite3_vfs posix_vfs = {
+	.iVersion = 1,
+	.szOsFile = sizeof(VfsFile),
+	.mxPathname = 0x100,
+	.pNext = NULL,
+	.zName = "posix_cache",
+	.pAppData = NULL,
+	.xOpen = vfs_cache_xOpen,
+	.xDelete = posix_xDelete,
+	.xAccess = posix_xAccess,
+	.xFullPathname = posix_xFullPathname,
+	.xDlOpen = posix_xDlOpen,
+	.xDlError = posix_xDlError,
+	.xDlSym = posix_xDlSym,
+	.xDlClose = posix_xDlClose,
+	.xRandomness = posix_xRandomness,
+	.xSleep = posix_xSleep,
+	.xCurrentTime = posix_xCurrentTime,
+	.xGetLastError = posix_xGetLastError,
+};
+
+void vfs_posix_register(FILE *trace) {
+	traced_backend = posix_backend;
+	if (trace != NULL) {
+		trace_file = trace;
+		traced_backend.trace = posix_trace;
+	}
+	vfs_cache_init(&traced_backend);
+	sqlite3_vfs_register(&posix_vfs, 1);
+}
+
+int sqlite3_os_init(void) {
+	return SQLITE_OK;
+}
+
+int sqlite3_os_end(void) {
+	return SQLITE_OK;
+}
@@ -0,0 +1,13 @@
+#ifndef LAUNCHER_VFS_POSIX_H
+#define LAUNCHER_VFS_POSIX_H
+
+#include <stdio.h>
+#include "vfs_cache.h"
+
+extern const VfsBackend posix_backend;
+
+// Registers the posix vfs as the default one. Every sqlite read and write is
+// logged to trace in the format of vita_sqlite.c when trace isn't NULL.
+void vfs_posix_register(FILE *trace);
+
+#endif